@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Packet-rate benchmark for the udp_proxy route.
+// Runs an echo upstream on ECHO_PORT and NUM_CLIENTS clients that keep
+// WINDOW datagrams in flight through the proxy, using recvmmsg()/sendmmsg()
+// on both ends so the proxy is the bottleneck. Pass the echo port as the
+// target to measure the loopback path without the proxy.
+//
+//   gcc -O2 -o udp_rate udp_rate.c -lpthread
+//   ./udp_rate 8005            # proxy on 8005, upstream "localhost:3005"
+
+#define SERVER_ADDR "127.0.0.1"
+#define ECHO_PORT 3005
+#define NUM_CLIENTS 4
+#define WINDOW 64
+#define BATCH_SIZE 32
+#define DGRAM_SIZE 64
+#define DURATION_SEC 5
+
+int target_port;
+volatile int running = 1;
+long sent_total, received_total;
+
+struct sockaddr_in make_addr(int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(SERVER_ADDR);
+    addr.sin_port = htons(port);
+    return addr;
+}
+
+// Echoes every datagram back to its sender, a batch at a time
+void *echo_thread(void *arg) {
+    int sockfd = *(int *)arg;
+    char bufs[BATCH_SIZE][DGRAM_SIZE];
+    struct mmsghdr msgs[BATCH_SIZE];
+    struct iovec iovs[BATCH_SIZE];
+    struct sockaddr_in addrs[BATCH_SIZE];
+
+    while (1) {
+        for (int i = 0; i < BATCH_SIZE; i++) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = DGRAM_SIZE;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+
+        int n = recvmmsg(sockfd, msgs, BATCH_SIZE, MSG_WAITFORONE, NULL);
+        if (n <= 0)
+            continue;
+        for (int i = 0; i < n; i++)
+            iovs[i].iov_len = msgs[i].msg_len;
+        sendmmsg(sockfd, msgs, n, 0);
+    }
+
+    return NULL;
+}
+
+// Sends n datagrams on a connected socket; returns how many went out
+int send_batch(int sockfd, char *buf, int n) {
+    struct mmsghdr msgs[BATCH_SIZE];
+    struct iovec iov = {.iov_base = buf, .iov_len = DGRAM_SIZE};
+    int total = 0;
+
+    while (total < n) {
+        int batch = n - total < BATCH_SIZE ? n - total : BATCH_SIZE;
+        memset(msgs, 0, sizeof(msgs[0]) * batch);
+        for (int i = 0; i < batch; i++) {
+            msgs[i].msg_hdr.msg_iov = &iov;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int sent = sendmmsg(sockfd, msgs, batch, 0);
+        if (sent <= 0)
+            break;
+        total += sent;
+    }
+
+    return total;
+}
+
+// Keeps WINDOW datagrams in flight; a datagram lost on the way is replaced after a timeout
+void *client_thread(void *arg) {
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in server_addr = make_addr(target_port);
+    if (sockfd < 0 || connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0) {
+        perror("[ERROR] client socket");
+        return NULL;
+    }
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = 100000};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char out[DGRAM_SIZE];
+    memset(out, 'x', sizeof(out));
+    char bufs[BATCH_SIZE][DGRAM_SIZE];
+    struct mmsghdr msgs[BATCH_SIZE];
+    struct iovec iovs[BATCH_SIZE];
+    long sent = send_batch(sockfd, out, WINDOW), received = 0;
+
+    while (running) {
+        for (int i = 0; i < BATCH_SIZE; i++) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = DGRAM_SIZE;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int n = recvmmsg(sockfd, msgs, BATCH_SIZE, MSG_WAITFORONE, NULL);
+        if (n > 0) {
+            received += n;
+            sent += send_batch(sockfd, out, n);
+        } else {
+            // Nothing came back in time: the window was lost, refill it
+            sent += send_batch(sockfd, out, WINDOW);
+        }
+    }
+
+    __atomic_add_fetch(&sent_total, sent, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&received_total, received, __ATOMIC_RELAXED);
+    close(sockfd);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <port>  (proxy port, or %d for the echo upstream alone)\n", argv[0],
+                ECHO_PORT);
+        return 1;
+    }
+    target_port = atoi(argv[1]);
+
+    // Echo upstream
+    int echo_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in echo_addr = make_addr(ECHO_PORT);
+    if (echo_fd < 0 || bind(echo_fd, (struct sockaddr *)&echo_addr, sizeof(echo_addr)) != 0) {
+        perror("[ERROR] echo bind");
+        return 1;
+    }
+    pthread_t echo_id;
+    pthread_create(&echo_id, NULL, echo_thread, &echo_fd);
+
+    pthread_t client_ids[NUM_CLIENTS];
+    for (int i = 0; i < NUM_CLIENTS; i++)
+        pthread_create(&client_ids[i], NULL, client_thread, NULL);
+
+    sleep(DURATION_SEC);
+    running = 0;
+    for (int i = 0; i < NUM_CLIENTS; i++)
+        pthread_join(client_ids[i], NULL);
+
+    printf("[INFO] %d clients, window %d, %d-byte datagrams, %d sec\n", NUM_CLIENTS, WINDOW,
+           DGRAM_SIZE, DURATION_SEC);
+    printf("[INFO] sent %ld, echoed back %ld (%.1f%% lost)\n", sent_total, received_total,
+           sent_total ? 100.0 * (sent_total - received_total) / sent_total : 0);
+    printf("[INFO] %.0f round trips/sec\n", (double)received_total / DURATION_SEC);
+
+    close(echo_fd);
+    return 0;
+}
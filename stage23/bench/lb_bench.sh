@@ -0,0 +1,51 @@
+#!/bin/bash
+# Compares load balancing strategies against one slow and two fast upstreams.
+# Usage: ./lb_bench.sh [clients] [requests] [slow_delay_msec]
+# Needs ../src/xps (built with ../src/build.sh, or set XPS=<binary>) and ports 8002, 3002-3004 free.
+
+CLIENTS=${1:-16}
+REQUESTS=${2:-4000}
+SLOW_MSEC=${3:-200}
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+XPS=${XPS:-$BENCH_DIR/../src/xps}
+OUT=$(mktemp -d)
+
+gcc -O2 -o $OUT/slow_upstream $BENCH_DIR/slow_upstream.c -lpthread || exit 1
+gcc -O2 -o $OUT/lb_load $BENCH_DIR/lb_load.c -lpthread || exit 1
+
+$OUT/slow_upstream 3002 $SLOW_MSEC & PIDS="$!"
+$OUT/slow_upstream 3003 5 & PIDS="$PIDS $!"
+$OUT/slow_upstream 3004 5 & PIDS="$PIDS $!"
+trap 'kill $PIDS 2>/dev/null; rm -rf $OUT' EXIT
+
+for strategy in round_robin least_conn ewma; do
+  cat > $OUT/config.json <<EOF
+{
+  "server_name": "eXpServer",
+  "workers": 4,
+  "servers": [
+    {
+      "listeners": [{ "host": "0.0.0.0", "port": 8002 }],
+      "routes": [
+        {
+          "req_path": "/",
+          "type": "reverse_proxy",
+          "upstreams": ["localhost:3002", "localhost:3003", "localhost:3004"],
+          "load_balancing": "$strategy"
+        }
+      ]
+    }
+  ]
+}
+EOF
+  (cd $BENCH_DIR/../src && exec $XPS $OUT/config.json > $OUT/xps.log 2>&1) &
+  XPS_PID=$!
+  sleep 1
+
+  echo "== $strategy"
+  $OUT/lb_load 8002 $CLIENTS $REQUESTS
+
+  kill -INT $XPS_PID
+  wait $XPS_PID
+done
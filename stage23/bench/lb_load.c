@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/*
+ * Closed-loop HTTP load generator for the reverse proxy. Each client thread
+ * sends GET requests on fresh connections, one at a time, and records the
+ * latency. Prints latency percentiles and how many responses each upstream
+ * (identified by the slow_upstream.c body) served.
+ *
+ *   gcc -O2 -o lb_load lb_load.c -lpthread
+ *   ./lb_load 8002 16 800     # port, clients, total requests
+ */
+
+#define SERVER_ADDR "127.0.0.1"
+#define BUFF_SIZE 8192
+#define MAX_BODIES 16
+
+int server_port;
+int n_requests;
+int next_request;
+long *latencies_usec;
+
+char bodies[MAX_BODIES][64];
+int body_counts[MAX_BODIES];
+int n_errors;
+pthread_mutex_t result_lock = PTHREAD_MUTEX_INITIALIZER;
+
+long now_usec() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+/* Sends one request on a new connection and reads the response; returns the body or NULL */
+char *send_request(int id, char *buff, size_t buff_size) {
+  int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock_fd < 0)
+    return NULL;
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr(SERVER_ADDR);
+  addr.sin_port = htons(server_port);
+
+  if (connect(sock_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(sock_fd);
+    return NULL;
+  }
+
+  char req[128];
+  int req_len = snprintf(req, sizeof(req),
+                         "GET /r%d HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n", id);
+  if (send(sock_fd, req, req_len, MSG_NOSIGNAL) != req_len) {
+    close(sock_fd);
+    return NULL;
+  }
+
+  // Read until the Content-Length body is in; the proxy may keep the connection open
+  size_t len = 0;
+  ssize_t read_n;
+  char *body = NULL;
+  while (len < buff_size - 1 && (read_n = recv(sock_fd, buff + len, buff_size - len - 1, 0)) > 0) {
+    len += read_n;
+    buff[len] = '\0';
+    if (body == NULL && (body = strstr(buff, "\r\n\r\n")) != NULL)
+      body += 4;
+    char *content_length = strcasestr(buff, "\r\nContent-Length:");
+    if (body && content_length && content_length < body &&
+        buff + len - body >= atol(content_length + 17))
+      break;
+  }
+  close(sock_fd);
+
+  if (body == NULL || strncmp(buff, "HTTP/1.1 200", 12) != 0)
+    return NULL;
+  return body;
+}
+
+void *client_thread(void *ptr) {
+  char buff[BUFF_SIZE];
+
+  while (1) {
+    int id = __atomic_fetch_add(&next_request, 1, __ATOMIC_RELAXED);
+    if (id >= n_requests)
+      break;
+
+    long start_usec = now_usec();
+    char *body = send_request(id, buff, sizeof(buff));
+    latencies_usec[id] = now_usec() - start_usec;
+
+    pthread_mutex_lock(&result_lock);
+    if (body == NULL) {
+      n_errors++;
+    } else {
+      body[strcspn(body, "\r\n")] = '\0';
+      for (int i = 0; i < MAX_BODIES; i++) {
+        if (bodies[i][0] == '\0')
+          snprintf(bodies[i], sizeof(bodies[i]), "%s", body);
+        if (strcmp(bodies[i], body) == 0) {
+          body_counts[i]++;
+          break;
+        }
+      }
+    }
+    pthread_mutex_unlock(&result_lock);
+  }
+
+  return NULL;
+}
+
+int compare_long(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s <port> <clients> <requests>\n", argv[0]);
+    return 1;
+  }
+  server_port = atoi(argv[1]);
+  int n_clients = atoi(argv[2]);
+  n_requests = atoi(argv[3]);
+  if (n_clients <= 0 || n_requests <= 0)
+    return 1;
+
+  latencies_usec = calloc(n_requests, sizeof(long));
+  pthread_t *threads = calloc(n_clients, sizeof(pthread_t));
+  if (latencies_usec == NULL || threads == NULL)
+    return 1;
+
+  long start_usec = now_usec();
+  for (int i = 0; i < n_clients; i++)
+    pthread_create(&threads[i], NULL, client_thread, NULL);
+  for (int i = 0; i < n_clients; i++)
+    pthread_join(threads[i], NULL);
+  double secs = (now_usec() - start_usec) / 1e6;
+
+  qsort(latencies_usec, n_requests, sizeof(long), compare_long);
+  long sum = 0;
+  for (int i = 0; i < n_requests; i++)
+    sum += latencies_usec[i];
+
+  printf("requests %d  errors %d  %.0f req/s\n", n_requests, n_errors, n_requests / secs);
+  printf("latency ms: mean %.1f  p50 %.1f  p95 %.1f  p99 %.1f  max %.1f\n",
+         sum / 1000.0 / n_requests, latencies_usec[n_requests / 2] / 1000.0,
+         latencies_usec[(int)(n_requests * 0.95)] / 1000.0,
+         latencies_usec[(int)(n_requests * 0.99)] / 1000.0,
+         latencies_usec[n_requests - 1] / 1000.0);
+  for (int i = 0; i < MAX_BODIES && bodies[i][0] != '\0'; i++)
+    printf("  %-12s %d\n", bodies[i], body_counts[i]);
+
+  free(threads);
+  free(latencies_usec);
+  return n_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+#include "xps.h"
+
+/*
+ * Checks the ip_hash Maglev table: how evenly it spreads keys, and what
+ * fraction of keys move when one upstream is removed or added. Exits with 1
+ * if a bound is broken. Compared with the old ip % n for reference.
+ *
+ *   ./build.sh maglev_remap.c maglev_remap && ./maglev_remap
+ */
+
+#define N_UPSTREAMS 10
+#define N_KEYS 1000000
+#define REMOVED 3
+
+#define MAX_IMBALANCE 0.05     // share of any upstream vs the ideal 1/n
+#define MAX_STRAY_REMAP 0.02   // removal: keys moved that were not on the removed upstream
+#define MAX_REMAP_FACTOR 1.25  // addition: keys moved vs the ideal 1/(n+1)
+
+xps_core_t **cores;
+int n_cores;
+
+void config_build_maglev(xps_config_route_t *route);
+
+/* Route with upstreams 10.0.0.1:80 .. 10.0.0.n:80, except skip; upstream heavy has weight 2 */
+xps_config_route_t *route_create(int n, int skip, int heavy) {
+  xps_config_route_t *route = calloc(1, sizeof(xps_config_route_t));
+  vec_init(&(route->upstreams));
+  vec_init(&(route->upstream_weights));
+  vec_init(&(route->_maglev_table));
+
+  for (int i = 0; i < n; i++) {
+    if (i == skip)
+      continue;
+    char *upstream = malloc(32);
+    sprintf(upstream, "10.0.0.%d:80", i + 1);
+    vec_push(&(route->upstreams), upstream);
+    vec_push(&(route->upstream_weights), i == heavy ? 2 : 1);
+  }
+  config_build_maglev(route);
+
+  return route;
+}
+
+void route_destroy(xps_config_route_t *route) {
+  for (int i = 0; i < route->upstreams.length; i++)
+    free(route->upstreams.data[i]);
+  vec_deinit(&(route->upstreams));
+  vec_deinit(&(route->upstream_weights));
+  vec_deinit(&(route->_maglev_table));
+  free(route);
+}
+
+const char *route_pick(xps_config_route_t *route, u_long key_hash) {
+  int index = route->_maglev_table.data[key_hash % route->_maglev_table.length];
+  return route->upstreams.data[index];
+}
+
+int main() {
+  xps_config_route_t *full = route_create(N_UPSTREAMS, -1, -1);
+  xps_config_route_t *removed = route_create(N_UPSTREAMS, REMOVED, -1);
+  xps_config_route_t *added = route_create(N_UPSTREAMS + 1, -1, -1);
+  xps_config_route_t *weighted = route_create(N_UPSTREAMS, -1, 0);
+
+  char removed_name[32];
+  sprintf(removed_name, "10.0.0.%d:80", REMOVED + 1);
+
+  int counts[N_UPSTREAMS] = {0}, weighted_counts[N_UPSTREAMS] = {0};
+  int stray_remap = 0, add_remap = 0, mod_remove_remap = 0, mod_add_remap = 0;
+
+  for (u_int ip = 0; ip < N_KEYS; ip++) {
+    u_long key_hash = hash_bytes(&ip, sizeof(ip), 0);
+    const char *before = route_pick(full, key_hash);
+
+    counts[full->_maglev_table.data[key_hash % MAGLEV_TABLE_SIZE]]++;
+    weighted_counts[weighted->_maglev_table.data[key_hash % MAGLEV_TABLE_SIZE]]++;
+
+    if (strcmp(before, removed_name) != 0 && strcmp(before, route_pick(removed, key_hash)) != 0)
+      stray_remap++;
+    if (strcmp(before, route_pick(added, key_hash)) != 0)
+      add_remap++;
+
+    if (ip % N_UPSTREAMS != ip % (N_UPSTREAMS - 1))
+      mod_remove_remap++;
+    if (ip % N_UPSTREAMS != ip % (N_UPSTREAMS + 1))
+      mod_add_remap++;
+  }
+
+  int failed = 0;
+
+  // Spread over equal upstreams, and twice the share for weight 2
+  double ideal = (double)N_KEYS / N_UPSTREAMS;
+  double max_imbalance = 0;
+  for (int i = 0; i < N_UPSTREAMS; i++) {
+    double imbalance = counts[i] > ideal ? counts[i] / ideal - 1 : 1 - counts[i] / ideal;
+    if (imbalance > max_imbalance)
+      max_imbalance = imbalance;
+  }
+  printf("balance:  max %.2f%% off the ideal share over %d upstreams\n", 100 * max_imbalance,
+         N_UPSTREAMS);
+  if (max_imbalance > MAX_IMBALANCE)
+    failed = 1;
+
+  double heavy_share = (double)weighted_counts[0] / N_KEYS;
+  double heavy_ideal = 2.0 / (N_UPSTREAMS + 1);
+  printf("weight 2: %.2f%% of keys (ideal %.2f%%)\n", 100 * heavy_share, 100 * heavy_ideal);
+  if (heavy_share < heavy_ideal * (1 - MAX_IMBALANCE) || heavy_share > heavy_ideal * (1 + MAX_IMBALANCE))
+    failed = 1;
+
+  // Removing an upstream should only move the keys it had
+  double stray = (double)stray_remap / N_KEYS;
+  printf("remove 1 of %d: %.2f%% of the other keys moved (modulo: %.2f%% of all keys)\n",
+         N_UPSTREAMS, 100 * stray, 100.0 * mod_remove_remap / N_KEYS);
+  if (stray > MAX_STRAY_REMAP)
+    failed = 1;
+
+  // Adding one should move about 1/(n+1) of the keys, all to the new upstream
+  double moved = (double)add_remap / N_KEYS;
+  double moved_ideal = 1.0 / (N_UPSTREAMS + 1);
+  printf("add 1 to %d:    %.2f%% of keys moved (ideal %.2f%%, modulo: %.2f%%)\n", N_UPSTREAMS,
+         100 * moved, 100 * moved_ideal, 100.0 * mod_add_remap / N_KEYS);
+  if (moved > moved_ideal * MAX_REMAP_FACTOR)
+    failed = 1;
+
+  route_destroy(full);
+  route_destroy(removed);
+  route_destroy(added);
+  route_destroy(weighted);
+
+  printf("%s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,125 @@
+#include "xps.h"
+
+/*
+ * Times route matching (config_resolve(), which xps_config_lookup() runs on
+ * a lookup cache miss) for 10 servers of 10, 100 and 1000 routes each. The
+ * time per lookup should not grow with the number of routes. Exits with 1
+ * if a lookup matches the wrong route.
+ *
+ *   ./build.sh route_lookup.c route_lookup && ./route_lookup
+ */
+
+#define N_SERVERS 10
+#define N_LOOKUPS 200000
+#define PORT 9000
+
+xps_core_t **cores;
+int n_cores;
+
+int config_resolve(xps_config_t *config, xps_listener_t *listener, const char *h_host,
+                   const char *h_pathname, xps_config_cache_entry_t *entry);
+void config_cache_entry_clear(xps_config_cache_entry_t *entry);
+
+/* Writes a config of N_SERVERS servers on one port, told apart by hostname, each with n_routes */
+int config_write(const char *path, int n_routes) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+    return E_FAIL;
+
+  fprintf(file, "{\"server_name\": \"bench\", \"workers\": 1, \"servers\": [");
+  for (int s = 0; s < N_SERVERS; s++) {
+    fprintf(file, "%s{\"listeners\": [{\"host\": \"0.0.0.0\", \"port\": %d}], ", s ? ", " : "", PORT);
+    fprintf(file, "\"hostnames\": [\"host%d.example.com\"], \"routes\": [", s);
+    for (int r = 0; r < n_routes; r++)
+      fprintf(file,
+              "%s{\"req_path\": \"/service%d/v1/items\", \"type\": \"redirect\", "
+              "\"http_status_code\": 302, \"redirect_url\": \"http://s%d/r%d\"}",
+              r ? ", " : "", r, s, r);
+    fprintf(file, "]}");
+  }
+  fprintf(file, "]}\n");
+
+  fclose(file);
+  return OK;
+}
+
+double now_sec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Average ns to resolve pathname on host; -1 if it does not match expected_req_path,
+ * or matches a route when expected_req_path is NULL */
+double time_lookup(xps_config_t *config, const char *host, const char *pathname,
+                   const char *expected_req_path) {
+  xps_listener_t listener;
+  memset(&listener, 0, sizeof(listener));
+  listener.host = "0.0.0.0";
+  listener.port = PORT;
+
+  xps_config_cache_entry_t entry;
+  memset(&entry, 0, sizeof(entry));
+
+  if (config_resolve(config, &listener, host, pathname, &entry) != OK)
+    return -1;
+  bool matched = entry.result == OK;
+  if (matched != (expected_req_path != NULL) ||
+      (matched && strcmp(entry.route->req_path, expected_req_path) != 0))
+    return -1;
+  config_cache_entry_clear(&entry);
+
+  double start = now_sec();
+  for (int i = 0; i < N_LOOKUPS; i++) {
+    config_resolve(config, &listener, host, pathname, &entry);
+    config_cache_entry_clear(&entry);
+  }
+
+  return (now_sec() - start) * 1e9 / N_LOOKUPS;
+}
+
+int main() {
+  int route_counts[] = {10, 100, 1000};
+  char path[] = "/tmp/route_lookup_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp()");
+    return 1;
+  }
+  close(fd);
+
+  int failed = 0;
+  printf("%-8s %-14s %-14s %-14s\n", "routes", "first route", "last route", "no match");
+  for (int i = 0; i < 3; i++) {
+    int n_routes = route_counts[i];
+    if (config_write(path, n_routes) != OK) {
+      perror("config_write()");
+      failed = 1;
+      break;
+    }
+    xps_config_t *config = xps_config_create(path);
+    if (config == NULL) {
+      failed = 1;
+      break;
+    }
+
+    char last_req_path[64], last_pathname[64], host[64];
+    sprintf(last_req_path, "/service%d/v1/items", n_routes - 1);
+    sprintf(last_pathname, "%s/42", last_req_path);
+    sprintf(host, "host%d.example.com", N_SERVERS - 1);
+
+    double first = time_lookup(config, host, "/service0/v1/items/42", "/service0/v1/items");
+    double last = time_lookup(config, host, last_pathname, last_req_path);
+    double none = time_lookup(config, host, "/nothing/here", NULL);
+
+    printf("%-8d %-14.0f %-14.0f %-14.0f ns/lookup\n", n_routes, first, last, none);
+    if (first < 0 || last < 0 || none < 0)
+      failed = 1;
+
+    xps_config_destroy(config);
+  }
+
+  unlink(path);
+  printf("%s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
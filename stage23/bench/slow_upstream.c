@@ -0,0 +1,107 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Stand-in HTTP upstream that answers every request after a fixed delay.
+ * The body names the port so the load generator can count where requests went.
+ *
+ *   gcc -O2 -o slow_upstream slow_upstream.c -lpthread
+ *   ./slow_upstream 3002 200    # answers after 200 ms
+ */
+
+#define BACKLOG 128
+#define BUFF_SIZE 8192
+
+int port;
+int delay_msec;
+
+void *client_thread(void *ptr) {
+  int sock_fd = (int)(long)ptr;
+  char buff[BUFF_SIZE];
+  size_t len = 0;
+  int alive = 1;
+
+  while (alive) {
+    ssize_t read_n = recv(sock_fd, buff + len, sizeof(buff) - len - 1, 0);
+    if (read_n <= 0)
+      break;
+    len += read_n;
+    buff[len] = '\0';
+
+    // Answer each complete request head; bodies are not expected
+    char *end;
+    while ((end = strstr(buff, "\r\n\r\n")) != NULL) {
+      usleep(delay_msec * 1000);
+
+      char body[64];
+      int body_len = snprintf(body, sizeof(body), "port %d\n", port);
+      char res[256];
+      int res_len = snprintf(res, sizeof(res),
+                             "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                             "Content-Length: %d\r\n\r\n%s",
+                             body_len, body);
+      if (send(sock_fd, res, res_len, MSG_NOSIGNAL) != res_len) {
+        alive = 0;
+        break;
+      }
+
+      size_t used = end + 4 - buff;
+      memmove(buff, buff + used, len - used + 1);
+      len -= used;
+    }
+    if (len == sizeof(buff) - 1)
+      break;
+  }
+
+  close(sock_fd);
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <port> <delay_msec>\n", argv[0]);
+    return 1;
+  }
+  port = atoi(argv[1]);
+  delay_msec = atoi(argv[2]);
+
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    perror("socket()");
+    return 1;
+  }
+  int on = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_port = htons(port);
+
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listen_fd, BACKLOG) != 0) {
+    perror("bind()/listen()");
+    return 1;
+  }
+
+  while (1) {
+    int sock_fd = accept(listen_fd, NULL, NULL);
+    if (sock_fd < 0)
+      continue;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, client_thread, (void *)(long)sock_fd) != 0) {
+      close(sock_fd);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+
+  return 0;
+}
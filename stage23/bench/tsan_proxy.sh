@@ -0,0 +1,69 @@
+#!/bin/bash
+# Builds the server with ThreadSanitizer and drives every load balancing
+# strategy on 4 worker cores. Fails if ThreadSanitizer reports anything.
+# Usage: ./tsan_proxy.sh [clients] [requests per strategy]
+# Needs ports 8010-8013 and 3002-3004 free.
+
+CLIENTS=${1:-32}
+REQUESTS=${2:-4000}
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+OUT=$(mktemp -d)
+
+# build.sh with -fsanitize=thread in place of -fsanitize=address
+sed -e 's/-fsanitize=address/-fsanitize=thread -O1/' -e "s#-o xps#-o $OUT/xps_tsan#" \
+    $BENCH_DIR/../src/build.sh > $OUT/build_tsan.sh
+(cd $BENCH_DIR/../src && bash $OUT/build_tsan.sh) || exit 1
+gcc -O2 -o $OUT/slow_upstream $BENCH_DIR/slow_upstream.c -lpthread || exit 1
+gcc -O2 -o $OUT/lb_load $BENCH_DIR/lb_load.c -lpthread || exit 1
+
+$OUT/slow_upstream 3002 20 & PIDS="$!"
+$OUT/slow_upstream 3003 1 & PIDS="$PIDS $!"
+$OUT/slow_upstream 3004 1 & PIDS="$PIDS $!"
+trap 'kill $PIDS 2>/dev/null; rm -rf $OUT' EXIT
+
+PORT=8010
+SERVERS=""
+for strategy in round_robin least_conn ewma ip_hash; do
+  SERVERS="$SERVERS${SERVERS:+,}
+    {
+      \"listeners\": [{ \"host\": \"0.0.0.0\", \"port\": $PORT }],
+      \"routes\": [
+        {
+          \"req_path\": \"/\",
+          \"type\": \"reverse_proxy\",
+          \"upstreams\": [\"localhost:3002\", \"localhost:3003\", { \"upstream\": \"localhost:3004\", \"weight\": 2 }],
+          \"load_balancing\": \"$strategy\"
+        }
+      ]
+    }"
+  PORT=$((PORT + 1))
+done
+cat > $OUT/config.json <<EOF
+{
+  "server_name": "eXpServer",
+  "workers": 4,
+  "servers": [$SERVERS
+  ]
+}
+EOF
+
+(cd $BENCH_DIR/../src && TSAN_OPTIONS=halt_on_error=0 exec setarch $(uname -m) -R \
+    $OUT/xps_tsan $OUT/config.json > $OUT/xps.log 2>&1) &
+XPS_PID=$!
+sleep 2
+kill -0 $XPS_PID 2>/dev/null || { cat $OUT/xps.log; exit 1; }
+
+PORT=8010
+for strategy in round_robin least_conn ewma ip_hash; do
+  echo "== $strategy"
+  $OUT/lb_load $PORT $CLIENTS $REQUESTS
+  PORT=$((PORT + 1))
+done
+
+kill -INT $XPS_PID
+wait $XPS_PID
+
+REPORTS=$(grep -c "WARNING: ThreadSanitizer" $OUT/xps.log)
+echo "ThreadSanitizer reports: $REPORTS"
+[ "$REPORTS" -eq 0 ] || { grep "SUMMARY: ThreadSanitizer" $OUT/xps.log | sort | uniq -c; exit 1; }
@@ -2,9 +2,9 @@ gcc -g -lz -fsanitize=address \
     main.c \
     lib/vec/vec.c lib/parson/parson.c \
     config/xps_config.c \
-    core/xps_core.c core/xps_loop.c core/xps_pipe.c core/xps_session.c core/xps_timer.c core/xps_metrics.c\
+    core/xps_core.c core/xps_loop.c core/xps_pipe.c core/xps_session.c core/xps_splice.c core/xps_tcp_session.c core/xps_timer.c core/xps_udp_proxy.c core/xps_metrics.c core/xps_reload.c \
     disk/xps_file.c disk/xps_mime.c disk/xps_directory.c disk/xps_gzip.c \
-    http/xps_http.c http/xps_http_req.c http/xps_http_res.c \
-    network/xps_connection.c network/xps_listener.c network/xps_upstream.c \
-    utils/xps_logger.c utils/xps_utils.c utils/xps_buffer.c utils/xps_cliargs.c \
+    http/xps_http.c http/xps_http_body.c http/xps_http_req.c http/xps_http_res.c http/xps_http_res_parser.c \
+    network/xps_connection.c network/xps_dns.c network/xps_health.c network/xps_listener.c network/xps_upstream.c \
+    utils/xps_acl.c utils/xps_logger.c utils/xps_utils.c utils/xps_buffer.c utils/xps_cliargs.c \
     -o xps
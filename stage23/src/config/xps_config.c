@@ -1,10 +1,57 @@
+#include "../xps.h" // sessions embed a lookup, so xps_config.h must be read before them
 #include "xps_config.h"
 #include <stdio.h>
 
-void parse_server(JSON_Object *server_object, xps_config_server_t *server);
-void parse_listener(JSON_Object *listener_object, xps_config_listener_t *listener);
-void parse_route(JSON_Object *route_object, xps_config_route_t *route);
-void parse_all_listeners(vec_void_t *_all_listeners, xps_config_server_t *server);
+int parse_server(JSON_Object *server_object, xps_config_server_t *server);
+int parse_listener(JSON_Object *listener_object, xps_config_listener_t *listener);
+int parse_route(JSON_Object *route_object, xps_config_route_t *route);
+int parse_all_listeners(vec_void_t *_all_listeners, xps_config_server_t *server);
+int config_parse_workers(xps_config_t *config, JSON_Object *root_object);
+u_long config_get_number(JSON_Object *object, const char *name, u_long min, u_long max,
+                         u_long def, int *error);
+xps_config_listener_t *config_metrics_listener_create(xps_config_t *config);
+int compile_res_templates(xps_config_t *config);
+void config_build_schedule(xps_config_route_t *route);
+void config_build_maglev(xps_config_route_t *route);
+u_long config_hash_key(xps_config_route_t *route, xps_http_req_t *http_req,
+                       const struct in6_addr *client_addr);
+const char *config_cookie_value(const char *cookies, const char *name, size_t *len);
+int config_pick_maglev(xps_config_route_t *route, u_long key_hash, u_long now_msec);
+int config_pick_upstream(xps_config_route_t *route, u_long start, u_long now_msec);
+int config_pick_least_conn(xps_config_route_t *route, u_long start, u_long now_msec);
+int config_pick_ewma(xps_config_route_t *route, xps_core_t *core);
+bool config_upstream_is_up(xps_config_route_t *route, int index, u_long now_msec);
+int config_build_route_trie(xps_config_server_t *server);
+xps_config_route_node_t *config_route_node_create(const char *label, size_t label_len);
+void config_route_node_destroy(xps_config_route_node_t *node);
+xps_config_route_node_t *config_route_node_child(xps_config_route_node_t *node, char first,
+                                                 int *child_index);
+xps_config_route_t *config_route_trie_match(xps_config_route_node_t *root, const char *path);
+int config_build_server_map(xps_config_t *config);
+u_long config_server_key_hash(const char *host, u_int port, const char *hostname);
+int config_server_map_put(xps_config_t *config, const char *host, u_int port,
+                          const char *hostname, int server_index);
+int config_server_map_get(xps_config_t *config, const char *host, u_int port,
+                          const char *hostname);
+int config_resolve(xps_config_t *config, xps_listener_t *listener, const char *h_host,
+                   const char *h_pathname, xps_config_cache_entry_t *entry);
+u_long config_cache_key_hash(xps_listener_t *listener, const char *host, const char *pathname);
+xps_config_cache_entry_t *config_cache_get(xps_config_cache_t *cache, xps_config_t *config,
+                                           xps_listener_t *listener, const char *host,
+                                           const char *pathname, u_long now_msec);
+xps_config_cache_entry_t *config_cache_put(xps_config_cache_t *cache, xps_config_t *config,
+                                           xps_listener_t *listener, const char *host,
+                                           const char *pathname, u_long now_msec);
+void config_cache_entry_clear(xps_config_cache_entry_t *entry);
+void config_build_acl_routes(xps_config_t *config);
+int config_parse_acl(JSON_Array *entries, const char *name, xps_acl_t **acl);
+
+// status codes for which error responses are pre-serialized at config load
+u_int error_res_status_codes[] = {
+  HTTP_BAD_REQUEST,           HTTP_FORBIDDEN,   HTTP_NOT_FOUND,
+  HTTP_INTERNAL_SERVER_ERROR, HTTP_BAD_GATEWAY, HTTP_GATEWAY_TIMEOUT,
+};
+int n_error_res_status_codes = sizeof(error_res_status_codes) / sizeof(error_res_status_codes[0]);
 
 const char *default_gzip_mimes[] = {
   "text/html",
@@ -34,6 +81,8 @@ const char *default_gzip_mimes[] = {
 
 int n_default_gzip_mimes = sizeof(default_gzip_mimes) / sizeof(default_gzip_mimes[0]);
 
+u_long config_generation = 0; // last xps_config_t::_generation handed out
+
 xps_config_t *xps_config_create(const char *config_path) {
   /*assert*/
   assert(config_path != NULL);
@@ -43,311 +92,559 @@ xps_config_t *xps_config_create(const char *config_path) {
     logger(LOG_ERROR, "xps_config_create()", "malloc() failed for config");
     return NULL;
   }
+  /*initialize fields of config object, so xps_config_destroy() can undo any step below*/
+  config->_config_json = NULL;
+  config->config_path = config_path;
+  config->_generation = ++config_generation;
+  config->_n_switched = 0;
+  config->_n_released = 0;
+  config->metrics_host = NULL;
+  config->_metrics_listener = NULL;
+  config->_server_map = NULL;
+  config->_server_map_size = 0;
+  vec_init(&(config->servers));
+  vec_init(&(config->_all_listeners));
+  vec_init(&(config->_all_routes));
+  vec_init(&(config->_cpus));
+  vec_init(&(config->_error_res_templates));
+
   /*get config_json using json_parse_file*/
-  JSON_Value *config_json = json_parse_file(config_path);
-  if (config_json == NULL) {
+  config->_config_json = json_parse_file(config_path);
+  if (config->_config_json == NULL) {
     logger(LOG_ERROR, "xps_config_create()", "json_parse_file() failed");
+    xps_config_destroy(config);
     return NULL;
   }
-  /*initialize fields of config object*/
-  config->_config_json = config_json;
-  config->config_path = config_path;
 
-  JSON_Object *root_object = json_value_get_object(config_json);
+  JSON_Object *root_object = json_value_get_object(config->_config_json);
   if (root_object == NULL) {
     logger(LOG_ERROR, "xps_config_create()", "failed to parse root_object");
+    xps_config_destroy(config);
     return NULL;
   }
   /*initialize server_name,workers,servers fields - hint: use
   json_object_get_string ,json_object_get_number,json_object_get_array*/
   config->server_name = json_object_get_string(root_object, "server_name");
-  config->workers = json_object_get_number(root_object, "workers");
+  if (config_parse_workers(config, root_object) != OK) {
+    logger(LOG_ERROR, "xps_config_create()", "config_parse_workers() failed");
+    xps_config_destroy(config);
+    return NULL;
+  }
+
+  /*Tuning, with defaults that servers and routes inherit*/
+  const char *metrics_host = json_object_get_string(root_object, "metrics_host");
+  config->metrics_host = str_create(metrics_host ? metrics_host : METRICS_HOST);
+  if (config->metrics_host == NULL) {
+    logger(LOG_ERROR, "xps_config_create()", "str_create() failed for metrics_host");
+    xps_config_destroy(config);
+    return NULL;
+  }
+  int error = OK;
+  config->metrics_port =
+    config_get_number(root_object, "metrics_port", 1, 65535, METRICS_PORT, &error);
+  config->max_epoll_events =
+    config_get_number(root_object, "max_epoll_events", 1, 4096, MAX_EPOLL_EVENTS, &error);
+  config->nulls_thresh =
+    config_get_number(root_object, "nulls_thresh", 1, 1000000, DEFAULT_NULLS_THRESH, &error);
+  config->backlog = config_get_number(root_object, "backlog", 1, 65535, DEFAULT_BACKLOG, &error);
+  config->buffer_size =
+    config_get_number(root_object, "buffer_size", 1024, 16777216, DEFAULT_BUFFER_SIZE, &error);
+  config->pipe_buff_thresh = config_get_number(root_object, "pipe_buff_thresh", 1024,
+                                               1073741824, DEFAULT_PIPE_BUFF_THRESH, &error);
+  config->req_timeout_msec = config_get_number(root_object, "req_timeout_msec", 100, 86400000,
+                                               DEFAULT_HTTP_REQ_TIMEOUT_MSEC, &error);
+  if (error != OK) {
+    logger(LOG_ERROR, "xps_config_create()", "invalid tuning value");
+    xps_config_destroy(config);
+    return NULL;
+  }
 
   /*Setting Up `server` Array*/
   JSON_Array *servers = json_object_get_array(root_object, "servers");
-  vec_init(&(config->servers));
   if (servers == NULL) {
     logger(LOG_ERROR, "xps_config_create()", "failed to parse servers");
+    xps_config_destroy(config);
     return NULL;
   }
   for (size_t i = 0; i < json_array_get_count(servers); i++) {
     JSON_Object *server_object = json_array_get_object(servers, i);
     if (server_object == NULL) {
       logger(LOG_ERROR, "xps_config_create()", "failed to parse server_object");
+      xps_config_destroy(config);
       return NULL;
     }
     xps_config_server_t *server = malloc(sizeof(xps_config_server_t));
     if (server == NULL) {
       logger(LOG_ERROR, "xps_config_create()", "malloc() failed for server");
+      xps_config_destroy(config);
       return NULL;
     }
     vec_init(&(server->routes));
     vec_init(&(server->listeners));
     vec_init(&server->hostnames);
-    parse_server(server_object, server);
+    server->_route_trie = NULL;
+    server->backlog = config->backlog;
+    server->buffer_size = config->buffer_size;
+    server->pipe_buff_thresh = config->pipe_buff_thresh;
+    server->req_timeout_msec = config->req_timeout_msec;
     vec_push(&(config->servers), server);
+    if (parse_server(server_object, server) != OK) {
+      logger(LOG_ERROR, "xps_config_create()", "parse_server() failed for server %zu", i);
+      xps_config_destroy(config);
+      return NULL;
+    }
+
+    /*Compile routes for longest prefix match*/
+    if (config_build_route_trie(server) != OK) {
+      logger(LOG_ERROR, "xps_config_create()", "config_build_route_trie() failed");
+      xps_config_destroy(config);
+      return NULL;
+    }
+  }
+
+  /*Index servers by listener and hostname*/
+  if (config_build_server_map(config) != OK) {
+    logger(LOG_ERROR, "xps_config_create()", "config_build_server_map() failed");
+    xps_config_destroy(config);
+    return NULL;
   }
 
   /*Setting up `_all_listeners` Array*/
-  vec_init(&(config->_all_listeners));
   for (int i = 0; i < config->servers.length; i++) {
-    parse_all_listeners(&(config->_all_listeners), config->servers.data[i]);
+    if (parse_all_listeners(&(config->_all_listeners), config->servers.data[i]) != OK) {
+      logger(LOG_ERROR, "xps_config_create()", "parse_all_listeners() failed");
+      xps_config_destroy(config);
+      return NULL;
+    }
+  }
+
+  /*The metrics server has a listener of its own*/
+  config->_metrics_listener = config_metrics_listener_create(config);
+  if (config->_metrics_listener == NULL) {
+    logger(LOG_ERROR, "xps_config_create()", "config_metrics_listener_create() failed");
+    xps_config_destroy(config);
+    return NULL;
+  }
+
+  /*Number every route so cores can keep per-route state in plain arrays*/
+  for (int i = 0; i < config->servers.length; i++) {
+    xps_config_server_t *server = config->servers.data[i];
+    for (int j = 0; j < server->routes.length; j++) {
+      xps_config_route_t *route = server->routes.data[j];
+      route->_id = config->_all_routes.length;
+      vec_push(&(config->_all_routes), route);
+
+      /*Resolve a relative dir_path once, not per request*/
+      route->_req_path_len = route->req_path ? strlen(route->req_path) : 0;
+      if (route->_type == REQ_FILE_SERVE && route->dir_path) {
+        if (is_abs_path((char *)route->dir_path)) {
+          route->_dir_path = str_create(route->dir_path);
+        } else {
+          char *config_dir = str_create(config_path);
+          route->_dir_path = path_join(dirname(config_dir), route->dir_path);
+          free(config_dir);
+        }
+        if (route->_dir_path == NULL) {
+          logger(LOG_ERROR, "xps_config_create()", "failed to resolve dir_path");
+          xps_config_destroy(config);
+          return NULL;
+        }
+      }
+    }
+  }
+
+  /*Let listeners refuse clients that no route of theirs would serve*/
+  config_build_acl_routes(config);
+
+  /*Pre-serialize redirect and error responses*/
+  if (compile_res_templates(config) != OK) {
+    logger(LOG_ERROR, "xps_config_create()", "compile_res_templates() failed");
+    xps_config_destroy(config);
+    return NULL;
   }
 
   logger(LOG_DEBUG, "xps_config_create()", "Config file parsed successfully");
   return config;
 }
 
+/* Also frees a config that xps_config_create() gave up on part way */
 void xps_config_destroy(xps_config_t *config) {
   assert(config != NULL);
 
   for (int i = 0; i < config->servers.length; i++) {
     xps_config_server_t *server = config->servers.data[i];
-    for (int j = 0; j < server->listeners.length; j++)
-      free(server->listeners.data[j]);
+    for (int j = 0; j < server->listeners.length; j++) {
+      xps_config_listener_t *listener = server->listeners.data[j];
+      vec_deinit(&(listener->_acl_routes));
+      free(listener);
+    }
     vec_deinit(&server->listeners);
     for (int j = 0; j < server->routes.length; j++) {
       xps_config_route_t *route = server->routes.data[j];
       vec_deinit(&(route->index));
       vec_deinit(&(route->upstreams));
-      vec_deinit(&(route->ip_whitelist));
-      vec_deinit(&(route->ip_blacklist));
+      vec_deinit(&(route->upstream_weights));
+      vec_deinit(&(route->_upstream_schedule));
+      vec_deinit(&(route->_maglev_table));
+      vec_deinit(&(route->_upstream_health));
+      if (route->ip_whitelist)
+        xps_acl_destroy(route->ip_whitelist);
+      if (route->ip_blacklist)
+        xps_acl_destroy(route->ip_blacklist);
       vec_deinit(&(route->gzip_mime_types));
+      if (route->_redirect_res)
+        xps_http_res_template_destroy(route->_redirect_res);
+      if (route->_dir_path)
+        free(route->_dir_path);
       free(route);
     }
     vec_deinit(&(server->routes));
     vec_deinit(&(server->hostnames));
+    if (server->_route_trie)
+      config_route_node_destroy(server->_route_trie);
     free(server);
   }
   vec_deinit(&(config->servers));
   vec_deinit(&(config->_all_listeners));
+  if (config->_metrics_listener) {
+    vec_deinit(&(config->_metrics_listener->_acl_routes));
+    free(config->_metrics_listener);
+  }
+  free(config->metrics_host);
+  vec_deinit(&(config->_cpus));
+  vec_deinit(&(config->_all_routes));
+
+  for (u_int i = 0; i < config->_server_map_size; i++) {
+    xps_config_server_key_t *key = config->_server_map[i];
+    while (key) {
+      xps_config_server_key_t *next = key->next;
+      free(key);
+      key = next;
+    }
+  }
+  free(config->_server_map);
+
+  for (int i = 0; i < config->_error_res_templates.length; i++)
+    xps_http_res_template_destroy(config->_error_res_templates.data[i]);
+  vec_deinit(&(config->_error_res_templates));
 
-  json_value_free(config->_config_json);
+  if (config->_config_json)
+    json_value_free(config->_config_json);
   free(config);
 }
 
-xps_config_lookup_t *xps_config_lookup(xps_config_t *config, xps_http_req_t *http_req,
-                                       xps_connection_t *client, int *error) {
+/* Routes http_req into lookup, which the caller owns and releases with
+ * xps_config_lookup_clear(); returns E_NOTFOUND when no route matches */
+int xps_config_lookup(xps_config_t *config, xps_http_req_t *http_req, xps_connection_t *client,
+                      xps_config_lookup_t *lookup) {
   /*assert*/
   assert(config != NULL);
   assert(http_req != NULL);
   assert(client != NULL);
+  assert(lookup != NULL);
+
+  lookup->type = REQ_INVALID;
+  lookup->route = NULL;
+  lookup->file_path = NULL;
+  lookup->dir_path = NULL;
 
   // CASE : METRICS  TODO: STAGE22
-  if (client->listener->port == METRICS_PORT) {
-    xps_config_lookup_t *lookup = malloc(sizeof(xps_config_lookup_t));
-    if (lookup == NULL) {
-      logger(LOG_ERROR, "xps_config_lookup()", "malloc() failed for 'lookup'");
-      return NULL;
-    }
+  if (client->listener->port == config->metrics_port) {
     lookup->type = REQ_METRICS;
-    lookup->file_path = NULL;
-    lookup->dir_path = NULL;
-
-    *error = OK;
-    return lookup;
+    return OK;
   }
 
-  *error = E_FAIL;
   /*get host,keep_alive(connection),accept encoding,pathname from http_req*/
 
-  const char *h_host = xps_http_get_header(&(http_req->headers), "Host");
-  const char *h_keep_alive = xps_http_get_header(&(http_req->headers), "Connection");
-  const char *h_accept_encoding = xps_http_get_header(&(http_req->headers), "Accept-Encoding");
+  const char *h_host = http_req->known_headers[HTTP_H_HOST];
+  const char *h_keep_alive = http_req->known_headers[HTTP_H_CONNECTION];
+  const char *h_accept_encoding = http_req->known_headers[HTTP_H_ACCEPT_ENCODING];
   const char *h_pathname = http_req->pathname;
-  // Step 1: Find matching server block
-  int target_server_index = -1;
-  for (int i = 0; i < config->servers.length; i++) {
-    xps_config_server_t *server = config->servers.data[i];
-    // Check if client listener is present in server
-    bool has_matching_listener = false;
-    for (int j = 0; j < server->listeners.length; j++) {
-      xps_config_listener_t *listener = server->listeners.data[j];
-      if (strcmp(listener->host, client->listener->host) == 0 &&
-          listener->port == client->listener->port) {
-        has_matching_listener = true;
-        break;
-      }
-    }
-    if (!has_matching_listener)
-      continue;
 
-    /* Check if host header matches any hostname*/
-    // NOTE: if not hostnames provided, it is considered a match
-    bool has_matching_hostname = server->hostnames.length == 0;
-    for (int j = 0; j < server->hostnames.length; j++) {
-      if (strcmp(server->hostnames.data[j], h_host) == 0) {
-        has_matching_hostname = true;
-        break;
-      }
+  // Hot URLs skip route matching and the stat() calls of file resolution
+  xps_core_t *core = client->core;
+  xps_config_cache_entry_t *entry =
+    config_cache_get(core->lookup_cache, config, client->listener, h_host, h_pathname,
+                     core->curr_time_msec);
+  if (entry) {
+    xps_metrics_set(core, M_LOOKUP_CACHE_HIT, 1);
+  } else {
+    xps_metrics_set(core, M_LOOKUP_CACHE_MISS, 1);
+    entry = config_cache_put(core->lookup_cache, config, client->listener, h_host, h_pathname,
+                             core->curr_time_msec);
+    if (entry == NULL) {
+      logger(LOG_ERROR, "xps_config_lookup()", "config_cache_put() failed");
+      return E_FAIL;
     }
-    if (has_matching_hostname) {
-      target_server_index = i;
-      break;
+    if (config_resolve(config, client->listener, h_host, h_pathname, entry) != OK) {
+      logger(LOG_ERROR, "xps_config_lookup()", "config_resolve() failed");
+      config_cache_entry_clear(entry);
+      return E_FAIL;
     }
   }
 
-  if (target_server_index == -1) {
-    *error = E_NOTFOUND;
-    return NULL;
-  }
+  if (entry->result != OK)
+    return entry->result;
 
-  xps_config_server_t *server = config->servers.data[target_server_index];
-  /*Find matching route block*/
-  xps_config_route_t *route = NULL;
-  int longest_path_len = -1;
-  for (int i = 0; i < server->routes.length; i++) {
-    xps_config_route_t *current_route = server->routes.data[i];
-    size_t route_path_len = strlen(current_route->req_path);
+  /* Init values of lookup*/
+  xps_config_route_t *route = entry->route;
+  lookup->type = route->_type;
+  lookup->route = route;
+  lookup->keep_alive = h_keep_alive && strcmp(h_keep_alive, "keep-alive") == 0;
+  lookup->file_start = 0;
+  lookup->file_end = -1;
+  lookup->gzip_enable = route->gzip_enable && entry->gzip_mime && h_accept_encoding &&
+                        strstr(h_accept_encoding, "gzip");
+  lookup->upstream = route->upstreams.length > 0 ? route->upstreams.data[0] : NULL;
+  lookup->upstream_health = NULL;
+
+  // Initialize type-specific fields
+  if (lookup->type == REQ_FILE_SERVE) {
+    // The entry keeps its paths, the lookup gets copies it can outlive the entry with
+    if (entry->file_path)
+      lookup->file_path = str_create(entry->file_path);
+    if (entry->dir_path)
+      lookup->dir_path = str_create(entry->dir_path);
+    if ((entry->file_path && lookup->file_path == NULL) ||
+        (entry->dir_path && lookup->dir_path == NULL)) {
+      logger(LOG_ERROR, "xps_config_lookup()", "str_create() failed");
+      xps_config_lookup_clear(lookup);
+      return E_FAIL;
+    }
 
-    if (str_starts_with(h_pathname, current_route->req_path)) {
+    logger(LOG_DEBUG, "xps_config_file_lookup()", "requested file path: %s", lookup->file_path);
 
-      if ((int)route_path_len > longest_path_len) {
-        route = current_route;
-        longest_path_len = (int)route_path_len;
-      }
+  } else if (lookup->type == REQ_REVERSE_PROXY) {
+
+    if (route->upstreams.length == 0) {
+      logger(LOG_ERROR, "xps_config_lookup()", "route has no upstreams");
+      return E_FAIL;
     }
+    int index = xps_config_balance(route, http_req, core, &(client->remote_addr));
+    lookup->upstream = route->upstreams.data[index];
+    lookup->upstream_health =
+      route->_upstream_health.length > 0 ? route->_upstream_health.data[index] : NULL;
   }
+  return OK;
+}
 
-  if (route == NULL) {
-    *error = E_NOTFOUND; // No matching route found - 404
-    return NULL;
+/* Fills entry with the route for h_host and h_pathname on listener, and for
+ * file_serve routes the file or directory it resolves to */
+int config_resolve(xps_config_t *config, xps_listener_t *listener, const char *h_host,
+                   const char *h_pathname, xps_config_cache_entry_t *entry) {
+  assert(config != NULL);
+  assert(listener != NULL);
+  assert(h_pathname != NULL);
+  assert(entry != NULL);
+
+  entry->result = E_NOTFOUND;
+
+  // Step 1: Find matching server block
+  // The first server on the listener that lists the Host header, or has no hostnames at all
+  const char *l_host = listener->host;
+  u_int l_port = listener->port;
+  int named_index = h_host ? config_server_map_get(config, l_host, l_port, h_host) : -1;
+  int default_index = config_server_map_get(config, l_host, l_port, NULL);
+
+  int target_server_index = named_index;
+  if (default_index != -1 && (named_index == -1 || default_index < named_index))
+    target_server_index = default_index;
+
+  if (target_server_index == -1)
+    return OK;
+
+  xps_config_server_t *server = config->servers.data[target_server_index];
+  /*Find matching route block: the longest req_path that h_pathname starts with*/
+  xps_config_route_t *route = config_route_trie_match(server->_route_trie, h_pathname);
+
+  if (route == NULL)
+    return OK; // No matching route found - 404
+
+  entry->result = OK;
+  entry->route = route;
+  if (route->_type != REQ_FILE_SERVE)
+    return OK;
+
+  // _dir_path was made absolute at config load
+  char *resource_path = path_join(route->_dir_path, h_pathname + route->_req_path_len);
+  if (resource_path == NULL) {
+    logger(LOG_ERROR, "config_resolve()", "path_join() failed");
+    return E_FAIL;
   }
 
-  /* Init values of lookup*/
-  xps_config_lookup_t *lookup = malloc(sizeof(xps_config_lookup_t));
-  if (lookup == NULL) {
-    logger(LOG_ERROR, "xps_config_lookup()", "malloc() failed for 'lookup'");
-    return NULL;
+  // is file
+  if (is_file(resource_path)) {
+    entry->file_path = resource_path;
+
+  } else if (is_dir(resource_path)) { // is directory
+    bool index_file_found = false;
+    for (int i = 0; i < route->index.length; i++) {
+      char *index_file = path_join(resource_path, route->index.data[i]);
+      if (is_file(index_file)) {
+        entry->file_path = index_file;
+        index_file_found = true;
+        free(resource_path);
+        break;
+      } else {
+        free(index_file);
+      }
+    }
+
+    // no index file found so we show the directory contents (directory browsing)
+    if (!index_file_found) {
+      entry->dir_path = resource_path;
+    }
+  } else {
+    free(resource_path);
   }
-  if (strcmp(route->type, "file_serve") == 0) {
-    lookup->type = REQ_FILE_SERVE;
 
-  } else if (strcmp(route->type, "reverse_proxy") == 0)
-    lookup->type = REQ_REVERSE_PROXY;
-  else if (strcmp(route->type, "redirect") == 0)
-    lookup->type = REQ_REDIRECT;
-  else
-    lookup->type = REQ_INVALID;
-  // Initialize common fields
-  lookup->keep_alive = h_keep_alive && strcmp(h_keep_alive, "keep-alive") == 0;
-  /*need to understand why these values*/
-  lookup->file_path = NULL;
-  lookup->dir_path = NULL;
-  lookup->file_start = 0;
-  lookup->file_end = -1;
-  lookup->gzip_enable =
-    route->gzip_enable && h_accept_encoding && strstr(h_accept_encoding, "gzip");
-  lookup->gzip_level = route->gzip_level;
-  lookup->upstream = route->upstreams.length > 0 ? route->upstreams.data[0] : NULL;
-  /*till here |^*/
-  lookup->http_status_code = route->http_status_code;
-  lookup->redirect_url = route->redirect_url;
-  lookup->ip_whitelist = route->ip_whitelist;
-  lookup->ip_blacklist = route->ip_blacklist;
+  if (entry->file_path) {
+    const char *mime = xps_get_mime(entry->file_path);
+
+    if (mime) {
+      bool mime_match = false;
+      for (size_t i = 0; i < n_default_gzip_mimes; i++) {
+        if (strcmp(mime, default_gzip_mimes[i]) == 0) {
+          mime_match = true;
 
-  // Initialize type-specific fields
-  if (lookup->type == REQ_FILE_SERVE) {
-    char *resource_path = path_join(
-      route->dir_path, h_pathname + strlen(route->req_path)); /*need to specify this in the doc*/
-    if (!is_abs_path(resource_path)) { // we require abosulte path so we need to see if
-                                       // the current path is absolute or not
-      char *temp = str_create(config->config_path);
-      char *temp2 = path_join(dirname(temp), resource_path);
-      free(temp);
-      free(resource_path);
-      resource_path = temp2;
-
-      // printf("resource_path: %s\n", resource_path);
-    }
-    // is file
-    if (is_file(resource_path)) {
-      lookup->file_path = resource_path;
-
-    } else if (is_dir(resource_path)) { // is directory
-      bool index_file_found = false;
-      for (int i = 0; i < route->index.length; i++) {
-        char *index_file = path_join(resource_path, route->index.data[i]);
-        if (is_file(index_file)) {
-          lookup->file_path = index_file;
-          index_file_found = true;
-          free(resource_path);
           break;
-        } else {
-          free(index_file);
         }
       }
 
-      // no index file found so we show the directory contents (directory browsing)
-      if (!index_file_found) {
-        lookup->dir_path = resource_path;
+      for (size_t i = 0; i < route->gzip_mime_types.length && !mime_match; i++) {
+        if (strcmp(mime, route->gzip_mime_types.data[i]) == 0) {
+          mime_match = true;
+          break;
+        }
       }
+
+      entry->gzip_mime = mime_match;
     } else {
-      free(resource_path);
+      entry->gzip_mime = false;
     }
+  }
 
-    if (lookup->file_path) {
-      const char *mime = xps_get_mime(lookup->file_path);
+  return OK;
+}
 
-      if (mime) {
-        bool mime_match = false;
-        for (size_t i = 0; i < n_default_gzip_mimes; i++) {
-          if (strcmp(mime, default_gzip_mimes[i]) == 0) {
-            mime_match = true;
+/* Index of the upstream in route->upstreams that core's load balancer picks for
+ * the client at client_addr; http_req is NULL for tcp_proxy and udp_proxy */
+int xps_config_balance(xps_config_route_t *route, xps_http_req_t *http_req, xps_core_t *core,
+                       const struct in6_addr *client_addr) {
+  assert(route != NULL);
+  assert(core != NULL);
 
-            break;
-          }
-        }
+  u_long now_msec = core->curr_time_msec;
+  vec_int_t *schedule = &(route->_upstream_schedule);
+  // Position of this core's load balancer, never shared with other cores
+  u_long *lb_counter = &(core->lb_counters[route->_id]);
 
-        for (size_t i = 0; i < route->gzip_mime_types.length && !mime_match; i++) {
-          if (strcmp(mime, route->gzip_mime_types.data[i]) == 0) {
-            mime_match = true;
-            break;
-          }
-        }
+  int index = 0;
+  switch (route->_lb) {
+    case LB_ROUND_ROBIN:
+      index = config_pick_upstream(route, schedule->data[*lb_counter % schedule->length], now_msec);
+      (*lb_counter)++;
+      break;
+    case LB_IP_HASH:
+      index = config_pick_maglev(route, config_hash_key(route, http_req, client_addr), now_msec);
+      break;
+    case LB_LEAST_CONN:
+      index = config_pick_least_conn(route, *lb_counter, now_msec);
+      (*lb_counter)++;
+      break;
+    case LB_EWMA:
+      index = config_pick_ewma(route, core);
+      break;
+  }
 
-        lookup->gzip_enable = lookup->gzip_enable && mime_match;
-      } else {
-        lookup->gzip_enable = false;
-      }
-    }
+  return index;
+}
 
-    logger(LOG_DEBUG, "xps_config_file_lookup()", "requested file path: %s", lookup->file_path);
+/* Whether a route's ip_whitelist and ip_blacklist let addr through; an
+ * address on both lists is refused */
+bool xps_config_ip_allowed(xps_config_route_t *route, const struct in6_addr *addr) {
+  assert(route != NULL);
+  assert(addr != NULL);
 
-  } else if (lookup->type == REQ_REVERSE_PROXY) {
+  if (route->ip_whitelist && !xps_acl_match(route->ip_whitelist, addr))
+    return false;
 
-    if (strcmp(route->load_balancing, "round_robin") == 0) {
+  if (route->ip_blacklist && xps_acl_match(route->ip_blacklist, addr))
+    return false;
 
-      int index = route->_round_robin_counter % route->upstreams.length;
-      route->_round_robin_counter++;
-      lookup->upstream = route->upstreams.data[index];
-    } else if (strcmp(route->load_balancing, "ip_hash") == 0) {
-      u_int ip;
-      inet_pton(AF_INET, client->remote_ip, &ip);
-      int index = ip % route->upstreams.length;
-      lookup->upstream = route->upstreams.data[index];
-    } else {
-      logger(LOG_ERROR, "xps_config_lookup()", "invalid load balancing strategy");
-    }
+  return true;
+}
+
+/* Frees what a lookup allocated; the storage itself belongs to the caller */
+void xps_config_lookup_clear(xps_config_lookup_t *lookup) {
+  assert(lookup != NULL);
+
+  if (lookup->dir_path)
+    free(lookup->dir_path);
+  lookup->dir_path = NULL;
+
+  if (lookup->file_path)
+    free(lookup->file_path);
+  lookup->file_path = NULL;
+}
+
+xps_http_res_template_t *xps_config_error_res(xps_config_t *config, u_int status_code) {
+  assert(config != NULL);
+
+  for (int i = 0; i < config->_error_res_templates.length; i++) {
+    xps_http_res_template_t *tmpl = config->_error_res_templates.data[i];
+    if (tmpl->status_code == status_code)
+      return tmpl;
   }
-  *error = OK;
-  return lookup;
+
+  return NULL;
 }
 
-void xps_config_lookup_destroy(xps_config_lookup_t *config_lookup, xps_core_t *core) {
-  assert(config_lookup != NULL);
-  assert(core != NULL);
+int compile_res_templates(xps_config_t *config) {
+  assert(config != NULL);
 
-  if (config_lookup->dir_path)
-    free(config_lookup->dir_path);
+  for (int i = 0; i < n_error_res_status_codes; i++) {
+    xps_http_res_template_t *tmpl = xps_http_res_template_create(error_res_status_codes[i], NULL);
+    if (tmpl == NULL) {
+      logger(LOG_ERROR, "compile_res_templates()", "xps_http_res_template_create() failed");
+      return E_FAIL;
+    }
+    vec_push(&(config->_error_res_templates), tmpl);
+  }
 
-  if (config_lookup->file_path)
-    free(config_lookup->file_path);
+  for (int i = 0; i < config->servers.length; i++) {
+    xps_config_server_t *server = config->servers.data[i];
+    for (int j = 0; j < server->routes.length; j++) {
+      xps_config_route_t *route = server->routes.data[j];
+      if (route->_type != REQ_REDIRECT || route->redirect_url == NULL)
+        continue;
+
+      route->_redirect_res =
+        xps_http_res_template_create(route->http_status_code, route->redirect_url);
+      if (route->_redirect_res == NULL) {
+        logger(LOG_ERROR, "compile_res_templates()", "xps_http_res_template_create() failed");
+        return E_FAIL;
+      }
+    }
+  }
 
-  free(config_lookup);
+  return OK;
 }
 
-void parse_server(JSON_Object *server_object, xps_config_server_t *server) {
+int parse_server(JSON_Object *server_object, xps_config_server_t *server) {
+
+  /*Tuning, inherited from the config and passed on to routes*/
+  int error = OK;
+  server->backlog =
+    config_get_number(server_object, "backlog", 1, 65535, server->backlog, &error);
+  server->buffer_size =
+    config_get_number(server_object, "buffer_size", 1024, 16777216, server->buffer_size, &error);
+  server->pipe_buff_thresh = config_get_number(server_object, "pipe_buff_thresh", 1024,
+                                               1073741824, server->pipe_buff_thresh, &error);
+  server->req_timeout_msec = config_get_number(server_object, "req_timeout_msec", 100, 86400000,
+                                               server->req_timeout_msec, &error);
+  if (error != OK)
+    return E_FAIL;
 
   /*Setting Up `listeners` Array*/
   JSON_Array *listeners = json_object_get_array(server_object, "listeners");
@@ -358,9 +655,17 @@ void parse_server(JSON_Object *server_object, xps_config_server_t *server) {
       xps_config_listener_t *listener = malloc(sizeof(xps_config_listener_t));
       if (listener == NULL) {
         logger(LOG_ERROR, "parse_server()", "malloc() failed for listener");
-        return;
+        return E_FAIL;
       }
-      parse_listener(listener_object, listener);
+      if (parse_listener(listener_object, listener) != OK) {
+        logger(LOG_ERROR, "parse_server()", "parse_listener() failed for listener %zu", j);
+        free(listener);
+        return E_FAIL;
+      }
+      listener->backlog = server->backlog;
+      listener->buffer_size = server->buffer_size;
+      listener->pipe_buff_thresh = server->pipe_buff_thresh;
+      listener->req_timeout_msec = server->req_timeout_msec;
       vec_push(&(server->listeners), listener);
     }
 
@@ -372,28 +677,71 @@ void parse_server(JSON_Object *server_object, xps_config_server_t *server) {
       xps_config_route_t *route = malloc(sizeof(xps_config_route_t));
       if (route == NULL) {
         logger(LOG_ERROR, "parse_server()", "malloc() failed for route");
-        return;
+        return E_FAIL;
       }
       route->req_path = NULL;
       route->type = NULL;
+      route->_type = REQ_INVALID;
+      route->_req_path_len = 0;
       route->dir_path = NULL;
+      route->_dir_path = NULL;
       vec_init(&(route->upstreams));
+      vec_init(&(route->upstream_weights));
+      vec_init(&(route->_upstream_schedule));
+      route->hash_key = "ip";
+      route->_hash_key_type = HASH_KEY_IP;
+      route->_hash_key_name = NULL;
+      vec_init(&(route->_maglev_table));
       vec_init(&(route->index));
-      vec_init(&route->ip_whitelist);
-      vec_init(&route->ip_blacklist);
+      route->ip_whitelist = NULL;
+      route->ip_blacklist = NULL;
       vec_init(&route->gzip_mime_types);
       route->gzip_enable = false;
       route->gzip_level = -1; // valid values: [-1, 9]
+      route->x_forwarded_for = false;
+      route->splice = false;
+      route->idle_timeout_msec = DEFAULT_TCP_IDLE_TIMEOUT_MSEC;
       route->load_balancing = "round_robin";
-      route->_round_robin_counter = 0;
+      route->_lb = LB_ROUND_ROBIN;
+      route->_id = 0;
+      route->health_check_type = NULL;
+      route->health_check_path = "/";
+      route->health_check_interval_msec = DEFAULT_HEALTH_CHECK_INTERVAL_MSEC;
+      vec_init(&(route->_upstream_health));
       route->http_status_code = 0;
       route->redirect_url = NULL;
+      route->_redirect_res = NULL;
       route->keep_alive = false;
+      route->buffer_size = server->buffer_size;
+      route->pipe_buff_thresh = server->pipe_buff_thresh;
+      route->req_timeout_msec = server->req_timeout_msec;
 
-      parse_route(route_object, route);
-
+      // Listed first, so xps_config_destroy() frees it if parsing fails
       vec_push(&(server->routes), route);
+
+      if (parse_route(route_object, route) != OK) {
+        logger(LOG_ERROR, "parse_server()", "parse_route() failed for route %zu", j);
+        return E_FAIL;
+      }
+    }
+
+  /*A tcp_proxy route turns the server's listeners into plain TCP ones, udp_proxy into UDP ones*/
+  for (int i = 0; i < server->routes.length; i++) {
+    xps_config_route_t *route = server->routes.data[i];
+    if (route->_type != REQ_TCP_PROXY && route->_type != REQ_UDP_PROXY)
+      continue;
+    if (server->routes.length > 1) {
+      logger(LOG_ERROR, "parse_server()", "%s must be the only route of its server", route->type);
+      return E_FAIL;
+    }
+    for (int j = 0; j < server->listeners.length; j++) {
+      xps_config_listener_t *listener = server->listeners.data[j];
+      if (route->_type == REQ_TCP_PROXY)
+        listener->tcp_route = route;
+      else
+        listener->udp_route = route;
     }
+  }
 
   /*Setting up `hostnames` Array*/
   JSON_Array *hostnames = json_object_get_array(server_object, "hostnames");
@@ -402,47 +750,76 @@ void parse_server(JSON_Object *server_object, xps_config_server_t *server) {
       const char *hostname = json_array_get_string(hostnames, i);
       vec_push(&server->hostnames, (void *)hostname);
     }
+
+  return OK;
 }
 
-void parse_listener(JSON_Object *listener_object, xps_config_listener_t *listener) {
+int parse_listener(JSON_Object *listener_object, xps_config_listener_t *listener) {
+  listener->tcp_route = NULL;
+  listener->udp_route = NULL;
+  vec_init(&(listener->_acl_routes));
   listener->host = json_object_get_string(listener_object, "host");
   if (listener->host == NULL) {
     logger(LOG_ERROR, "parse_listener()", "host is required");
-    return;
+    return E_FAIL;
   }
   listener->port = json_object_get_number(listener_object, "port");
   if (listener->port == 0) {
     logger(LOG_ERROR, "parse_listener()", "port is required");
-    return;
-  } else if (listener->port == METRICS_PORT) { // TODO: stage22
-    logger(LOG_ERROR, "parse_listener()", "cannot use METRICS_PORT");
-    return;
+    return E_FAIL;
   }
+
+  return OK;
 }
 
-void parse_route(JSON_Object *route_object, xps_config_route_t *route) {
+int parse_route(JSON_Object *route_object, xps_config_route_t *route) {
 
+  route->type = json_object_get_string(route_object, "type");
+  if (route->type == NULL)
+    route->_type = REQ_INVALID;
+  else if (strcmp(route->type, "file_serve") == 0)
+    route->_type = REQ_FILE_SERVE;
+  else if (strcmp(route->type, "reverse_proxy") == 0)
+    route->_type = REQ_REVERSE_PROXY;
+  else if (strcmp(route->type, "redirect") == 0)
+    route->_type = REQ_REDIRECT;
+  else if (strcmp(route->type, "tcp_proxy") == 0)
+    route->_type = REQ_TCP_PROXY;
+  else if (strcmp(route->type, "udp_proxy") == 0)
+    route->_type = REQ_UDP_PROXY;
+  if (route->_type == REQ_INVALID) {
+    logger(LOG_ERROR, "parse_route()", "invalid route type");
+    return E_FAIL;
+  }
+
+  // tcp_proxy and udp_proxy routes take all traffic of their listeners, paths don't apply
   route->req_path = json_object_get_string(route_object, "req_path");
+  if (!route->req_path && (route->_type == REQ_TCP_PROXY || route->_type == REQ_UDP_PROXY))
+    route->req_path = "/";
 
   if (!route->req_path) {
     logger(LOG_ERROR, "parse_route()", "failed to parse req_path");
-    return;
+    return E_FAIL;
   }
 
-  route->type = json_object_get_string(route_object, "type");
-  if (strcmp(route->type, "file_serve") && strcmp(route->type, "reverse_proxy") &&
-      strcmp(route->type, "redirect")) {
-    logger(LOG_ERROR, "parse_route()", "invalid route type");
-    return;
-  }
+  // Tuning, inherited from the server
+  int error = OK;
+  route->buffer_size =
+    config_get_number(route_object, "buffer_size", 1024, 16777216, route->buffer_size, &error);
+  route->pipe_buff_thresh = config_get_number(route_object, "pipe_buff_thresh", 1024, 1073741824,
+                                              route->pipe_buff_thresh, &error);
+  route->req_timeout_msec = config_get_number(route_object, "req_timeout_msec", 100, 86400000,
+                                              route->req_timeout_msec, &error);
+  if (error != OK)
+    return E_FAIL;
 
-  if (strcmp(route->type, "file_serve") == 0) {
+  if (route->_type == REQ_FILE_SERVE) {
 
     /*if file server */
     route->dir_path = json_object_get_string(route_object, "dir_path");
     if (route->dir_path == NULL) {
       logger(LOG_ERROR, "parse_route()", "dir_path is required");
-      return;
+      return E_FAIL;
     }
     JSON_Array *indexes = json_object_get_array(route_object, "index");
     if (indexes)
@@ -458,7 +835,7 @@ void parse_route(JSON_Object *route_object, xps_config_route_t *route) {
     route->gzip_level = (int)json_object_get_number(route_object, "gzip_level");
     if (route->gzip_level < -1 || route->gzip_level > 9) {
       logger(LOG_ERROR, "parse_route()", "gzip_level out of range -1 to 9");
-      return;
+      return E_FAIL;
     }
 
     // gzip_mime_types
@@ -467,71 +844,134 @@ void parse_route(JSON_Object *route_object, xps_config_route_t *route) {
       for (size_t i = 0; i < json_array_get_count(gzip_mime_types); i++)
         vec_push(&route->gzip_mime_types, (void *)json_array_get_string(gzip_mime_types, i));
 
-  } else if (strcmp(route->type, "redirect") == 0) {
+  } else if (route->_type == REQ_REDIRECT) {
 
     /*if redirect*/
     route->http_status_code = json_object_get_number(route_object, "http_status_code");
     route->redirect_url = json_object_get_string(route_object, "redirect_url");
     if (route->redirect_url == NULL) {
       logger(LOG_ERROR, "parse_route()", "redirect_url required");
-      return;
+      return E_FAIL;
     }
 
-  } else if (strcmp(route->type, "reverse_proxy") == 0) {
+  } else if (route->_type == REQ_REVERSE_PROXY || route->_type == REQ_TCP_PROXY ||
+             route->_type == REQ_UDP_PROXY) {
 
     /*if upstream*/
     JSON_Array *upstreams = json_object_get_array(route_object, "upstreams");
 
     if (upstreams == NULL) {
       logger(LOG_ERROR, "parse_route()", "upstreams is required");
-      return;
+      return E_FAIL;
     }
+    // Each upstream is "host:port" or {"upstream": "host:port", "weight": n}
     for (size_t k = 0; k < json_array_get_count(upstreams); k++) {
       const char *upstream = json_array_get_string(upstreams, k);
+      int weight = 1;
+      JSON_Object *upstream_object = json_array_get_object(upstreams, k);
+      if (upstream_object) {
+        upstream = json_object_get_string(upstream_object, "upstream");
+        if (json_object_has_value(upstream_object, "weight"))
+          weight = json_object_get_number(upstream_object, "weight");
+      }
+      if (upstream == NULL || weight < 1 || weight > MAX_UPSTREAM_WEIGHT) {
+        logger(LOG_ERROR, "parse_route()", "invalid upstream at index %zu", k);
+        return E_FAIL;
+      }
       vec_push(&(route->upstreams), (void *)upstream);
+      vec_push(&(route->upstream_weights), weight);
+    }
+    if (route->upstreams.length == 0) {
+      logger(LOG_ERROR, "parse_route()", "upstreams must not be empty");
+      return E_FAIL;
     }
+    config_build_schedule(route);
+
+    // x_forwarded_for
+    route->x_forwarded_for = json_object_get_boolean(route_object, "x_forwarded_for") == 1;
+
+    // splice
+    route->splice = json_object_get_boolean(route_object, "splice") == 1;
+
+    // idle_timeout_msec, for tcp_proxy and udp_proxy
+    double idle_timeout = json_object_get_number(route_object, "idle_timeout_msec");
+    if (idle_timeout > 0)
+      route->idle_timeout_msec = idle_timeout;
+    else if (route->_type == REQ_UDP_PROXY)
+      route->idle_timeout_msec = DEFAULT_UDP_IDLE_TIMEOUT_MSEC;
 
     // load_balancing
     const char *lb = json_object_get_string(route_object, "load_balancing");
     if (lb)
       route->load_balancing = lb;
-  }
+    if (strcmp(route->load_balancing, "round_robin") == 0)
+      route->_lb = LB_ROUND_ROBIN;
+    else if (strcmp(route->load_balancing, "ip_hash") == 0)
+      route->_lb = LB_IP_HASH;
+    else if (strcmp(route->load_balancing, "least_conn") == 0)
+      route->_lb = LB_LEAST_CONN;
+    else if (strcmp(route->load_balancing, "ewma") == 0)
+      route->_lb = LB_EWMA;
+    else {
+      logger(LOG_ERROR, "parse_route()", "invalid load_balancing '%s'", route->load_balancing);
+      return E_FAIL;
+    }
 
-  JSON_Array *ip_whitelist = json_object_get_array(route_object, "ip_whitelist");
-  JSON_Array *ip_blacklist = json_object_get_array(route_object, "ip_blacklist");
-
-  if (ip_whitelist && !ip_blacklist) {
-    for (size_t i = 0; i < json_array_get_count(ip_whitelist); i++)
-      vec_push(&(route->ip_whitelist), (void *)json_array_get_string(ip_whitelist, i));
-  } else if (ip_blacklist && !ip_whitelist) {
-    for (size_t i = 0; i < json_array_get_count(ip_blacklist); i++)
-      vec_push(&(route->ip_blacklist), (void *)json_array_get_string(ip_blacklist, i));
-  } else if (ip_whitelist && ip_blacklist) {
-    // since both whitelist and blacklist are present we just need to filter the whitelist ips from
-    // the blacklist ips and then we dont requrie blacklist ip array the reason for that is when
-    // both exist teh whitelist takes priority as we just need to allow ips present in the whitelist
-    // so what we do here is we remove ips from whitelist array that is also present in blacklist
-    // array as well
-
-    for (size_t i = 0; i < json_array_get_count(ip_whitelist); i++) {
-      const char *ip_w = json_array_get_string(ip_whitelist, i);
-
-      bool in_blacklist = false;
-      for (size_t j = 0; j < json_array_get_count(ip_blacklist); j++) {
-        const char *ip_b = json_array_get_string(ip_blacklist, j);
-        if (strcmp(ip_w, ip_b) == 0) {
-          in_blacklist = true;
-          break;
-        }
+    // hash_key
+    const char *hash_key = json_object_get_string(route_object, "hash_key");
+    if (hash_key) {
+      if (strcmp(hash_key, "ip") && !(strncmp(hash_key, "header:", 7) == 0 && hash_key[7]) &&
+          !(strncmp(hash_key, "cookie:", 7) == 0 && hash_key[7])) {
+        logger(LOG_ERROR, "parse_route()", "invalid hash_key '%s'", hash_key);
+        return E_FAIL;
       }
+      route->hash_key = hash_key;
+      if (strncmp(hash_key, "header:", 7) == 0)
+        route->_hash_key_type = HASH_KEY_HEADER;
+      else if (strncmp(hash_key, "cookie:", 7) == 0)
+        route->_hash_key_type = HASH_KEY_COOKIE;
+      if (route->_hash_key_type != HASH_KEY_IP)
+        route->_hash_key_name = hash_key + 7;
+    }
+    if (route->_lb == LB_IP_HASH)
+      config_build_maglev(route);
+
+    // health_check
+    JSON_Object *health_check = json_object_get_object(route_object, "health_check");
+    if (health_check && route->_type == REQ_UDP_PROXY) {
+      // Probes connect over TCP, which says nothing about a datagram service
+      logger(LOG_ERROR, "parse_route()", "health_check is not supported for udp_proxy");
+      return E_FAIL;
+    }
+    if (health_check) {
+      const char *hc_type = json_object_get_string(health_check, "type");
+      if (hc_type == NULL || (strcmp(hc_type, "tcp") && strcmp(hc_type, "http"))) {
+        logger(LOG_ERROR, "parse_route()", "health_check type must be \"tcp\" or \"http\"");
+        return E_FAIL;
+      }
+      route->health_check_type = hc_type;
+
+      const char *hc_path = json_object_get_string(health_check, "path");
+      if (hc_path)
+        route->health_check_path = hc_path;
 
-      if (!in_blacklist)
-        vec_push(&(route->ip_whitelist), (void *)ip_w);
+      double hc_interval = json_object_get_number(health_check, "interval_msec");
+      if (hc_interval > 0)
+        route->health_check_interval_msec = hc_interval;
     }
   }
+
+  // Entries are addresses or CIDR prefixes, IPv4 or IPv6
+  if (config_parse_acl(json_object_get_array(route_object, "ip_whitelist"), "ip_whitelist",
+                       &(route->ip_whitelist)) != OK ||
+      config_parse_acl(json_object_get_array(route_object, "ip_blacklist"), "ip_blacklist",
+                       &(route->ip_blacklist)) != OK)
+    return E_FAIL;
+
+  return OK;
 }
 
-void parse_all_listeners(vec_void_t *_all_listeners, xps_config_server_t *server) {
+int parse_all_listeners(vec_void_t *_all_listeners, xps_config_server_t *server) {
 
   for (int i = 0; i < server->listeners.length; i++) {
 
@@ -541,9 +981,28 @@ void parse_all_listeners(vec_void_t *_all_listeners, xps_config_server_t *server
     bool listener_found = false;
 
     for (int j = 0; j < _all_listeners->length; j++) {
-      xps_config_listener_t *curr = _all_listeners->data[i];
+      xps_config_listener_t *curr = _all_listeners->data[j];
+
+      // A UDP socket can share its host and port with a TCP one
+      if ((server_listener->udp_route == NULL) != (curr->udp_route == NULL))
+        continue;
 
       if (strcmp(server_listener->host, curr->host) == 0 && server_listener->port == curr->port) {
+        if (server_listener->udp_route && server_listener->udp_route != curr->udp_route) {
+          logger(LOG_ERROR, "parse_all_listeners()", "%s:%u is used by two udp_proxy servers",
+                 curr->host, curr->port);
+          return E_FAIL;
+        }
+        if ((server_listener->tcp_route == NULL) != (curr->tcp_route == NULL)) {
+          logger(LOG_ERROR, "parse_all_listeners()", "%s:%u is used by both tcp_proxy and http",
+                 curr->host, curr->port);
+          return E_FAIL;
+        }
+        if (server_listener->tcp_route && server_listener->tcp_route != curr->tcp_route) {
+          logger(LOG_ERROR, "parse_all_listeners()", "%s:%u is used by two tcp_proxy servers",
+                 curr->host, curr->port);
+          return E_FAIL;
+        }
         listener_found = true;
         break;
       }
@@ -553,4 +1012,836 @@ void parse_all_listeners(vec_void_t *_all_listeners, xps_config_server_t *server
       vec_push(_all_listeners, server_listener);
     }
   }
-}
\ No newline at end of file
+
+  return OK;
+}
+
+/*
+ * Index of the upstream a strategy chose with start, moving on to the next one
+ * while it is ejected. If every upstream is ejected the original choice is
+ * kept, since failing some requests beats failing all of them.
+ */
+int config_pick_upstream(xps_config_route_t *route, u_long start, u_long now_msec) {
+  assert(route != NULL);
+  assert(route->upstreams.length > 0);
+
+  int n = route->upstreams.length;
+  int index = start % n;
+
+  for (int i = 0; i < n; i++) {
+    int curr = (index + i) % n;
+    if (config_upstream_is_up(route, curr, now_msec))
+      return curr;
+  }
+
+  return index;
+}
+
+/* Fewest active sessions relative to weight; start rotates among ties */
+int config_pick_least_conn(xps_config_route_t *route, u_long start, u_long now_msec) {
+  assert(route != NULL);
+  assert(route->upstreams.length > 0);
+
+  int n = route->upstreams.length;
+  if (route->_upstream_health.length != n)
+    return start % n;
+
+  int best = -1;
+  u_long best_active = 0;
+  for (int i = 0; i < n; i++) {
+    int curr = (start + i) % n;
+    if (!config_upstream_is_up(route, curr, now_msec))
+      continue;
+
+    u_long active = xps_health_active(route->_upstream_health.data[curr]);
+    // active / weight < best_active / best_weight, without division
+    if (best == -1 || active * route->upstream_weights.data[best] <
+                        best_active * route->upstream_weights.data[curr]) {
+      best = curr;
+      best_active = active;
+    }
+  }
+
+  return best == -1 ? config_pick_upstream(route, start, now_msec) : best;
+}
+
+/*
+ * Power of two choices: of two random healthy upstreams, take the one with
+ * the lower peak-EWMA latency times load, relative to weight.
+ */
+int config_pick_ewma(xps_config_route_t *route, xps_core_t *core) {
+  assert(route != NULL);
+  assert(core != NULL);
+  assert(route->upstreams.length > 0);
+
+  int n = route->upstreams.length;
+  if (route->_upstream_health.length != n)
+    return rand_r(&(core->rand_seed)) % n;
+
+  int candidates[n];
+  int n_candidates = 0;
+  for (int i = 0; i < n; i++)
+    if (config_upstream_is_up(route, i, core->curr_time_msec))
+      candidates[n_candidates++] = i;
+
+  if (n_candidates == 0)
+    return rand_r(&(core->rand_seed)) % n;
+  if (n_candidates == 1)
+    return candidates[0];
+
+  int a = rand_r(&(core->rand_seed)) % n_candidates;
+  int b = rand_r(&(core->rand_seed)) % (n_candidates - 1);
+  if (b >= a)
+    b++;
+  a = candidates[a];
+  b = candidates[b];
+
+  u_long cost_a = xps_health_cost(route->_upstream_health.data[a], core->curr_time_msec);
+  u_long cost_b = xps_health_cost(route->_upstream_health.data[b], core->curr_time_msec);
+
+  return cost_a * route->upstream_weights.data[b] <= cost_b * route->upstream_weights.data[a] ? a
+                                                                                              : b;
+}
+
+bool config_upstream_is_up(xps_config_route_t *route, int index, u_long now_msec) {
+  assert(route != NULL);
+
+  if (route->_upstream_health.length != route->upstreams.length)
+    return true;
+
+  return xps_health_is_up(route->_upstream_health.data[index], now_msec);
+}
+
+/*
+ * Precomputes the order in which round_robin visits upstreams, following
+ * nginx's smooth weighted round-robin: weights 5,1,1 give a,a,b,a,c,a,a
+ * rather than a,a,a,a,a,b,c.
+ */
+void config_build_schedule(xps_config_route_t *route) {
+  assert(route != NULL);
+
+  int n = route->upstreams.length;
+  if (n == 0)
+    return;
+
+  int total = 0;
+  for (int i = 0; i < n; i++)
+    total += route->upstream_weights.data[i];
+
+  int current[n];
+  memset(current, 0, sizeof(current));
+
+  for (int slot = 0; slot < total; slot++) {
+    int best = 0;
+    for (int i = 0; i < n; i++) {
+      current[i] += route->upstream_weights.data[i];
+      if (current[i] > current[best])
+        best = i;
+    }
+    current[best] -= total;
+    vec_push(&(route->_upstream_schedule), best);
+  }
+}
+
+/*
+ * Fills the Maglev lookup table (Eisenbud et al., NSDI 2016). Each upstream
+ * walks its own permutation of the slots, derived from its "host:port", and
+ * claims the next free slot on each turn; an upstream takes weight turns per
+ * round. Adding or removing an upstream only moves about 1/n of the keys.
+ */
+void config_build_maglev(xps_config_route_t *route) {
+  assert(route != NULL);
+
+  int n = route->upstreams.length;
+  if (n == 0)
+    return;
+
+  u_long offset[n], skip[n], next[n];
+  for (int i = 0; i < n; i++) {
+    const char *upstream = route->upstreams.data[i];
+    offset[i] = hash_bytes(upstream, strlen(upstream), 0) % MAGLEV_TABLE_SIZE;
+    skip[i] = hash_bytes(upstream, strlen(upstream), 1) % (MAGLEV_TABLE_SIZE - 1) + 1;
+    next[i] = 0;
+  }
+
+  vec_int_t *table = &(route->_maglev_table);
+  vec_clear(table);
+  if (vec_reserve(table, MAGLEV_TABLE_SIZE) != 0) {
+    logger(LOG_ERROR, "config_build_maglev()", "vec_reserve() failed");
+    return;
+  }
+  for (int slot = 0; slot < MAGLEV_TABLE_SIZE; slot++)
+    vec_push(table, -1);
+
+  int filled = 0;
+  while (filled < MAGLEV_TABLE_SIZE) {
+    for (int i = 0; i < n && filled < MAGLEV_TABLE_SIZE; i++) {
+      for (int turn = 0; turn < route->upstream_weights.data[i] && filled < MAGLEV_TABLE_SIZE;
+           turn++) {
+        u_long slot;
+        do {
+          slot = (offset[i] + next[i] * skip[i]) % MAGLEV_TABLE_SIZE;
+          next[i]++;
+        } while (table->data[slot] >= 0);
+
+        table->data[slot] = i;
+        filled++;
+      }
+    }
+  }
+}
+
+/* Hash of the request's ip_hash key; falls back to the client address if the
+ * header or cookie is missing, or there is no request (tcp_proxy, udp_proxy) */
+u_long config_hash_key(xps_config_route_t *route, xps_http_req_t *http_req,
+                       const struct in6_addr *client_addr) {
+  assert(route != NULL);
+
+  if (http_req == NULL) {
+    // no request to take a header or cookie from
+  } else if (route->_hash_key_type == HASH_KEY_HEADER) {
+    const char *val = xps_http_get_header(&(http_req->headers), route->_hash_key_name);
+    if (val)
+      return hash_bytes(val, strlen(val), 0);
+  } else if (route->_hash_key_type == HASH_KEY_COOKIE) {
+    const char *cookies = xps_http_get_header(&(http_req->headers), "Cookie");
+    size_t len;
+    const char *val = cookies ? config_cookie_value(cookies, route->_hash_key_name, &len) : NULL;
+    if (val)
+      return hash_bytes(val, len, 0);
+  }
+
+  struct in6_addr addr;
+  if (client_addr)
+    addr = *client_addr;
+  else
+    memset(&addr, 0, sizeof(addr));
+
+  return hash_bytes(&addr, sizeof(addr), 0);
+}
+
+/* Value of cookie name in a Cookie header ("a=1; b=2"), not NUL-terminated */
+const char *config_cookie_value(const char *cookies, const char *name, size_t *len) {
+  assert(cookies != NULL);
+  assert(name != NULL);
+  assert(len != NULL);
+
+  size_t name_len = strlen(name);
+  const char *p = cookies;
+  while (*p) {
+    while (*p == ' ' || *p == ';')
+      p++;
+    const char *end = strchr(p, ';');
+    if (end == NULL)
+      end = p + strlen(p);
+
+    if ((size_t)(end - p) > name_len && strncmp(p, name, name_len) == 0 && p[name_len] == '=') {
+      *len = end - (p + name_len + 1);
+      return p + name_len + 1;
+    }
+    p = end;
+  }
+
+  return NULL;
+}
+
+/*
+ * Upstream owning the key's slot. If it is ejected, the following slots are
+ * tried: they belong to the other upstreams in permuted order, so the keys of
+ * an ejected upstream spread over the rest and no other key moves.
+ */
+int config_pick_maglev(xps_config_route_t *route, u_long key_hash, u_long now_msec) {
+  assert(route != NULL);
+
+  vec_int_t *table = &(route->_maglev_table);
+  if (table->length == 0)
+    return 0;
+
+  u_long slot = key_hash % table->length;
+  int index = table->data[slot];
+  int max_probes = route->upstreams.length * 8;
+  for (int i = 0; i < max_probes; i++) {
+    int curr = table->data[(slot + i) % table->length];
+    if (config_upstream_is_up(route, curr, now_msec))
+      return curr;
+  }
+
+  return config_pick_upstream(route, index, now_msec);
+}
+
+/* Compiles the server's routes into a radix trie; the first of two equal req_paths wins */
+int config_build_route_trie(xps_config_server_t *server) {
+  assert(server != NULL);
+
+  server->_route_trie = config_route_node_create("", 0);
+  if (server->_route_trie == NULL)
+    return E_FAIL;
+
+  for (int i = 0; i < server->routes.length; i++) {
+    xps_config_route_t *route = server->routes.data[i];
+    if (route->req_path == NULL)
+      continue;
+
+    xps_config_route_node_t *node = server->_route_trie;
+    const char *path = route->req_path;
+    while (*path) {
+      int child_index;
+      xps_config_route_node_t *child = config_route_node_child(node, *path, &child_index);
+      if (child == NULL) {
+        child = config_route_node_create(path, strlen(path));
+        if (child == NULL)
+          return E_FAIL;
+        vec_push(&(node->children), child);
+        node = child;
+        break;
+      }
+
+      size_t common = 0;
+      while (common < child->label_len && path[common] == child->label[common])
+        common++;
+
+      // Split the child where path leaves its label
+      if (common < child->label_len) {
+        xps_config_route_node_t *mid = config_route_node_create(child->label, common);
+        if (mid == NULL)
+          return E_FAIL;
+        memmove(child->label, child->label + common, child->label_len - common + 1);
+        child->label_len -= common;
+        vec_push(&(mid->children), child);
+        node->children.data[child_index] = mid;
+        child = mid;
+      }
+
+      path += common;
+      node = child;
+    }
+
+    if (node->route == NULL)
+      node->route = route;
+  }
+
+  return OK;
+}
+
+xps_config_route_node_t *config_route_node_create(const char *label, size_t label_len) {
+  xps_config_route_node_t *node = malloc(sizeof(xps_config_route_node_t));
+  if (node == NULL) {
+    logger(LOG_ERROR, "config_route_node_create()", "malloc() failed for 'node'");
+    return NULL;
+  }
+
+  node->label = strndup(label, label_len);
+  if (node->label == NULL) {
+    logger(LOG_ERROR, "config_route_node_create()", "strndup() failed for 'label'");
+    free(node);
+    return NULL;
+  }
+  node->label_len = label_len;
+  node->route = NULL;
+  vec_init(&(node->children));
+
+  return node;
+}
+
+void config_route_node_destroy(xps_config_route_node_t *node) {
+  for (int i = 0; i < node->children.length; i++)
+    config_route_node_destroy(node->children.data[i]);
+  vec_deinit(&(node->children));
+  free(node->label);
+  free(node);
+}
+
+xps_config_route_node_t *config_route_node_child(xps_config_route_node_t *node, char first,
+                                                 int *child_index) {
+  for (int i = 0; i < node->children.length; i++) {
+    xps_config_route_node_t *child = node->children.data[i];
+    if (child->label[0] == first) {
+      *child_index = i;
+      return child;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Route with the longest req_path that path starts with at a segment boundary,
+ * as str_starts_with() decides it: "/api" takes "/api" and "/api/x" but not
+ * "/api2", "/api/" takes anything under it. NULL if none; one pass over path.
+ */
+xps_config_route_t *config_route_trie_match(xps_config_route_node_t *root, const char *path) {
+  assert(root != NULL);
+  assert(path != NULL);
+
+  xps_config_route_t *route = NULL;
+  if (root->route && (*path == '\0' || *path == '/'))
+    route = root->route;
+
+  xps_config_route_node_t *node = root;
+  while (*path) {
+    int child_index;
+    xps_config_route_node_t *child = config_route_node_child(node, *path, &child_index);
+    if (child == NULL || strncmp(path, child->label, child->label_len) != 0)
+      break;
+
+    path += child->label_len;
+    node = child;
+    if (node->route &&
+        (node->label[node->label_len - 1] == '/' || *path == '\0' || *path == '/'))
+      route = node->route;
+  }
+
+  return route;
+}
+
+/* Hash map from (listener, hostname) to the first server that takes such requests */
+int config_build_server_map(xps_config_t *config) {
+  assert(config != NULL);
+
+  u_int n_keys = 0;
+  for (int i = 0; i < config->servers.length; i++) {
+    xps_config_server_t *server = config->servers.data[i];
+    n_keys += server->listeners.length * (server->hostnames.length ? server->hostnames.length : 1);
+  }
+
+  // Power of two, at most half full
+  u_int size = 16;
+  while (size < 2 * n_keys)
+    size *= 2;
+
+  config->_server_map = calloc(size, sizeof(xps_config_server_key_t *));
+  if (config->_server_map == NULL) {
+    logger(LOG_ERROR, "config_build_server_map()", "calloc() failed for '_server_map'");
+    return E_FAIL;
+  }
+  config->_server_map_size = size;
+
+  for (int i = 0; i < config->servers.length; i++) {
+    xps_config_server_t *server = config->servers.data[i];
+    for (int j = 0; j < server->listeners.length; j++) {
+      xps_config_listener_t *listener = server->listeners.data[j];
+      if (listener->host == NULL)
+        continue;
+
+      if (server->hostnames.length == 0 &&
+          config_server_map_put(config, listener->host, listener->port, NULL, i) != OK)
+        return E_FAIL;
+      for (int k = 0; k < server->hostnames.length; k++) {
+        if (config_server_map_put(config, listener->host, listener->port,
+                                  server->hostnames.data[k], i) != OK)
+          return E_FAIL;
+      }
+    }
+  }
+
+  return OK;
+}
+
+u_long config_server_key_hash(const char *host, u_int port, const char *hostname) {
+  u_long hash = hash_bytes(host, strlen(host), port);
+  if (hostname)
+    hash = hash_bytes(hostname, strlen(hostname), hash);
+
+  return hash;
+}
+
+/* Adds the key unless an earlier server already has it */
+int config_server_map_put(xps_config_t *config, const char *host, u_int port,
+                          const char *hostname, int server_index) {
+  if (config_server_map_get(config, host, port, hostname) != -1)
+    return OK;
+
+  xps_config_server_key_t *key = malloc(sizeof(xps_config_server_key_t));
+  if (key == NULL) {
+    logger(LOG_ERROR, "config_server_map_put()", "malloc() failed for 'key'");
+    return E_FAIL;
+  }
+
+  u_long slot = config_server_key_hash(host, port, hostname) & (config->_server_map_size - 1);
+  key->host = host;
+  key->port = port;
+  key->hostname = hostname;
+  key->server_index = server_index;
+  key->next = config->_server_map[slot];
+  config->_server_map[slot] = key;
+
+  return OK;
+}
+
+/* Index of the server for the key, -1 if there is none; hostname NULL looks up the default */
+int config_server_map_get(xps_config_t *config, const char *host, u_int port,
+                          const char *hostname) {
+  u_long slot = config_server_key_hash(host, port, hostname) & (config->_server_map_size - 1);
+
+  for (xps_config_server_key_t *key = config->_server_map[slot]; key; key = key->next) {
+    if (key->port == port && strcmp(key->host, host) == 0 &&
+        (key->hostname == NULL) == (hostname == NULL) &&
+        (hostname == NULL || strcmp(key->hostname, hostname) == 0))
+      return key->server_index;
+  }
+
+  return -1;
+}
+
+xps_config_cache_t *xps_config_cache_create(u_int size) {
+  assert(size > 0);
+
+  xps_config_cache_t *cache = malloc(sizeof(xps_config_cache_t));
+  if (cache == NULL) {
+    logger(LOG_ERROR, "xps_config_cache_create()", "malloc() failed for 'cache'");
+    return NULL;
+  }
+
+  cache->entries = calloc(size, sizeof(xps_config_cache_entry_t));
+  if (cache->entries == NULL) {
+    logger(LOG_ERROR, "xps_config_cache_create()", "calloc() failed for 'entries'");
+    free(cache);
+    return NULL;
+  }
+  cache->size = size;
+
+  return cache;
+}
+
+void xps_config_cache_destroy(xps_config_cache_t *cache) {
+  assert(cache != NULL);
+
+  for (u_int i = 0; i < cache->size; i++)
+    config_cache_entry_clear(&(cache->entries[i]));
+  free(cache->entries);
+  free(cache);
+}
+
+u_long config_cache_key_hash(xps_listener_t *listener, const char *host, const char *pathname) {
+  u_long hash = hash_bytes(&listener, sizeof(listener), 0);
+  if (host)
+    hash = hash_bytes(host, strlen(host), hash);
+
+  return hash_bytes(pathname, strlen(pathname), hash);
+}
+
+/* The live entry for the key, or NULL when it was never cached, was evicted,
+ * expired or belongs to another config */
+xps_config_cache_entry_t *config_cache_get(xps_config_cache_t *cache, xps_config_t *config,
+                                           xps_listener_t *listener, const char *host,
+                                           const char *pathname, u_long now_msec) {
+  assert(cache != NULL);
+  assert(config != NULL);
+  assert(pathname != NULL);
+
+  u_long hash = config_cache_key_hash(listener, host, pathname);
+  xps_config_cache_entry_t *entry = &(cache->entries[hash % cache->size]);
+
+  if (entry->pathname == NULL || entry->hash != hash || entry->listener != listener ||
+      entry->generation != config->_generation || entry->expire_msec <= now_msec)
+    return NULL;
+
+  if ((entry->host == NULL) != (host == NULL) || (host && strcmp(entry->host, host) != 0) ||
+      strcmp(entry->pathname, pathname) != 0)
+    return NULL;
+
+  return entry;
+}
+
+/* Claims the key's slot, evicting whatever was there, for the caller to fill */
+xps_config_cache_entry_t *config_cache_put(xps_config_cache_t *cache, xps_config_t *config,
+                                           xps_listener_t *listener, const char *host,
+                                           const char *pathname, u_long now_msec) {
+  assert(cache != NULL);
+  assert(config != NULL);
+  assert(pathname != NULL);
+
+  u_long hash = config_cache_key_hash(listener, host, pathname);
+  xps_config_cache_entry_t *entry = &(cache->entries[hash % cache->size]);
+  config_cache_entry_clear(entry);
+
+  entry->host = host ? str_create(host) : NULL;
+  entry->pathname = str_create(pathname);
+  if ((host && entry->host == NULL) || entry->pathname == NULL) {
+    config_cache_entry_clear(entry);
+    return NULL;
+  }
+
+  entry->hash = hash;
+  entry->listener = listener;
+  entry->generation = config->_generation;
+  entry->expire_msec = now_msec + DEFAULT_LOOKUP_CACHE_TTL_MSEC;
+  entry->result = E_NOTFOUND;
+  entry->gzip_mime = true;
+
+  return entry;
+}
+
+void config_cache_entry_clear(xps_config_cache_entry_t *entry) {
+  assert(entry != NULL);
+
+  free(entry->host);
+  free(entry->pathname);
+  free(entry->file_path);
+  free(entry->dir_path);
+  memset(entry, 0, sizeof(xps_config_cache_entry_t));
+}
+
+/* Fills _acl_routes of every listener in _all_listeners with the routes of all
+ * servers on its host and port, unless one of them lets every address through */
+void config_build_acl_routes(xps_config_t *config) {
+  assert(config != NULL);
+
+  for (int i = 0; i < config->_all_listeners.length; i++) {
+    xps_config_listener_t *listener = config->_all_listeners.data[i];
+    bool all_filtered = true;
+
+    for (int j = 0; j < config->servers.length && all_filtered; j++) {
+      xps_config_server_t *server = config->servers.data[j];
+
+      bool on_listener = false;
+      for (int k = 0; k < server->listeners.length; k++) {
+        xps_config_listener_t *curr = server->listeners.data[k];
+        if ((curr->udp_route == NULL) == (listener->udp_route == NULL) &&
+            strcmp(curr->host, listener->host) == 0 && curr->port == listener->port)
+          on_listener = true;
+      }
+      if (!on_listener)
+        continue;
+
+      for (int k = 0; k < server->routes.length; k++) {
+        xps_config_route_t *route = server->routes.data[k];
+        if (route->ip_whitelist == NULL && route->ip_blacklist == NULL) {
+          all_filtered = false;
+          break;
+        }
+        vec_push(&(listener->_acl_routes), route);
+      }
+    }
+
+    if (!all_filtered)
+      vec_clear(&(listener->_acl_routes));
+  }
+}
+
+/*
+ * Sets acl to the prefixes in entries, or to NULL when there are none, which
+ * lets every client through as an empty list always did. Any entry that is
+ * not an address or prefix fails the whole list.
+ */
+int config_parse_acl(JSON_Array *entries, const char *name, xps_acl_t **acl) {
+  assert(name != NULL);
+  assert(acl != NULL);
+
+  *acl = NULL;
+  if (entries == NULL || json_array_get_count(entries) == 0)
+    return OK;
+
+  *acl = xps_acl_create();
+  if (*acl == NULL) {
+    logger(LOG_ERROR, "config_parse_acl()", "xps_acl_create() failed for %s", name);
+    return E_FAIL;
+  }
+
+  for (size_t i = 0; i < json_array_get_count(entries); i++) {
+    const char *entry = json_array_get_string(entries, i);
+    if (entry == NULL || xps_acl_add(*acl, entry) != OK) {
+      logger(LOG_ERROR, "config_parse_acl()", "invalid %s entry at index %zu", name, i);
+      return E_FAIL;
+    }
+  }
+
+  return OK;
+}
+
+/*
+ * Number at name, or def when it is absent. A value that is not a number in
+ * [min, max] sets *error to E_FAIL, so several can be read before one check.
+ */
+u_long config_get_number(JSON_Object *object, const char *name, u_long min, u_long max,
+                         u_long def, int *error) {
+  assert(object != NULL);
+  assert(name != NULL);
+  assert(error != NULL);
+
+  if (!json_object_has_value(object, name))
+    return def;
+
+  JSON_Value *json_value = json_object_get_value(object, name);
+  double value = json_value_get_number(json_value);
+  if (json_value_get_type(json_value) != JSONNumber || value < min || value > max) {
+    logger(LOG_ERROR, "config_get_number()", "%s must be a number in [%lu, %lu]", name, min, max);
+    *error = E_FAIL;
+    return def;
+  }
+
+  return (u_long)value;
+}
+
+/* The metrics server's listener, which no server may share */
+xps_config_listener_t *config_metrics_listener_create(xps_config_t *config) {
+  assert(config != NULL);
+
+  for (int i = 0; i < config->_all_listeners.length; i++) {
+    xps_config_listener_t *curr = config->_all_listeners.data[i];
+    if (curr->udp_route == NULL && curr->port == config->metrics_port) {
+      logger(LOG_ERROR, "config_metrics_listener_create()", "port %u is the metrics_port",
+             curr->port);
+      return NULL;
+    }
+  }
+
+  xps_config_listener_t *listener = malloc(sizeof(xps_config_listener_t));
+  if (listener == NULL) {
+    logger(LOG_ERROR, "config_metrics_listener_create()", "malloc() failed for 'listener'");
+    return NULL;
+  }
+
+  listener->host = config->metrics_host;
+  listener->port = config->metrics_port;
+  listener->tcp_route = NULL;
+  listener->udp_route = NULL;
+  vec_init(&(listener->_acl_routes));
+  listener->backlog = config->backlog;
+  listener->buffer_size = config->buffer_size;
+  listener->pipe_buff_thresh = config->pipe_buff_thresh;
+  listener->req_timeout_msec = config->req_timeout_msec;
+
+  return listener;
+}
+
+/* Effective tuning of config, its listeners and its routes, for /api */
+xps_buffer_t *xps_config_get_json(xps_config_t *config) {
+  assert(config != NULL);
+
+  size_t size = 512 + config->_cpus.length * 8;
+  for (int i = 0; i < config->_all_listeners.length; i++) {
+    xps_config_listener_t *listener = config->_all_listeners.data[i];
+    size += strlen(listener->host) + 160;
+  }
+  for (int i = 0; i < config->_all_routes.length; i++) {
+    xps_config_route_t *route = config->_all_routes.data[i];
+    size += (route->req_path ? strlen(route->req_path) : 0) + 128;
+  }
+
+  xps_buffer_t *buff = xps_buffer_create(size, 0, NULL);
+  if (buff == NULL) {
+    logger(LOG_ERROR, "xps_config_get_json()", "xps_buffer_create() failed");
+    return NULL;
+  }
+
+  char *data = (char *)buff->data;
+  size_t len = snprintf(data, size, "{\"workers\": %u,\"cpu_affinity\": [", config->workers);
+  for (int i = 0; i < config->_cpus.length; i++)
+    len += snprintf(data + len, size - len, "%s%d", i == 0 ? "" : ",", config->_cpus.data[i]);
+  len += snprintf(data + len, size - len,
+                        "],\"metrics_host\": \"%s\",\"metrics_port\": %u,"
+                        "\"max_epoll_events\": %u,\"nulls_thresh\": %u,\"backlog\": %u,"
+                        "\"buffer_size\": %u,\"pipe_buff_thresh\": %lu,"
+                        "\"req_timeout_msec\": %lu,\"listeners\": [",
+                        config->metrics_host, config->metrics_port, config->max_epoll_events,
+                        config->nulls_thresh, config->backlog, config->buffer_size,
+                        config->pipe_buff_thresh, config->req_timeout_msec);
+
+  for (int i = 0; i < config->_all_listeners.length; i++) {
+    xps_config_listener_t *listener = config->_all_listeners.data[i];
+    len += snprintf(data + len, size - len,
+                    "%s{\"host\": \"%s\",\"port\": %u,\"udp\": %s,\"backlog\": %u,"
+                    "\"buffer_size\": %u,\"pipe_buff_thresh\": %lu,\"req_timeout_msec\": %lu}",
+                    i == 0 ? "" : ",", listener->host, listener->port,
+                    listener->udp_route ? "true" : "false", listener->backlog,
+                    listener->buffer_size, listener->pipe_buff_thresh,
+                    listener->req_timeout_msec);
+  }
+
+  len += snprintf(data + len, size - len, "],\"routes\": [");
+  for (int i = 0; i < config->_all_routes.length; i++) {
+    xps_config_route_t *route = config->_all_routes.data[i];
+    len += snprintf(data + len, size - len,
+                    "%s{\"req_path\": \"%s\",\"buffer_size\": %u,\"pipe_buff_thresh\": %lu,"
+                    "\"req_timeout_msec\": %lu}",
+                    i == 0 ? "" : ",", route->req_path ? route->req_path : "",
+                    route->buffer_size, route->pipe_buff_thresh, route->req_timeout_msec);
+  }
+  len += snprintf(data + len, size - len, "]}");
+  buff->len = len;
+
+  return buff;
+}
+
+/*
+ * "workers" is a count or "auto", one core per CPU the process may run on.
+ * "cpu_affinity" lists the CPUs cores are pinned to, round-robin by core id,
+ * or is "none" to leave scheduling to the kernel. Without it, cores are
+ * pinned round-robin over the CPUs the process may run on.
+ */
+int config_parse_workers(xps_config_t *config, JSON_Object *root_object) {
+  assert(config != NULL);
+  assert(root_object != NULL);
+
+  vec_int_t allowed;
+  vec_init(&allowed);
+  if (cpus_allowed(&allowed) != OK) {
+    logger(LOG_ERROR, "config_parse_workers()", "cpus_allowed() failed");
+    vec_deinit(&allowed);
+    return E_FAIL;
+  }
+
+  // CPUs to pin to
+  JSON_Value *affinity_value = json_object_get_value(root_object, "cpu_affinity");
+  JSON_Array *affinity = json_value_get_array(affinity_value);
+  bool pinned = true;
+  if (affinity) {
+    for (size_t i = 0; i < json_array_get_count(affinity); i++) {
+      double cpu = json_array_get_number(affinity, i);
+      int index;
+      vec_find(&allowed, (int)cpu, index);
+      if (json_value_get_type(json_array_get_value(affinity, i)) != JSONNumber ||
+          cpu != (int)cpu || index == -1) {
+        logger(LOG_ERROR, "config_parse_workers()",
+               "cpu_affinity entry %zu is not a CPU this process may run on", i);
+        vec_deinit(&allowed);
+        return E_FAIL;
+      }
+      vec_push(&(config->_cpus), (int)cpu);
+    }
+  } else if (affinity_value && json_value_get_string(affinity_value) &&
+             strcmp(json_value_get_string(affinity_value), "none") == 0) {
+    pinned = false;
+  } else if (affinity_value) {
+    logger(LOG_ERROR, "config_parse_workers()", "cpu_affinity must be a list of CPUs or \"none\"");
+    vec_deinit(&allowed);
+    return E_FAIL;
+  }
+  if (pinned && config->_cpus.length == 0)
+    vec_extend(&(config->_cpus), &allowed);
+
+  // Number of cores
+  JSON_Value *workers_value = json_object_get_value(root_object, "workers");
+  const char *workers_str = json_value_get_string(workers_value);
+  config->workers = 0;
+  if (json_value_get_type(workers_value) == JSONNumber) {
+    double workers = json_value_get_number(workers_value);
+    if (workers < 1 || workers > MAX_WORKERS || workers != (int)workers) {
+      logger(LOG_ERROR, "config_parse_workers()", "workers must be in [1, %d]", MAX_WORKERS);
+      vec_deinit(&allowed);
+      return E_FAIL;
+    }
+    config->workers = workers;
+  } else if (workers_value && (workers_str == NULL || strcmp(workers_str, "auto") != 0)) {
+    logger(LOG_ERROR, "config_parse_workers()", "workers must be a number or \"auto\"");
+    vec_deinit(&allowed);
+    return E_FAIL;
+  }
+  if (config->workers == 0)
+    config->workers = affinity && config->_cpus.length > 0 ? config->_cpus.length : allowed.length;
+  if (config->workers > MAX_WORKERS)
+    config->workers = MAX_WORKERS;
+
+  // One entry per core
+  if (config->_cpus.length > 0) {
+    vec_int_t cpus;
+    vec_init(&cpus);
+    for (u_int i = 0; i < config->workers; i++)
+      vec_push(&cpus, config->_cpus.data[i % config->_cpus.length]);
+    vec_deinit(&(config->_cpus));
+    config->_cpus = cpus;
+  }
+
+  vec_deinit(&allowed);
+  return OK;
+}
@@ -3,12 +3,52 @@
 
 #include "../xps.h"
 
+typedef enum xps_req_type_e {
+  REQ_FILE_SERVE,
+  REQ_REVERSE_PROXY,
+  REQ_REDIRECT,
+  REQ_METRICS,
+  REQ_TCP_PROXY,
+  REQ_UDP_PROXY,
+  REQ_INVALID
+} xps_req_type_t;
+
+typedef enum xps_lb_e {
+  LB_ROUND_ROBIN,
+  LB_IP_HASH,
+  LB_LEAST_CONN,
+  LB_EWMA,
+} xps_lb_t;
+
+typedef enum xps_hash_key_e {
+  HASH_KEY_IP,
+  HASH_KEY_HEADER,
+  HASH_KEY_COOKIE,
+} xps_hash_key_t;
+
 struct xps_config_s {
   const char *config_path;
   const char *server_name;
   u_int workers;
+  vec_int_t _cpus; // CPU each core is pinned to, by core id; empty when cores are not pinned
+  char *metrics_host;
+  u_int metrics_port;
+  u_int max_epoll_events; // events taken per epoll_wait()
+  u_int nulls_thresh;     // NULL slots a core's lists may hold before they are compacted
+  u_int backlog;          // defaults for servers and routes that do not set their own
+  u_int buffer_size;
+  u_long pipe_buff_thresh;
+  u_long req_timeout_msec;
   vec_void_t servers;
   vec_void_t _all_listeners;
+  vec_void_t _all_routes; // every route, at the index given by its _id
+  vec_void_t _error_res_templates; // pre-serialized error responses, one per status code
+  xps_config_server_key_t **_server_map; // (listener, hostname) -> server, _server_map_size chains
+  u_int _server_map_size;
+  u_long _generation; // differs between configs, so cached lookups of an old one are ignored
+  u_int _n_switched;  // cores serving this config, once it is published by a reload
+  u_int _n_released;  // cores that moved off it and whose sessions on it have ended
+  xps_config_listener_t *_metrics_listener; // settings of the metrics server's listener
   JSON_Value *_config_json;
 };
 
@@ -16,41 +56,85 @@ struct xps_config_server_s {
   vec_void_t listeners;
   vec_void_t hostnames;
   vec_void_t routes;
+  u_int backlog;            // listen() backlog of its listeners
+  u_int buffer_size;        // bytes read per recv() from its clients
+  u_long pipe_buff_thresh;  // bytes a pipe holds before its source is paused
+  u_long req_timeout_msec;  // close a client that is idle this long
+  xps_config_route_node_t *_route_trie; // routes by req_path, for longest prefix match
+};
+
+/* Node of a radix trie over req_path bytes; a node's path is the labels from the root down */
+struct xps_config_route_node_s {
+  char *label;
+  size_t label_len;
+  xps_config_route_t *route; // route whose req_path ends at this node, or NULL
+  vec_void_t children;       // labels start with distinct bytes
+};
+
+/* Entry of config->_server_map: the first server on a listener serving hostname */
+struct xps_config_server_key_s {
+  const char *host;
+  u_int port;
+  const char *hostname; // NULL for the first server that has no hostnames
+  int server_index;
+  xps_config_server_key_t *next;
 };
 
 struct xps_config_listener_s {
   const char *host;
   u_int port;
+  xps_config_route_t *tcp_route; // set when the listener belongs to a tcp_proxy server
+  xps_config_route_t *udp_route; // set when the listener belongs to a udp_proxy server
+  vec_void_t _acl_routes; // every route served on it, if all have ip lists; otherwise empty
+  u_int backlog;           // settings of the first server on it
+  u_int buffer_size;
+  u_long pipe_buff_thresh;
+  u_long req_timeout_msec;
 };
 
 struct xps_config_route_s {
   const char *req_path;
   const char *type;
+  xps_req_type_t _type;
+  size_t _req_path_len;
   const char *dir_path;
+  char *_dir_path; // dir_path made absolute against the config file's directory
   vec_void_t index;
-  vec_void_t ip_whitelist; 
-  vec_void_t ip_blacklist; 
+  xps_acl_t *ip_whitelist; // NULL when the route has none
+  xps_acl_t *ip_blacklist; // NULL when the route has none
   bool gzip_enable;             
   int gzip_level;               
   vec_void_t gzip_mime_types;     // get default mime types and append the rest
   vec_void_t upstreams;
+  vec_int_t upstream_weights;   // index-aligned with upstreams
+  vec_int_t _upstream_schedule; // smooth weighted round-robin order of upstream indices
+  const char *hash_key;         // ip_hash key: "ip", "header:<name>" or "cookie:<name>"
+  xps_hash_key_t _hash_key_type;
+  const char *_hash_key_name;   // header or cookie name, inside hash_key
+  vec_int_t _maglev_table;      // ip_hash: upstream index for each of MAGLEV_TABLE_SIZE slots
+  bool x_forwarded_for;
+  bool splice; // pass large response bodies through with splice()
+  u_long idle_timeout_msec; // tcp_proxy, udp_proxy: close after this long without traffic
   const char *load_balancing;
-  u_long _round_robin_counter;
+  xps_lb_t _lb;
+  u_int _id; // index of the route's load balancer position in core->lb_counters
+  const char *health_check_type; // NULL, "tcp" or "http"
+  const char *health_check_path;
+  u_long health_check_interval_msec;
+  vec_void_t _upstream_health; // xps_health_entry_t per upstream, filled by xps_health_start()
   u_int http_status_code;
   const char *redirect_url;
+  xps_http_res_template_t *_redirect_res; // pre-serialized redirect response
   bool keep_alive;
+  u_int buffer_size;       // bytes read per recv() from its upstreams
+  u_long pipe_buff_thresh; // for file and upstream pipes
+  u_long req_timeout_msec; // once a request is routed here
 };
 
-typedef enum xps_req_type_e {
-  REQ_FILE_SERVE,
-  REQ_REVERSE_PROXY,
-  REQ_REDIRECT,
-  REQ_METRICS,
-  REQ_INVALID
-} xps_req_type_t;
-
+/* Result of routing one request, filled in caller-owned storage */
 struct xps_config_lookup_s {
   xps_req_type_t type;
+  xps_config_route_t *route; // NULL for REQ_METRICS
 
   /* file_serve */
   char *file_path; // absolute path
@@ -58,27 +142,49 @@ struct xps_config_lookup_s {
   long file_start; // parse range header
                    // https://developer.mozilla.org/en-US/docs/Web/HTTP/Range_requests
   long file_end;
-
-  bool gzip_enable;           
-  int gzip_level; // -1 to 9  
+  bool gzip_enable; // route allows it, client accepts it and the mime type matches
 
   /* reverse_proxy */
   const char *upstream;
-
-  /* redirect */
-  u_int http_status_code;
-  const char *redirect_url;
+  xps_health_entry_t *upstream_health;
 
   /* common */
   bool keep_alive;
-  vec_void_t ip_whitelist; 
-  vec_void_t ip_blacklist; 
+};
+
+/* A routing result remembered by (listener, Host header, pathname) */
+struct xps_config_cache_entry_s {
+  u_long hash;
+  xps_listener_t *listener;
+  char *host; // NULL when the request had no Host header
+  char *pathname; // NULL when the slot is empty
+  u_long generation;
+  u_long expire_msec;
+
+  int result; // OK or E_NOTFOUND
+  xps_config_route_t *route;
+  char *file_path;
+  char *dir_path;
+  bool gzip_mime; // file_path has a mime type the route compresses, true without a file
+};
+
+/* Per-core cache in front of route matching and file resolution, one entry per slot */
+struct xps_config_cache_s {
+  xps_config_cache_entry_t *entries;
+  u_int size;
 };
 
 xps_config_t *xps_config_create(const char *config_path);
 void xps_config_destroy(xps_config_t *config);
-xps_config_lookup_t *xps_config_lookup(xps_config_t *config, xps_http_req_t *http_req,
-                                       xps_connection_t *client, int *error);
-void xps_config_lookup_destroy(xps_config_lookup_t *config_lookup, xps_core_t *core);
+int xps_config_lookup(xps_config_t *config, xps_http_req_t *http_req, xps_connection_t *client,
+                      xps_config_lookup_t *lookup);
+int xps_config_balance(xps_config_route_t *route, xps_http_req_t *http_req, xps_core_t *core,
+                       const struct in6_addr *client_addr);
+bool xps_config_ip_allowed(xps_config_route_t *route, const struct in6_addr *addr);
+void xps_config_lookup_clear(xps_config_lookup_t *lookup);
+xps_config_cache_t *xps_config_cache_create(u_int size);
+void xps_config_cache_destroy(xps_config_cache_t *cache);
+xps_http_res_template_t *xps_config_error_res(xps_config_t *config, u_int status_code);
+xps_buffer_t *xps_config_get_json(xps_config_t *config);
 
 #endif
\ No newline at end of file
@@ -2,7 +2,7 @@
 #include "xps_metrics.h"
 #include "xps_timer.h"
 
-xps_core_t *xps_core_create(xps_config_t *config) {
+xps_core_t *xps_core_create(xps_config_t *config, u_int id) {
 
   xps_core_t *core = malloc(sizeof(xps_core_t)); /* allocate memory using malloc() */
   /* handle error where core == NULL */
@@ -11,7 +11,7 @@ xps_core_t *xps_core_create(xps_config_t *config) {
     return NULL;
   }
 
-  xps_loop_t *loop = xps_loop_create(core); /* create xps_loop instance */
+  xps_loop_t *loop = xps_loop_create(core, config->max_epoll_events); /* create xps_loop instance */
   /* handle error where loop == NULL */
   if (loop == NULL) {
     logger(LOG_ERROR, "xps_core_create()", "xps_loop_create() failed to create loop");
@@ -20,19 +20,33 @@ xps_core_t *xps_core_create(xps_config_t *config) {
   }
 
   // Init values
+  core->id = id;
+  core->cpu = config->_cpus.length > 0 ? config->_cpus.data[id] : -1;
+  core->node = core->cpu >= 0 ? cpu_node(core->cpu) : 0;
   core->loop = loop;
   core->config = config;
+  core->config_refs = 0;
+  vec_init(&(core->retired_configs));
   vec_init(&(core->listeners));
   vec_init(&(core->connections));
   vec_init(&(core->pipes));
   vec_init(&(core->sessions));
+  vec_init(&(core->tcp_sessions));
+  vec_init(&(core->splices));
+  vec_init(&(core->udp_proxies));
+  vec_init(&(core->upstream_pool));
   core->n_null_listeners = 0;
   core->n_null_connections = 0;
   core->n_null_pipes = 0;
   core->n_null_sessions = 0;
+  core->n_null_tcp_sessions = 0;
   core->n_null_timers = 0;
+  core->n_null_splices = 0;
   core->init_time_msec = 0;
   core->curr_time_msec = 0;
+  core->rand_seed = time(NULL) ^ (u_long)core;
+  core->http_date[0] = '\0';
+  core->http_date_sec = 0;
 
   // TODO: STAGE22
   xps_metrics_t *metrics = xps_metrics_create(core, config);
@@ -58,8 +72,66 @@ xps_core_t *xps_core_create(xps_config_t *config) {
     return NULL;
   }
 
+  xps_timer_t *upstream_pool_timer =
+    xps_timer_create(core, DEFAULT_UPSTREAM_POOL_SWEEP_MSEC, core, xps_upstream_pool_sweep_handler);
+  if (upstream_pool_timer == NULL) {
+    logger(LOG_ERROR, "xps_core_create()", "xps_timer_create() failed'");
+    xps_timer_destroy(metrics_update_timer);
+    xps_loop_destroy(loop);
+    xps_metrics_destroy(metrics);
+    free(core);
+    return NULL;
+  }
+
+  xps_dns_cache_t *dns_cache = xps_dns_cache_create(config);
+  if (dns_cache == NULL) {
+    logger(LOG_ERROR, "xps_core_create()", "xps_dns_cache_create() failed'");
+    xps_timer_destroy(upstream_pool_timer);
+    xps_timer_destroy(metrics_update_timer);
+    xps_loop_destroy(loop);
+    xps_metrics_destroy(metrics);
+    free(core);
+    return NULL;
+  }
+
+  // Start each core at a different point of every route's schedule, so the
+  // cores together still spread requests evenly
+  u_long *lb_counters = malloc(sizeof(u_long) * (config->_all_routes.length + 1));
+  if (lb_counters == NULL) {
+    logger(LOG_ERROR, "xps_core_create()", "malloc() failed for 'lb_counters'");
+    xps_dns_cache_destroy(dns_cache);
+    xps_timer_destroy(upstream_pool_timer);
+    xps_timer_destroy(metrics_update_timer);
+    xps_loop_destroy(loop);
+    xps_metrics_destroy(metrics);
+    free(core);
+    return NULL;
+  }
+  for (int i = 0; i < config->_all_routes.length; i++) {
+    xps_config_route_t *route = config->_all_routes.data[i];
+    lb_counters[i] = (u_long)id * route->_upstream_schedule.length / config->workers;
+  }
+
+  xps_config_cache_t *lookup_cache = xps_config_cache_create(DEFAULT_LOOKUP_CACHE_SIZE);
+  if (lookup_cache == NULL) {
+    logger(LOG_ERROR, "xps_core_create()", "xps_config_cache_create() failed");
+    free(lb_counters);
+    xps_dns_cache_destroy(dns_cache);
+    xps_timer_destroy(upstream_pool_timer);
+    xps_timer_destroy(metrics_update_timer);
+    xps_loop_destroy(loop);
+    xps_metrics_destroy(metrics);
+    free(core);
+    return NULL;
+  }
+
   core->metrics = metrics;
+  core->lb_counters = lb_counters;
+  core->n_lb_counters = config->_all_routes.length;
+  core->lookup_cache = lookup_cache;
   core->metrics_update_timer = metrics_update_timer;
+  core->upstream_pool_timer = upstream_pool_timer;
+  core->dns_cache = dns_cache;
 
   logger(LOG_DEBUG, "xps_core_create()", "created core");
 
@@ -78,6 +150,30 @@ void xps_core_destroy(xps_core_t *core) {
   }
   vec_deinit(&(core->sessions));
 
+  // Destroy tcp sessions, along with their connections
+  for (int i = 0; i < core->tcp_sessions.length; i++) {
+    xps_tcp_session_t *session = core->tcp_sessions.data[i];
+    if (session != NULL)
+      xps_tcp_session_destroy(session);
+  }
+  vec_deinit(&(core->tcp_sessions));
+
+  // Destroy udp proxies, along with their flows
+  for (int i = 0; i < core->udp_proxies.length; i++) {
+    xps_udp_proxy_t *proxy = core->udp_proxies.data[i];
+    if (proxy != NULL)
+      xps_udp_proxy_destroy(proxy);
+  }
+  vec_deinit(&(core->udp_proxies));
+
+  // Sessions destroy their splices; any left have lost their owner
+  for (int i = 0; i < core->splices.length; i++) {
+    xps_splice_t *splice = core->splices.data[i];
+    if (splice != NULL)
+      xps_splice_destroy(splice);
+  }
+  vec_deinit(&(core->splices));
+
   // Destroy connections
   for (int i = 0; i < core->connections.length; i++) {
     xps_connection_t *connection = core->connections.data[i];
@@ -85,6 +181,7 @@ void xps_core_destroy(xps_core_t *core) {
       xps_connection_destroy(connection);
   }
   vec_deinit(&(core->connections));
+  vec_deinit(&(core->upstream_pool));
 
   /* destory all the listeners and de-initialize core->listeners */
   for (int i = 0; i < core->listeners.length; i++) {
@@ -123,6 +220,14 @@ void xps_core_destroy(xps_core_t *core) {
   /* destory metrics attached to the core*/
   xps_metrics_destroy(core->metrics);
 
+  // Sessions released their configs as they were destroyed
+  assert(core->retired_configs.length == 0);
+  vec_deinit(&(core->retired_configs));
+
+  xps_dns_cache_destroy(core->dns_cache);
+  free(core->lb_counters);
+  xps_config_cache_destroy(core->lookup_cache);
+
   /* free core instance */
   free(core);
 
@@ -136,6 +241,15 @@ void xps_core_start(xps_core_t *core) {
 
   logger(LOG_DEBUG, "xps_start()", "starting core");
 
+  // Before the loop runs, so what it allocates lands on the core's NUMA node
+  if (core->cpu >= 0) {
+    if (cpu_pin_thread(pthread_self(), core->cpu) == OK)
+      logger(LOG_DEBUG, "xps_core_start()", "core %u pinned to cpu %d on node %d", core->id,
+             core->cpu, core->node);
+    else
+      logger(LOG_ERROR, "xps_core_start()", "cpu_pin_thread() failed for core %u", core->id);
+  }
+
   /* run loop instance using xps_loop_run() */
   xps_loop_run(core->loop);
 }
@@ -156,4 +270,14 @@ void xps_core_update_time(xps_core_t *core) {
   // Set 'init_time_msec'
   if (core->init_time_msec == 0)
     core->init_time_msec = core->curr_time_msec;
+
+  // Refresh cached HTTP Date string once per second
+  u_long curr_sec = core->curr_time_msec / 1000;
+  if (curr_sec != core->http_date_sec) {
+    time_t now = curr_sec;
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(core->http_date, sizeof(core->http_date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    core->http_date_sec = curr_sec;
+  }
 }
\ No newline at end of file
@@ -4,29 +4,49 @@
 #include "../xps.h"
 
 struct xps_core_s {
+  u_int id; // 0 .. workers - 1
+  int cpu;  // CPU its thread is pinned to, -1 when not pinned
+  int node; // NUMA node of cpu
   xps_loop_t *loop;
   xps_config_t *config;
+  u_int config_refs;          // sessions and tcp sessions on config
+  vec_void_t retired_configs; // configs this core moved off that its sessions still use
 
   vec_void_t listeners;
   vec_void_t connections;
   vec_void_t pipes;
   vec_void_t sessions;
+  vec_void_t tcp_sessions;
   vec_void_t timers;
+  vec_void_t splices;
+  vec_void_t udp_proxies; // this core's sockets of udp_proxy listeners
   u_int n_null_listeners;
   u_int n_null_connections;
   u_int n_null_pipes;
   u_int n_null_sessions;
+  u_int n_null_tcp_sessions;
   u_int n_null_timers;
+  u_int n_null_splices;
 
   xps_metrics_t *metrics;
+  xps_dns_cache_t *dns_cache;
+  vec_void_t upstream_pool; // idle keep-alive upstream connections
+  u_long *lb_counters;      // load balancer position per route, indexed by route->_id
+  u_int n_lb_counters;
+  xps_config_cache_t *lookup_cache;
 
   u_long curr_time_msec;
   u_long init_time_msec;
+  u_int rand_seed; // for rand_r(), so cores don't share random state
+
+  char http_date[32];   // cached value of HTTP Date header, refreshed every second
+  u_long http_date_sec; // curr_time_msec / 1000 at which http_date was last formatted
 
   xps_timer_t *metrics_update_timer;
+  xps_timer_t *upstream_pool_timer;
 };
 
-xps_core_t *xps_core_create(xps_config_t *config);
+xps_core_t *xps_core_create(xps_config_t *config, u_int id);
 void xps_core_destroy(xps_core_t *core);
 void xps_core_start(xps_core_t *core);
 void xps_core_update_time(xps_core_t *core);
@@ -5,6 +5,8 @@ loop_event_t *loop_event_create(u_int fd, void *ptr, xps_handler_t read_cb, xps_
 void loop_event_destroy(loop_event_t *event);
 void handle_epoll_events(xps_loop_t *loop, int n_events);
 bool handle_pipes(xps_loop_t *loop);
+bool handle_splices(xps_loop_t *loop);
+bool handle_udp_proxies(xps_loop_t *loop);
 void filter_nulls(xps_core_t *core);
 long handle_timers(xps_loop_t *loop);
 
@@ -46,10 +48,12 @@ void loop_event_destroy(loop_event_t *event) {
  * and initializes its values.
  *
  * @param core : The core instance to which the loop belongs
+ * @param max_events : Most events a single epoll_wait() returns
  * @return A pointer to the newly created loop instance, or NULL on failure.
  */
-xps_loop_t *xps_loop_create(xps_core_t *core) {
+xps_loop_t *xps_loop_create(xps_core_t *core, u_int max_events) {
   assert(core != NULL);
+  assert(max_events > 0);
 
   int epoll_fd = epoll_create1(0);
   if (epoll_fd < 0) {
@@ -61,14 +65,25 @@ xps_loop_t *xps_loop_create(xps_core_t *core) {
   xps_loop_t *loop = malloc(sizeof(xps_loop_t));
   if (loop == NULL) {
     logger(LOG_ERROR, "xps_loop_create()", "malloc() failed for 'loop'");
+    close(epoll_fd);
+    return NULL;
+  }
+
+  loop->epoll_events = malloc(sizeof(struct epoll_event) * max_events);
+  if (loop->epoll_events == NULL) {
+    logger(LOG_ERROR, "xps_loop_create()", "malloc() failed for 'epoll_events'");
+    close(epoll_fd);
+    free(loop);
     return NULL;
   }
 
   loop->core = core;
   loop->epoll_fd = epoll_fd;
+  loop->max_events = max_events;
 
   vec_init(&loop->events);
   loop->n_null_events = 0;
+  loop->stopped = false;
 
   return loop;
 }
@@ -93,6 +108,7 @@ void xps_loop_destroy(xps_loop_t *loop) {
   }
   vec_deinit(&loop->events);
   close(loop->epoll_fd);
+  free(loop->epoll_events);
   free(loop);
 }
 
@@ -232,29 +248,71 @@ bool handle_pipes(xps_loop_t *loop) {
   return false;
 }
 
+bool handle_splices(xps_loop_t *loop) {
+  assert(loop != NULL);
+
+  // Entries can be destroyed by the close_cb of an earlier one
+  for (int i = 0; i < loop->core->splices.length; i++) {
+    xps_splice_t *splice = loop->core->splices.data[i];
+    if (splice != NULL && xps_splice_is_ready(splice))
+      xps_splice_handler(splice);
+  }
+
+  for (int i = 0; i < loop->core->splices.length; i++) {
+    xps_splice_t *splice = loop->core->splices.data[i];
+    if (splice != NULL && xps_splice_is_ready(splice))
+      return true;
+  }
+  return false;
+}
+
+bool handle_udp_proxies(xps_loop_t *loop) {
+  assert(loop != NULL);
+
+  bool has_ready = false;
+  for (int i = 0; i < loop->core->udp_proxies.length; i++) {
+    xps_udp_proxy_t *proxy = loop->core->udp_proxies.data[i];
+    if (proxy != NULL && xps_udp_proxy_is_ready(proxy))
+      xps_udp_proxy_handler(proxy);
+    if (proxy != NULL && xps_udp_proxy_is_ready(proxy))
+      has_ready = true;
+  }
+  return has_ready;
+}
+
 void filter_nulls(xps_core_t *core) {
   /*check whether number of nulls in each of events, listeners, connections, pipes list
-exceeds DEFAULT_NULLS_THRESH and filter nulls using vec_filter_null() and set
+exceeds nulls_thresh of the config and filter nulls using vec_filter_null() and set
 number of nulls in each list to 0*/
+  u_int nulls_thresh = core->config->nulls_thresh;
 
-  if (core->n_null_connections > DEFAULT_NULLS_THRESH) {
+  if (core->n_null_connections > nulls_thresh) {
     vec_filter_null(&(core->connections));
     core->n_null_connections = 0;
   }
-  if (core->n_null_listeners > DEFAULT_NULLS_THRESH) {
+  if (core->n_null_listeners > nulls_thresh) {
     vec_filter_null(&(core->listeners));
     core->n_null_listeners = 0;
   }
-  if (core->n_null_pipes > DEFAULT_NULLS_THRESH) {
+  if (core->n_null_pipes > nulls_thresh) {
     vec_filter_null(&(core->pipes));
     core->n_null_pipes = 0;
   }
-  if (core->n_null_sessions > DEFAULT_NULLS_THRESH) {
+  if (core->n_null_sessions > nulls_thresh) {
     vec_filter_null(&(core->sessions));
     core->n_null_sessions = 0;
   }
 
-	if (core->n_null_timers > DEFAULT_NULLS_THRESH) {
+  if (core->n_null_tcp_sessions > nulls_thresh) {
+    vec_filter_null(&(core->tcp_sessions));
+    core->n_null_tcp_sessions = 0;
+  }
+  if (core->n_null_splices > nulls_thresh) {
+    vec_filter_null(&(core->splices));
+    core->n_null_splices = 0;
+  }
+
+	if (core->n_null_timers > nulls_thresh) {
     vec_filter_null(&(core->timers));
     core->n_null_timers = 0;
   }
@@ -321,28 +379,37 @@ void xps_loop_run(xps_loop_t *loop) {
 
   logger(LOG_DEBUG, "xps_loop_run()", "starting to run loop");
 
-  while (1) {
+  while (!__atomic_load_n(&(loop->stopped), __ATOMIC_ACQUIRE)) {
     logger(LOG_DEBUG, "xps_loop_run()", "loop top");
 
 		//Update current time before handling timers 
 		xps_core_update_time(loop->core); 
 
+    // Between events is the core's quiescent point, where it takes a reloaded config
+    xps_reload_sync(loop->core);
+
 		// Handle timers
     long timeout_msec = handle_timers(loop);
 
+    // Handle splices before pipes, a finished splice hands its connections back to them
+    bool has_ready_splices = handle_splices(loop);
+
     // Handle pipes
     bool has_ready_pipes = handle_pipes(loop);
 
-    int timeout = has_ready_pipes ? 0 : timeout_msec; 
+    // Handle datagrams, a batch per ready socket
+    bool has_ready_udp = handle_udp_proxies(loop);
+
+    int timeout = has_ready_pipes || has_ready_splices || has_ready_udp ? 0 : timeout_msec;
 
     logger(LOG_DEBUG, "xps_loop_run()", "epoll waiting");
-    int n_events = epoll_wait(loop->epoll_fd, loop->epoll_events, MAX_EPOLL_EVENTS, timeout);
+    int n_events = epoll_wait(loop->epoll_fd, loop->epoll_events, loop->max_events, timeout);
     logger(LOG_DEBUG, "xps_loop_run()", "epoll wait over");
 
 		//update time after epoll_wait() 
 		xps_core_update_time(loop->core);
 
-    if (n_events < 0)
+    if (n_events < 0 && errno != EINTR)
       logger(LOG_ERROR, "xps_loop_run()", "epoll_wait() error");
 
     // Handle epoll events
@@ -354,6 +421,13 @@ void xps_loop_run(xps_loop_t *loop) {
   }
 }
 
+/* Makes xps_loop_run() return at its next pass; safe to call from a signal handler */
+void xps_loop_stop(xps_loop_t *loop) {
+  assert(loop != NULL);
+
+  __atomic_store_n(&(loop->stopped), true, __ATOMIC_RELEASE);
+}
+
 
 long handle_timers(xps_loop_t *loop) {
   assert(loop != NULL);
@@ -370,7 +444,14 @@ long handle_timers(xps_loop_t *loop) {
 
     if (timeout_msec <= 0) { // timeout <= 0, timer expired! Call callback
       curr_timer->cb(curr_timer->ptr);
-    } else {
+
+      // A periodic timer re-arms itself in its callback; count its next expiry too
+      if (loop->core->timers.data[i] != curr_timer)
+        continue;
+      timeout_msec = curr_timer->expiry_time_msec - loop->core->curr_time_msec;
+    }
+
+    if (timeout_msec > 0) {
       min_timeout_msec = (timeout_msec < min_timeout_msec) || (min_timeout_msec == -1)
                            ? timeout_msec
                            : min_timeout_msec;
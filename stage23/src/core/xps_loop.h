@@ -6,9 +6,11 @@
 struct xps_loop_s {
   xps_core_t *core;
   u_int epoll_fd;
-  struct epoll_event epoll_events[MAX_EPOLL_EVENTS];
+  struct epoll_event *epoll_events;
+  u_int max_events; // taken per epoll_wait()
   vec_void_t events;
   u_int n_null_events;
+  bool stopped; // set by xps_loop_stop(), possibly from a signal handler
 };
 
 struct loop_event_s {
@@ -21,11 +23,12 @@ struct loop_event_s {
 
 typedef struct loop_event_s loop_event_t;
 
-xps_loop_t *xps_loop_create(xps_core_t *core);
+xps_loop_t *xps_loop_create(xps_core_t *core, u_int max_events);
 void xps_loop_destroy(xps_loop_t *loop);
 
 int xps_loop_attach(xps_loop_t *loop, u_int fd, int event_flags, void *ptr, xps_handler_t read_cb, xps_handler_t write_cb, xps_handler_t close_cb); // [!code ++ ]
 int xps_loop_detach(xps_loop_t *loop, u_int fd);
 void xps_loop_run(xps_loop_t *loop);
+void xps_loop_stop(xps_loop_t *loop);
 
 #endif
\ No newline at end of file
@@ -2,9 +2,24 @@
 #include "xps_timer.h"
 #include <sys/resource.h>
 
-xps_buffer_t *metrics_to_json(xps_metrics_t *metrics, float workers_cpu_percent[]);
+xps_buffer_t *metrics_to_json(xps_metrics_t *metrics, float workers_cpu_percent[],
+                              const char *latency_json);
 float get_sys_cpu_percent();
 void get_sys_mem_usage(u_long *total_mem_bytes, u_long *used_mem_bytes);
+void metrics_write_begin(xps_metrics_counters_t *counters);
+void metrics_write_end(xps_metrics_counters_t *counters);
+void metrics_snapshot(xps_metrics_counters_t *counters, xps_metrics_counts_t *counts);
+void metrics_hist_add(xps_metrics_hist_t *hist, u_long usec);
+u_int metrics_hist_index(u_long usec);
+u_long metrics_hist_upper(u_int index);
+u_long metrics_hist_count(const xps_metrics_hist_t *hist);
+u_long metrics_hist_percentile(const xps_metrics_hist_t *hist, u_long count, double q);
+u_long metrics_hist_max(const xps_metrics_hist_t *hist);
+int metrics_hist_json(const xps_metrics_hist_t *hist, const char *name, char *str, size_t size);
+
+// The owning core is the only writer, so a load and a store make the add
+#define METRICS_ADD(field, val) __atomic_store_n(&(field), (field) + (val), __ATOMIC_RELAXED)
+#define METRICS_SUB(field, val) __atomic_store_n(&(field), (field) - (val), __ATOMIC_RELAXED)
 
 xps_metrics_t *xps_metrics_create(xps_core_t *core, xps_config_t *config) {
   assert(core != NULL);
@@ -16,12 +31,19 @@ xps_metrics_t *xps_metrics_create(xps_core_t *core, xps_config_t *config) {
     return NULL;
   }
 
+  // Whole cache lines, so no other core's data shares them
+  metrics->counters = aligned_alloc(64, sizeof(xps_metrics_counters_t));
+  if (metrics->counters == NULL) {
+    logger(LOG_ERROR, "xps_metrics_create()", "aligned_alloc() failed for counters");
+    free(metrics);
+    return NULL;
+  }
+  memset(metrics->counters, 0, sizeof(xps_metrics_counters_t));
+
   metrics->core = core;
 
   metrics->_last_worker_cpu_time_msec = 0;
   metrics->_last_worker_cpu_update_uptime_msec = 0;
-  metrics->_res_time_sum = 0;
-  metrics->_res_n = 0;
 
   metrics->server_name = config->server_name;
   metrics->pid = getpid();
@@ -32,31 +54,6 @@ xps_metrics_t *xps_metrics_create(xps_core_t *core, xps_config_t *config) {
   metrics->sys_ram_usage_bytes = 0;
   metrics->sys_ram_total_bytes = 0;
 
-  metrics->worker_ram_usage_bytes = 0;
-  metrics->worker_cpu_usage_percent = 0;
-
-  metrics->conn_accept_error = 0;
-  metrics->conn_current = 0;
-  metrics->conn_accepted = 0;
-  metrics->conn_error = 0;
-  metrics->conn_timeout = 0;
-
-  metrics->req_current = 0;
-  metrics->req_file_serve = 0;
-  metrics->req_redirect = 0;
-  metrics->req_reverse_proxy = 0;
-  metrics->req_total = 0;
-
-  metrics->res_avg_res_time_msec = 0;
-  metrics->res_peak_res_time_msec = 0;
-  metrics->res_code_2xx = 0;
-  metrics->res_code_3xx = 0;
-  metrics->res_code_4xx = 0;
-  metrics->res_code_5xx = 0;
-
-  metrics->traffic_total_send_bytes = 0;
-  metrics->traffic_total_recv_bytes = 0;
-
   logger(LOG_DEBUG, "xps_metrics_create()", "created metrics");
 
   return metrics;
@@ -65,6 +62,7 @@ xps_metrics_t *xps_metrics_create(xps_core_t *core, xps_config_t *config) {
 void xps_metrics_destroy(xps_metrics_t *metrics) {
   assert(metrics != NULL);
 
+  free(metrics->counters);
   free(metrics);
   logger(LOG_DEBUG, "xps_metrics_destory()", "destroyed metrics");
 }
@@ -82,6 +80,7 @@ xps_buffer_t *xps_metrics_get_json(xps_metrics_t *metrics) {
   xps_metrics_t cumulative;
   memset(&cumulative, 0, sizeof(cumulative));
 
+  cumulative.core = metrics->core;
   cumulative.server_name = metrics->server_name;
   cumulative.pid = metrics->pid;
   cumulative.workers = metrics->workers;
@@ -92,116 +91,390 @@ xps_buffer_t *xps_metrics_get_json(xps_metrics_t *metrics) {
 
   float workers_cpu_percent[n_cores];
 
-  // will be needing to remove this loop and keep it for the next stage
+  // Sums over a consistent snapshot of each core; histograms merge by the same sum
+  xps_metrics_counts_t total;
+  memset(&total, 0, sizeof(total));
   for (int i = 0; i < n_cores; i++) {
-    xps_metrics_t *curr = cores[i]->metrics;
-
-    workers_cpu_percent[i] =
-      curr->worker_cpu_usage_percent; // for stage22 manage this appropriately...(make it for a
-                                      // single core)
-    cumulative.worker_ram_usage_bytes += curr->worker_ram_usage_bytes;
-
-    cumulative.conn_current += curr->conn_current;
-    cumulative.conn_accepted += curr->conn_accepted;
-    cumulative.conn_error += curr->conn_error;
-    cumulative.conn_timeout += curr->conn_timeout;
-    cumulative.conn_accept_error += curr->conn_accept_error;
-
-    cumulative.req_current += curr->req_current;
-    cumulative.req_total += curr->req_total;
-    cumulative.req_file_serve += curr->req_file_serve;
-    cumulative.req_reverse_proxy += curr->req_reverse_proxy;
-    cumulative.req_redirect += curr->req_redirect;
-
-    cumulative.res_avg_res_time_msec += curr->res_avg_res_time_msec;
-    cumulative.res_peak_res_time_msec += curr->res_peak_res_time_msec;
-    cumulative.res_code_2xx += curr->res_code_2xx;
-    cumulative.res_code_3xx += curr->res_code_3xx;
-    cumulative.res_code_4xx += curr->res_code_4xx;
-    cumulative.res_code_5xx += curr->res_code_5xx;
-
-    cumulative.traffic_total_send_bytes += curr->traffic_total_send_bytes;
-    cumulative.traffic_total_recv_bytes += curr->traffic_total_recv_bytes;
+    xps_metrics_counts_t curr;
+    metrics_snapshot(cores[i]->metrics->counters, &curr);
+
+    workers_cpu_percent[i] = curr.worker_cpu_usage_centi / 100.0;
+
+    u_long *dst = (u_long *)&total;
+    const u_long *src = (const u_long *)&curr;
+    for (size_t j = 0; j < sizeof(total) / sizeof(u_long); j++)
+      dst[j] += src[j];
   }
 
-  return metrics_to_json(&cumulative, workers_cpu_percent);
+  cumulative.worker_ram_usage_bytes = total.worker_ram_usage_bytes;
+
+  cumulative.conn_current = total.conn_current;
+  cumulative.conn_accepted = total.conn_accepted;
+  cumulative.conn_error = total.conn_error;
+  cumulative.conn_timeout = total.conn_timeout;
+  cumulative.conn_accept_error = total.conn_accept_error;
+
+  cumulative.req_current = total.req_current;
+  cumulative.req_total = total.req_total;
+  cumulative.req_file_serve = total.req_file_serve;
+  cumulative.req_reverse_proxy = total.req_reverse_proxy;
+  cumulative.req_redirect = total.req_redirect;
+
+  u_long ttfb_n = metrics_hist_count(&total.ttfb);
+  if (ttfb_n > 0)
+    cumulative.res_avg_res_time_msec = total.ttfb.sum_usec / ttfb_n / 1000;
+  cumulative.res_peak_res_time_msec = metrics_hist_max(&total.ttfb) / 1000;
+  cumulative.res_code_2xx = total.res_code_2xx;
+  cumulative.res_code_3xx = total.res_code_3xx;
+  cumulative.res_code_4xx = total.res_code_4xx;
+  cumulative.res_code_5xx = total.res_code_5xx;
+
+  u_long upstream_res_n = metrics_hist_count(&total.upstream_res);
+  if (upstream_res_n > 0)
+    cumulative.upstream_avg_res_time_msec = total.upstream_res.sum_usec / upstream_res_n / 1000;
+  cumulative.upstream_peak_res_time_msec = metrics_hist_max(&total.upstream_res) / 1000;
+  cumulative.upstream_pool_hits = total.upstream_pool_hits;
+  cumulative.upstream_pool_misses = total.upstream_pool_misses;
+  cumulative.upstream_pool_evictions = total.upstream_pool_evictions;
+
+  cumulative.tcp_conn_current = total.tcp_conn_current;
+  cumulative.tcp_conn_total = total.tcp_conn_total;
+  cumulative.tcp_to_upstream_bytes = total.tcp_to_upstream_bytes;
+  cumulative.tcp_to_client_bytes = total.tcp_to_client_bytes;
+
+  cumulative.udp_flows_current = total.udp_flows_current;
+  cumulative.udp_flows_total = total.udp_flows_total;
+  cumulative.udp_to_upstream_dgrams = total.udp_to_upstream_dgrams;
+  cumulative.udp_to_client_dgrams = total.udp_to_client_dgrams;
+  cumulative.udp_dropped_dgrams = total.udp_dropped_dgrams;
+
+  cumulative.lookup_cache_hits = total.lookup_cache_hits;
+  cumulative.lookup_cache_misses = total.lookup_cache_misses;
+
+  cumulative.traffic_total_send_bytes = total.traffic_total_send_bytes;
+  cumulative.traffic_total_recv_bytes = total.traffic_total_recv_bytes;
+
+  u_long lookups = cumulative.lookup_cache_hits + cumulative.lookup_cache_misses;
+  if (lookups > 0)
+    cumulative.lookup_cache_hit_percent = 100.0 * cumulative.lookup_cache_hits / lookups;
+
+  xps_reload_stats_t reload_stats;
+  xps_reload_get_stats(&reload_stats);
+  cumulative.config_reloads = reload_stats.reloads;
+  cumulative.config_reload_failures = reload_stats.failures;
+  cumulative.config_reload_last_msec = reload_stats.last_msec;
+  cumulative.config_draining = reload_stats.draining;
+
+  // Latency percentiles of the merged histograms
+  char latency_json[1024];
+  int len = 0;
+  len += metrics_hist_json(&total.req_time, "request", latency_json + len,
+                           sizeof(latency_json) - len);
+  latency_json[len++] = ',';
+  len += metrics_hist_json(&total.ttfb, "ttfb", latency_json + len, sizeof(latency_json) - len);
+  latency_json[len++] = ',';
+  len += metrics_hist_json(&total.upstream_connect, "upstream_connect", latency_json + len,
+                           sizeof(latency_json) - len);
+  latency_json[len++] = ',';
+  metrics_hist_json(&total.upstream_res, "upstream_response", latency_json + len,
+                    sizeof(latency_json) - len);
+
+  return metrics_to_json(&cumulative, workers_cpu_percent, latency_json);
 }
 
 void xps_metrics_set(xps_core_t *core, xps_metric_type_t type, long val) {
   assert(core != NULL);
   assert(val >= 0);
 
+  xps_metrics_counters_t *counters = core->metrics->counters;
+  xps_metrics_counts_t *c = &(counters->counts);
+
+  metrics_write_begin(counters);
   switch (type) {
     case M_CONN_ACCEPT:
-      core->metrics->conn_current += val;
-      core->metrics->conn_accepted += val;
+      METRICS_ADD(c->conn_current, val);
+      METRICS_ADD(c->conn_accepted, val);
       break;
     case M_CONN_CLOSE:
-      core->metrics->conn_current -= val;
-      assert(core->metrics->conn_current >= 0);
+      METRICS_SUB(c->conn_current, val);
       break;
     case M_CONN_ACCEPT_ERROR:
-      core->metrics->conn_accept_error += val;
+      METRICS_ADD(c->conn_accept_error, val);
       break;
     case M_CONN_ERROR:
-      core->metrics->conn_error += val;
+      METRICS_ADD(c->conn_error, val);
       break;
     case M_CONN_TIMEOUT:
-      core->metrics->conn_timeout += val;
+      METRICS_ADD(c->conn_timeout, val);
       break;
     case M_REQ_CREATE:
-      core->metrics->req_total += val;
-      core->metrics->req_current += val;
+      METRICS_ADD(c->req_total, val);
+      METRICS_ADD(c->req_current, val);
       break;
     case M_REQ_DESTROY:
-      core->metrics->req_current -= val;
-      assert(core->metrics->req_current >= 0);
+      METRICS_SUB(c->req_current, val);
       break;
     case M_REQ_FILE_SERVE:
-      core->metrics->req_file_serve += val;
+      METRICS_ADD(c->req_file_serve, val);
+      break;
     case M_REQ_REVERSE_PROXY:
-      core->metrics->req_reverse_proxy += val;
+      METRICS_ADD(c->req_reverse_proxy, val);
       break;
     case M_REQ_REDIRECT:
-      core->metrics->req_redirect += val;
+      METRICS_ADD(c->req_redirect, val);
+      break;
+    case M_REQ_TIME:
+      metrics_hist_add(&(c->req_time), val);
       break;
-    case M_RES_TIME:
-      core->metrics->_res_time_sum += val;
-      core->metrics->_res_n += 1;
-      core->metrics->res_avg_res_time_msec = core->metrics->_res_time_sum / core->metrics->_res_n;
-      if (core->metrics->res_peak_res_time_msec < val)
-        core->metrics->res_peak_res_time_msec = val;
+    case M_RES_TTFB:
+      metrics_hist_add(&(c->ttfb), val);
       break;
     case M_RES_2XX:
-      core->metrics->res_code_2xx += val;
+      METRICS_ADD(c->res_code_2xx, val);
       break;
     case M_RES_3XX:
-      core->metrics->res_code_3xx += val;
+      METRICS_ADD(c->res_code_3xx, val);
       break;
     case M_RES_4XX:
-      core->metrics->res_code_4xx += val;
+      METRICS_ADD(c->res_code_4xx, val);
       break;
     case M_RES_5XX:
-      core->metrics->res_code_5xx += val;
+      METRICS_ADD(c->res_code_5xx, val);
+      break;
+    case M_UPSTREAM_CONNECT_TIME:
+      metrics_hist_add(&(c->upstream_connect), val);
+      break;
+    case M_UPSTREAM_RES_TIME:
+      metrics_hist_add(&(c->upstream_res), val);
+      break;
+    case M_UPSTREAM_POOL_HIT:
+      METRICS_ADD(c->upstream_pool_hits, val);
+      break;
+    case M_UPSTREAM_POOL_MISS:
+      METRICS_ADD(c->upstream_pool_misses, val);
+      break;
+    case M_UPSTREAM_POOL_EVICT:
+      METRICS_ADD(c->upstream_pool_evictions, val);
+      break;
+    case M_TCP_SESSION_CREATE:
+      METRICS_ADD(c->tcp_conn_current, val);
+      METRICS_ADD(c->tcp_conn_total, val);
+      break;
+    case M_TCP_SESSION_DESTROY:
+      METRICS_SUB(c->tcp_conn_current, val);
+      break;
+    case M_TCP_TO_UPSTREAM_BYTES:
+      METRICS_ADD(c->tcp_to_upstream_bytes, val);
+      break;
+    case M_TCP_TO_CLIENT_BYTES:
+      METRICS_ADD(c->tcp_to_client_bytes, val);
+      break;
+    case M_UDP_FLOW_CREATE:
+      METRICS_ADD(c->udp_flows_current, val);
+      METRICS_ADD(c->udp_flows_total, val);
+      break;
+    case M_UDP_FLOW_DESTROY:
+      METRICS_SUB(c->udp_flows_current, val);
+      break;
+    case M_UDP_TO_UPSTREAM_DGRAMS:
+      METRICS_ADD(c->udp_to_upstream_dgrams, val);
+      break;
+    case M_UDP_TO_CLIENT_DGRAMS:
+      METRICS_ADD(c->udp_to_client_dgrams, val);
+      break;
+    case M_UDP_DROP_DGRAMS:
+      METRICS_ADD(c->udp_dropped_dgrams, val);
+      break;
+    case M_LOOKUP_CACHE_HIT:
+      METRICS_ADD(c->lookup_cache_hits, val);
+      break;
+    case M_LOOKUP_CACHE_MISS:
+      METRICS_ADD(c->lookup_cache_misses, val);
       break;
     case M_TRAFFIC_SEND_BYTES:
-      core->metrics->traffic_total_send_bytes += val;
+      METRICS_ADD(c->traffic_total_send_bytes, val);
       break;
     case M_TRAFFIC_RECV_BYTES:
-      core->metrics->traffic_total_recv_bytes += val;
+      METRICS_ADD(c->traffic_total_recv_bytes, val);
       break;
     default:
       logger(LOG_ERROR, "xps_set_metric()", "invalid metric type");
   }
+  metrics_write_end(counters);
+}
+
+/*
+ * Seqlock writer side. The core is the only writer, so plain increments of
+ * _seq suffice; the fences order them around the counts for other cores.
+ */
+void metrics_write_begin(xps_metrics_counters_t *counters) {
+  __atomic_store_n(&(counters->_seq), counters->_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void metrics_write_end(xps_metrics_counters_t *counters) {
+  __atomic_store_n(&(counters->_seq), counters->_seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies counters into counts with no update of the core half applied. After
+ * METRICS_SNAPSHOT_TRIES the last copy is kept: each word is still whole.
+ */
+void metrics_snapshot(xps_metrics_counters_t *counters, xps_metrics_counts_t *counts) {
+  assert(counters != NULL);
+  assert(counts != NULL);
+
+  const u_long *src = (const u_long *)&(counters->counts);
+  u_long *dst = (u_long *)counts;
+
+  for (int tries = 1;; tries++) {
+    u_int seq = __atomic_load_n(&(counters->_seq), __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < sizeof(*counts) / sizeof(u_long); i++)
+      dst[i] = __atomic_load_n(&(src[i]), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if ((seq & 1) == 0 && __atomic_load_n(&(counters->_seq), __ATOMIC_RELAXED) == seq)
+      return;
+    if (tries == METRICS_SNAPSHOT_TRIES) {
+      logger(LOG_DEBUG, "metrics_snapshot()", "gave up waiting for a quiet moment");
+      return;
+    }
+  }
 }
 
-xps_buffer_t *metrics_to_json(xps_metrics_t *metrics, float workers_cpu_percent[]) {
+/* Records usec in hist; called between metrics_write_begin() and metrics_write_end() */
+void metrics_hist_add(xps_metrics_hist_t *hist, u_long usec) {
+  assert(hist != NULL);
+
+  u_int index = metrics_hist_index(usec);
+  METRICS_ADD(hist->buckets[index], 1);
+  METRICS_ADD(hist->sum_usec, usec);
+}
+
+/*
+ * Bucket of usec. Below 2^METRICS_HIST_SUB_BITS the value is its own bucket;
+ * above, the top METRICS_HIST_SUB_BITS + 1 bits pick it, so a bucket is at
+ * most 1/32 of its values wide. Values past the last bucket land in it.
+ */
+u_int metrics_hist_index(u_long usec) {
+  const u_long sub_count = 1UL << METRICS_HIST_SUB_BITS;
+
+  if (usec >= (1UL << METRICS_HIST_MAX_BITS))
+    usec = (1UL << METRICS_HIST_MAX_BITS) - 1;
+  if (usec < sub_count)
+    return usec;
+
+  u_int msb = 63 - __builtin_clzl(usec);
+  u_int shift = msb - METRICS_HIST_SUB_BITS;
+  return ((shift + 1) << METRICS_HIST_SUB_BITS) + ((usec >> shift) - sub_count);
+}
+
+/* Largest value that falls in bucket index */
+u_long metrics_hist_upper(u_int index) {
+  assert(index < METRICS_HIST_BUCKETS);
+
+  const u_long sub_count = 1UL << METRICS_HIST_SUB_BITS;
+
+  if (index < sub_count)
+    return index;
+
+  u_int shift = (index >> METRICS_HIST_SUB_BITS) - 1;
+  u_long low = ((index & (sub_count - 1)) + sub_count) << shift;
+  return low + (1UL << shift) - 1;
+}
+
+u_long metrics_hist_count(const xps_metrics_hist_t *hist) {
+  assert(hist != NULL);
+
+  u_long count = 0;
+  for (u_int i = 0; i < METRICS_HIST_BUCKETS; i++)
+    count += hist->buckets[i];
+  return count;
+}
+
+/* Upper bound of the bucket holding the q-th quantile of count values */
+u_long metrics_hist_percentile(const xps_metrics_hist_t *hist, u_long count, double q) {
+  assert(hist != NULL);
+
+  if (count == 0)
+    return 0;
+
+  u_long rank = (u_long)(q * count);
+  if (rank < q * count)
+    rank++;
+  if (rank == 0)
+    rank = 1;
+
+  u_long seen = 0;
+  for (u_int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen >= rank)
+      return metrics_hist_upper(i);
+  }
+  return metrics_hist_upper(METRICS_HIST_BUCKETS - 1);
+}
+
+u_long metrics_hist_max(const xps_metrics_hist_t *hist) {
+  assert(hist != NULL);
+
+  for (int i = METRICS_HIST_BUCKETS - 1; i >= 0; i--)
+    if (hist->buckets[i] > 0)
+      return metrics_hist_upper(i);
+  return 0;
+}
+
+/* Writes "name": {...} into str, returns its length */
+int metrics_hist_json(const xps_metrics_hist_t *hist, const char *name, char *str, size_t size) {
+  assert(hist != NULL);
+  assert(name != NULL);
+  assert(str != NULL);
+
+  u_long count = metrics_hist_count(hist);
+  int len = snprintf(str, size,
+                     "\"%s\": {"
+                     "\"count\": %lu,"
+                     "\"mean\": %lu,"
+                     "\"p50\": %lu,"
+                     "\"p90\": %lu,"
+                     "\"p99\": %lu,"
+                     "\"p999\": %lu,"
+                     "\"max\": %lu"
+                     "}",
+                     name, count, count > 0 ? hist->sum_usec / count : 0,
+                     metrics_hist_percentile(hist, count, 0.5),
+                     metrics_hist_percentile(hist, count, 0.9),
+                     metrics_hist_percentile(hist, count, 0.99),
+                     metrics_hist_percentile(hist, count, 0.999), metrics_hist_max(hist));
+  assert(len > 0 && (size_t)len < size);
+  return len;
+}
+
+xps_buffer_t *metrics_to_json(xps_metrics_t *metrics, float workers_cpu_percent[],
+                              const char *latency_json) {
 
   assert(metrics != NULL);
+  assert(latency_json != NULL);
+
+  // Health of every upstream, shared by all cores
+  xps_buffer_t *upstreams_json = xps_health_get_json(metrics->core->curr_time_msec);
+  if (upstreams_json == NULL) {
+    logger(LOG_ERROR, "metrics_to_json()", "xps_health_get_json() failed");
+    return NULL;
+  }
+
+  // Effective tuning of the config the core serves now
+  xps_buffer_t *config_json = xps_config_get_json(metrics->core->config);
+  if (config_json == NULL) {
+    logger(LOG_ERROR, "metrics_to_json()", "xps_config_get_json() failed");
+    xps_buffer_destroy(upstreams_json);
+    return NULL;
+  }
 
-  xps_buffer_t *buff = xps_buffer_create(2000, 0, NULL);
+  xps_buffer_t *buff = xps_buffer_create(3000 + strlen(latency_json) + upstreams_json->len + config_json->len, 0, NULL);
   if (buff == NULL) {
     logger(LOG_ERROR, "metrics_to_json()", "xps_buffer_create() failed");
+    xps_buffer_destroy(upstreams_json);
+    xps_buffer_destroy(config_json);
     return NULL;
   }
 
@@ -255,6 +528,36 @@ xps_buffer_t *metrics_to_json(xps_metrics_t *metrics, float workers_cpu_percent[
     "\"res_code_4xx\": %lu,"
     "\"res_code_5xx\": %lu,"
 
+    "\"upstream_avg_res_time_msec\": %lu,"
+    "\"upstream_peak_res_time_msec\": %lu,"
+    "\"upstream_pool_hits\": %lu,"
+    "\"upstream_pool_misses\": %lu,"
+    "\"upstream_pool_evictions\": %lu,"
+    "\"upstreams\": %.*s,"
+
+    "\"latency_usec\": {%s},"
+
+    "\"tcp_conn_current\": %lu,"
+    "\"tcp_conn_total\": %lu,"
+    "\"tcp_to_upstream_bytes\": %lu,"
+    "\"tcp_to_client_bytes\": %lu,"
+
+    "\"udp_flows_current\": %lu,"
+    "\"udp_flows_total\": %lu,"
+    "\"udp_to_upstream_dgrams\": %lu,"
+    "\"udp_to_client_dgrams\": %lu,"
+    "\"udp_dropped_dgrams\": %lu,"
+
+    "\"lookup_cache_hits\": %lu,"
+    "\"lookup_cache_misses\": %lu,"
+    "\"lookup_cache_hit_percent\": %f,"
+
+    "\"config_reloads\": %lu,"
+    "\"config_reload_failures\": %lu,"
+    "\"config_reload_last_msec\": %lu,"
+    "\"config_draining\": %u,"
+    "\"config\": %.*s,"
+
     "\"traffic_total_send_bytes\": %lu,"
     "\"traffic_total_recv_bytes\": %lu"
     "}",
@@ -265,9 +568,21 @@ xps_buffer_t *metrics_to_json(xps_metrics_t *metrics, float workers_cpu_percent[
     metrics->req_current, metrics->req_total, metrics->req_file_serve, metrics->req_reverse_proxy,
     metrics->req_redirect, metrics->res_avg_res_time_msec, metrics->res_peak_res_time_msec,
     metrics->res_code_2xx, metrics->res_code_3xx, metrics->res_code_4xx, metrics->res_code_5xx,
-    metrics->traffic_total_send_bytes, metrics->traffic_total_recv_bytes);
+    metrics->upstream_avg_res_time_msec, metrics->upstream_peak_res_time_msec,
+    metrics->upstream_pool_hits, metrics->upstream_pool_misses, metrics->upstream_pool_evictions,
+    (int)upstreams_json->len, upstreams_json->data, latency_json, metrics->tcp_conn_current,
+    metrics->tcp_conn_total, metrics->tcp_to_upstream_bytes, metrics->tcp_to_client_bytes,
+    metrics->udp_flows_current, metrics->udp_flows_total, metrics->udp_to_upstream_dgrams,
+    metrics->udp_to_client_dgrams, metrics->udp_dropped_dgrams, metrics->lookup_cache_hits,
+    metrics->lookup_cache_misses, metrics->lookup_cache_hit_percent,
+    metrics->config_reloads, metrics->config_reload_failures, metrics->config_reload_last_msec,
+    metrics->config_draining, (int)config_json->len, config_json->data,
+    metrics->traffic_total_send_bytes,
+    metrics->traffic_total_recv_bytes);
 
   buff->len = strlen(buff->data);
+  xps_buffer_destroy(upstreams_json);
+  xps_buffer_destroy(config_json);
 
   return buff;
 }
@@ -371,14 +686,15 @@ void xps_metrics_update_handler(void *ptr) {
   assert(ptr != NULL);
   xps_core_t *core = ptr;
   xps_metrics_t *metrics = core->metrics;
+  xps_metrics_counters_t *counters = metrics->counters;
 
   // Server resource usage
+  u_long cpu_usage_centi = 0;
+  u_long ram_usage_bytes = 0;
   struct rusage usage;
   if (getrusage(RUSAGE_THREAD, &usage) != 0) {
     logger(LOG_ERROR, "xps_metrics_get_json()", "getrusage() failed");
     perror("Error message");
-    metrics->worker_cpu_usage_percent = 0;
-    metrics->worker_ram_usage_bytes = 0;
   } else {
     // Calculate worker CPU Usage percent
     u_long curr_worker_cpu_time_msec =
@@ -388,13 +704,19 @@ void xps_metrics_update_handler(void *ptr) {
     u_long uptime_msec = core->curr_time_msec - core->init_time_msec;
     u_long diff_uptime_msec = uptime_msec - metrics->_last_worker_cpu_update_uptime_msec;
 
-    metrics->worker_cpu_usage_percent = ((float)diff_cpu_time * 100) / ((float)diff_uptime_msec);
+    if (diff_uptime_msec > 0)
+      cpu_usage_centi = diff_cpu_time * 10000 / diff_uptime_msec;
 
     metrics->_last_worker_cpu_time_msec = curr_worker_cpu_time_msec;
     metrics->_last_worker_cpu_update_uptime_msec = uptime_msec;
 
-    metrics->worker_ram_usage_bytes = usage.ru_maxrss * 1024;
+    ram_usage_bytes = usage.ru_maxrss * 1024;
   }
 
+  metrics_write_begin(counters);
+  __atomic_store_n(&(counters->counts.worker_cpu_usage_centi), cpu_usage_centi, __ATOMIC_RELAXED);
+  __atomic_store_n(&(counters->counts.worker_ram_usage_bytes), ram_usage_bytes, __ATOMIC_RELAXED);
+  metrics_write_end(counters);
+
   xps_timer_update(core->metrics_update_timer, DEFAULT_METRICS_UPDATE_MSEC);
 }
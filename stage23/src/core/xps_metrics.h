@@ -3,10 +3,84 @@
 
 #include "../xps.h"
 
+/*
+ * Log-linear latency histogram in microseconds, HDR style: values below
+ * 2^METRICS_HIST_SUB_BITS get a bucket each, and every power of two above
+ * is split into 2^METRICS_HIST_SUB_BITS equal buckets. Histograms of several
+ * cores merge by adding their buckets.
+ */
+struct xps_metrics_hist_s {
+  u_long buckets[METRICS_HIST_BUCKETS];
+  u_long sum_usec;
+};
+
+/*
+ * What a core counts. Every field is a u_long, so a snapshot can copy the
+ * block word by word, each word read atomically.
+ */
+struct xps_metrics_counts_s {
+  u_long conn_current;
+  u_long conn_accepted;
+  u_long conn_error;
+  u_long conn_timeout;
+  u_long conn_accept_error;
+
+  u_long req_current;
+  u_long req_total;
+  u_long req_file_serve;
+  u_long req_reverse_proxy;
+  u_long req_redirect;
+
+  u_long res_code_2xx;
+  u_long res_code_3xx;
+  u_long res_code_4xx;
+  u_long res_code_5xx;
+
+  u_long upstream_pool_hits;
+  u_long upstream_pool_misses;
+  u_long upstream_pool_evictions;
+
+  u_long tcp_conn_current;
+  u_long tcp_conn_total;
+  u_long tcp_to_upstream_bytes;
+  u_long tcp_to_client_bytes;
+
+  u_long udp_flows_current;
+  u_long udp_flows_total;
+  u_long udp_to_upstream_dgrams;
+  u_long udp_to_client_dgrams;
+  u_long udp_dropped_dgrams;
+
+  u_long lookup_cache_hits;
+  u_long lookup_cache_misses;
+
+  u_long traffic_total_send_bytes;
+  u_long traffic_total_recv_bytes;
+
+  u_long worker_ram_usage_bytes;
+  u_long worker_cpu_usage_centi; // hundredths of a percent
+
+  xps_metrics_hist_t req_time;         // request parsed to session end
+  xps_metrics_hist_t ttfb;             // request parsed to first response bytes queued
+  xps_metrics_hist_t upstream_connect; // connect() to connected, new upstream connections only
+  xps_metrics_hist_t upstream_res;     // upstream picked to its response complete
+};
+
+/*
+ * A core's counts, on cache lines of their own. Only the owning core writes
+ * them, with relaxed atomic stores, so an update costs an add to a line no
+ * other core writes. _seq is odd while an update is in progress; readers on
+ * other cores retry until they copy the counts between two updates.
+ */
+struct xps_metrics_counters_s {
+  u_int _seq;
+  xps_metrics_counts_t counts;
+} __attribute__((aligned(64)));
+
+/* JSON view of the metrics, summed over every core */
 struct xps_metrics_s {
   xps_core_t *core;
-  u_long _res_n;
-  u_long _res_time_sum;
+  xps_metrics_counters_t *counters; // this core's, written only by its thread
   u_long _last_worker_cpu_update_uptime_msec;
   u_long _last_worker_cpu_time_msec;
 
@@ -19,7 +93,6 @@ struct xps_metrics_s {
   u_long sys_ram_usage_bytes;
   u_long sys_ram_total_bytes;
 
-  float worker_cpu_usage_percent;
   u_long worker_ram_usage_bytes;
 
   u_long conn_current;
@@ -41,6 +114,32 @@ struct xps_metrics_s {
   u_long res_code_4xx;
   u_long res_code_5xx;
 
+  u_long upstream_avg_res_time_msec;
+  u_long upstream_peak_res_time_msec;
+  u_long upstream_pool_hits;
+  u_long upstream_pool_misses;
+  u_long upstream_pool_evictions;
+
+  u_long tcp_conn_current;
+  u_long tcp_conn_total;
+  u_long tcp_to_upstream_bytes;
+  u_long tcp_to_client_bytes;
+
+  u_long udp_flows_current;
+  u_long udp_flows_total;
+  u_long udp_to_upstream_dgrams;
+  u_long udp_to_client_dgrams;
+  u_long udp_dropped_dgrams;
+
+  u_long lookup_cache_hits;
+  u_long lookup_cache_misses;
+  float lookup_cache_hit_percent;
+
+  u_long config_reloads;
+  u_long config_reload_failures;
+  u_long config_reload_last_msec;
+  u_int config_draining;
+
   size_t traffic_total_send_bytes;
   size_t traffic_total_recv_bytes;
 };
@@ -56,11 +155,28 @@ typedef enum xps_metric_type_e {
   M_REQ_FILE_SERVE,
   M_REQ_REVERSE_PROXY,
   M_REQ_REDIRECT,
-  M_RES_TIME,
+  M_REQ_TIME,
+  M_RES_TTFB,
   M_RES_2XX,
   M_RES_3XX,
   M_RES_4XX,
   M_RES_5XX,
+  M_UPSTREAM_CONNECT_TIME,
+  M_UPSTREAM_RES_TIME,
+  M_UPSTREAM_POOL_HIT,
+  M_UPSTREAM_POOL_MISS,
+  M_UPSTREAM_POOL_EVICT,
+  M_TCP_SESSION_CREATE,
+  M_TCP_SESSION_DESTROY,
+  M_TCP_TO_UPSTREAM_BYTES,
+  M_TCP_TO_CLIENT_BYTES,
+  M_UDP_FLOW_CREATE,
+  M_UDP_FLOW_DESTROY,
+  M_UDP_TO_UPSTREAM_DGRAMS,
+  M_UDP_TO_CLIENT_DGRAMS,
+  M_UDP_DROP_DGRAMS,
+  M_LOOKUP_CACHE_HIT,
+  M_LOOKUP_CACHE_MISS,
   M_TRAFFIC_SEND_BYTES,
   M_TRAFFIC_RECV_BYTES
 } xps_metric_type_t;
@@ -207,6 +207,33 @@ int xps_pipe_source_write(xps_pipe_source_t *source, xps_buffer_t *buff) {
     return OK;
 }
 
+/*
+ * Writes several buffers as one unit, so framing around a buffer is never
+ * split by buff_thresh. The buffers are not copied: on OK the pipe owns them,
+ * on E_FAIL nothing was queued and the caller still does.
+ */
+int xps_pipe_source_writev(xps_pipe_source_t *source, xps_buffer_t **buffs, int n_buffs) {
+		assert(source != NULL);
+		assert(buffs != NULL);
+
+    if (source->pipe == NULL) {
+			logger(LOG_ERROR, "xps_pipe_source_writev()", "source is not attached to a pipe");
+			return E_FAIL;
+    }
+
+    if (xps_pipe_is_writable(source->pipe) == false) {
+			logger(LOG_ERROR, "xps_pipe_source_writev()", "pipe is not writable");
+			return E_FAIL;
+    }
+
+    if (xps_buffer_list_appendv(source->pipe->buff_list, buffs, n_buffs) != OK) {
+			logger(LOG_ERROR, "xps_pipe_source_writev()", "xps_buffer_list_appendv() failed");
+			return E_FAIL;
+    }
+
+    return OK;
+}
+
 xps_pipe_sink_t *xps_pipe_sink_create(void *ptr, xps_handler_t handler_cb, xps_handler_t close_cb) {
     /*refer to xps_pipe_source_create() and fill accordingly*/
 		assert(ptr != NULL);
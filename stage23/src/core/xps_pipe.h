@@ -45,6 +45,7 @@ xps_pipe_source_t *xps_pipe_source_create(void *ptr, xps_handler_t handler_cb,
                                             xps_handler_t close_cb);
 void xps_pipe_source_destroy(xps_pipe_source_t *source);
 int xps_pipe_source_write(xps_pipe_source_t *source, xps_buffer_t *buff);
+int xps_pipe_source_writev(xps_pipe_source_t *source, xps_buffer_t **buffs, int n_buffs);
 
 /* xps_pipe_sink */
 xps_pipe_sink_t *xps_pipe_sink_create(void *ptr, xps_handler_t handler_cb, xps_handler_t close_cb);
@@ -0,0 +1,464 @@
+#include "xps_reload.h"
+
+// Latest published config, read by every core at its quiescent point
+xps_config_t *reload_config = NULL;
+
+// Only touched by the reload thread
+const char *reload_path = NULL;
+vec_void_t reload_old_configs; // configs no core serves anymore, freed once released everywhere
+vec_void_t reload_listeners;   // sockets bound for the reload in progress, each core dups them
+sem_t reload_sem;
+pthread_t reload_thread;
+bool reload_running = false;
+
+xps_reload_stats_t reload_stats;
+
+void *reload_thread_start(void *arg);
+void reload_run();
+void reload_collect();
+int reload_bind_listeners(xps_config_t *config, xps_config_t *old);
+int reload_switch(xps_core_t *core, xps_config_t *config);
+void reload_switch_listeners(xps_core_t *core, xps_config_t *config,
+                             xps_reload_retired_t *retired);
+void reload_switch_udp_proxies(xps_core_t *core, xps_config_t *config);
+void reload_release(xps_core_t *core, xps_reload_retired_t *retired);
+xps_config_listener_t *reload_find_listener(xps_config_t *config, const char *host, u_int port,
+                                            bool udp);
+u_long reload_now_msec();
+
+/* Publishes config as the one cores run on, and starts waiting for SIGHUP */
+int xps_reload_start(xps_config_t *config) {
+  assert(config != NULL);
+
+  if (sem_init(&reload_sem, 0, 0) != 0) {
+    logger(LOG_ERROR, "xps_reload_start()", "sem_init() failed");
+    return E_FAIL;
+  }
+  vec_init(&reload_old_configs);
+  vec_init(&reload_listeners);
+  memset(&reload_stats, 0, sizeof(reload_stats));
+  reload_path = config->config_path;
+  reload_config = config;
+
+  if (pthread_create(&reload_thread, NULL, reload_thread_start, NULL) != 0) {
+    logger(LOG_ERROR, "xps_reload_start()", "pthread_create() failed");
+    vec_deinit(&reload_old_configs);
+    vec_deinit(&reload_listeners);
+    sem_destroy(&reload_sem);
+    return E_FAIL;
+  }
+  reload_running = true;
+
+  return OK;
+}
+
+/* Must run while the cores are still looping, a reload in progress waits for them */
+void xps_reload_stop() {
+  if (!reload_running)
+    return;
+
+  pthread_cancel(reload_thread);
+  pthread_join(reload_thread, NULL);
+  reload_running = false;
+
+  for (int i = 0; i < reload_listeners.length; i++)
+    xps_listener_destroy(reload_listeners.data[i]);
+  vec_clear(&reload_listeners);
+}
+
+/* Frees every config; must run after the cores, whose sessions point into them */
+void xps_reload_destroy() {
+  if (reload_config == NULL)
+    return;
+
+  for (int i = 0; i < reload_old_configs.length; i++)
+    xps_config_destroy(reload_old_configs.data[i]);
+  vec_deinit(&reload_old_configs);
+  vec_deinit(&reload_listeners);
+
+  xps_config_destroy(reload_config);
+  reload_config = NULL;
+  sem_destroy(&reload_sem);
+}
+
+/* Async-signal-safe, called from the SIGHUP handler */
+void xps_reload_request() {
+  if (reload_running)
+    sem_post(&reload_sem);
+}
+
+/* Called by core at the top of every loop iteration */
+void xps_reload_sync(xps_core_t *core) {
+  assert(core != NULL);
+
+  xps_config_t *config = __atomic_load_n(&reload_config, __ATOMIC_ACQUIRE);
+  if (config == NULL || config == core->config)
+    return;
+
+  // On failure the core stays on its config and tries again next iteration
+  if (reload_switch(core, config) != OK)
+    logger(LOG_ERROR, "xps_reload_sync()", "reload_switch() failed");
+}
+
+void xps_reload_get_stats(xps_reload_stats_t *stats) {
+  assert(stats != NULL);
+
+  stats->reloads = __atomic_load_n(&(reload_stats.reloads), __ATOMIC_RELAXED);
+  stats->failures = __atomic_load_n(&(reload_stats.failures), __ATOMIC_RELAXED);
+  stats->last_msec = __atomic_load_n(&(reload_stats.last_msec), __ATOMIC_RELAXED);
+  stats->draining = __atomic_load_n(&(reload_stats.draining), __ATOMIC_RELAXED);
+}
+
+/* The config a new session of core runs on, pinned until xps_reload_config_put() */
+xps_config_t *xps_reload_config_get(xps_core_t *core) {
+  assert(core != NULL);
+
+  core->config_refs++;
+
+  return core->config;
+}
+
+void xps_reload_config_put(xps_core_t *core, xps_config_t *config) {
+  assert(core != NULL);
+  assert(config != NULL);
+
+  if (config == core->config) {
+    assert(core->config_refs > 0);
+    core->config_refs--;
+    return;
+  }
+
+  for (int i = 0; i < core->retired_configs.length; i++) {
+    xps_reload_retired_t *retired = core->retired_configs.data[i];
+    if (retired->config != config)
+      continue;
+
+    assert(retired->refs > 0);
+    if (--retired->refs == 0) {
+      vec_splice(&(core->retired_configs), i, 1);
+      reload_release(core, retired);
+    }
+    return;
+  }
+
+  assert(false);
+}
+
+void *reload_thread_start(void *arg) {
+  // Signal handlers run on the main thread or the cores, never on this one
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  while (1) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += DEFAULT_RELOAD_COLLECT_MSEC / 1000;
+    deadline.tv_nsec += (DEFAULT_RELOAD_COLLECT_MSEC % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+
+    int error = sem_timedwait(&reload_sem, &deadline);
+
+    // A reload runs to the end, so shutdown never sees one half published
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    if (error == 0)
+      reload_run();
+    reload_collect();
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+  }
+
+  return NULL;
+}
+
+/* Parses and publishes the config file, then waits until every core serves it */
+void reload_run() {
+  u_long start_msec = reload_now_msec();
+  logger(LOG_INFO, "reload_run()", "reloading %s", reload_path);
+
+  xps_config_t *old = reload_config;
+  xps_config_t *config = xps_config_create(reload_path);
+  if (config == NULL) {
+    logger(LOG_ERROR, "reload_run()", "failed to parse config file, keeping the current one");
+    __atomic_add_fetch(&(reload_stats.failures), 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  // Cores and their CPUs are fixed at startup
+  if (config->workers != old->workers)
+    logger(LOG_WARNING, "reload_run()", "changing workers from %u to %u needs a restart",
+           old->workers, config->workers);
+  bool cpus_changed = config->_cpus.length != old->_cpus.length;
+  for (int i = 0; i < config->_cpus.length && !cpus_changed; i++)
+    cpus_changed = config->_cpus.data[i] != old->_cpus.data[i];
+  if (cpus_changed && config->workers == old->workers)
+    logger(LOG_WARNING, "reload_run()", "changing cpu_affinity needs a restart");
+  config->workers = old->workers;
+  vec_clear(&(config->_cpus));
+  vec_extend(&(config->_cpus), &(old->_cpus));
+
+  // The metrics socket and each core's epoll event array are set up once, at startup
+  if (config->metrics_port != old->metrics_port ||
+      strcmp(config->metrics_host, old->metrics_host) != 0)
+    logger(LOG_WARNING, "reload_run()", "moving metrics from %s:%u to %s:%u needs a restart",
+           old->metrics_host, old->metrics_port, config->metrics_host, config->metrics_port);
+  free(config->metrics_host);
+  config->metrics_host = str_create(old->metrics_host);
+  config->metrics_port = old->metrics_port;
+  config->_metrics_listener->host = config->metrics_host;
+  config->_metrics_listener->port = old->metrics_port;
+  if (config->max_epoll_events != old->max_epoll_events) {
+    logger(LOG_WARNING, "reload_run()", "changing max_epoll_events from %u to %u needs a restart",
+           old->max_epoll_events, config->max_epoll_events);
+    config->max_epoll_events = old->max_epoll_events;
+  }
+
+  // Everything a core needs must be ready before it can see the config
+  if (xps_health_attach(config) != OK || xps_dns_resolver_update(config) != OK ||
+      reload_bind_listeners(config, old) != OK) {
+    logger(LOG_ERROR, "reload_run()", "failed to prepare config, keeping the current one");
+    for (int i = 0; i < reload_listeners.length; i++)
+      xps_listener_destroy(reload_listeners.data[i]);
+    vec_clear(&reload_listeners);
+    xps_config_destroy(config);
+    __atomic_add_fetch(&(reload_stats.failures), 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  __atomic_store_n(&reload_config, config, __ATOMIC_RELEASE);
+
+  // Every core wakes at least once per metrics update, so this is bounded
+  while (__atomic_load_n(&(config->_n_switched), __ATOMIC_ACQUIRE) < (u_int)n_cores)
+    usleep(1000);
+
+  // Each core holds its own dup of these
+  for (int i = 0; i < reload_listeners.length; i++)
+    xps_listener_destroy(reload_listeners.data[i]);
+  vec_clear(&reload_listeners);
+
+  vec_push(&reload_old_configs, old);
+  __atomic_store_n(&(reload_stats.draining), reload_old_configs.length, __ATOMIC_RELAXED);
+
+  u_long reload_msec = reload_now_msec() - start_msec;
+  __atomic_store_n(&(reload_stats.last_msec), reload_msec, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&(reload_stats.reloads), 1, __ATOMIC_RELAXED);
+
+  logger(LOG_INFO, "reload_run()", "config reloaded in %lu msec", reload_msec);
+}
+
+/* Frees old configs that every core has released */
+void reload_collect() {
+  for (int i = 0; i < reload_old_configs.length; i++) {
+    xps_config_t *config = reload_old_configs.data[i];
+    if (__atomic_load_n(&(config->_n_released), __ATOMIC_ACQUIRE) < (u_int)n_cores)
+      continue;
+
+    logger(LOG_DEBUG, "reload_collect()", "freeing drained config");
+    vec_splice(&reload_old_configs, i, 1);
+    i--;
+    xps_config_destroy(config);
+  }
+
+  __atomic_store_n(&(reload_stats.draining), reload_old_configs.length, __ATOMIC_RELAXED);
+}
+
+/* Binds the tcp and http listeners of config that old does not have */
+int reload_bind_listeners(xps_config_t *config, xps_config_t *old) {
+  assert(config != NULL);
+  assert(old != NULL);
+
+  for (int i = 0; i < config->_all_listeners.length; i++) {
+    xps_config_listener_t *conf = config->_all_listeners.data[i];
+    if (conf->udp_route || reload_find_listener(old, conf->host, conf->port, false))
+      continue;
+
+    // A port that cannot be bound is logged and skipped, as at startup
+    xps_listener_t *listener = xps_listener_create(conf->host, conf->port, conf->backlog);
+    if (listener == NULL) {
+      logger(LOG_ERROR, "reload_bind_listeners()", "listener creation failed");
+      continue;
+    }
+    listener->conf = conf;
+    vec_push(&reload_listeners, listener);
+
+    logger(LOG_INFO, "reload_bind_listeners()", "Server listening on %s://%s:%d",
+           conf->tcp_route ? "tcp" : "http", conf->host, conf->port);
+  }
+
+  return OK;
+}
+
+/* Moves core onto config; runs on core's own thread, between events */
+int reload_switch(xps_core_t *core, xps_config_t *config) {
+  assert(core != NULL);
+  assert(config != NULL);
+
+  xps_reload_retired_t *retired = malloc(sizeof(xps_reload_retired_t));
+  if (retired == NULL) {
+    logger(LOG_ERROR, "reload_switch()", "malloc() failed for 'retired'");
+    return E_FAIL;
+  }
+
+  // Sessions on the old config keep balancing with their own route ids, so never shrink
+  if (config->_all_routes.length > core->n_lb_counters) {
+    u_long *lb_counters =
+      realloc(core->lb_counters, sizeof(u_long) * config->_all_routes.length);
+    if (lb_counters == NULL) {
+      logger(LOG_ERROR, "reload_switch()", "realloc() failed for 'lb_counters'");
+      free(retired);
+      return E_FAIL;
+    }
+    core->lb_counters = lb_counters;
+    core->n_lb_counters = config->_all_routes.length;
+  }
+  for (int i = 0; i < config->_all_routes.length; i++) {
+    xps_config_route_t *route = config->_all_routes.data[i];
+    core->lb_counters[i] = (u_long)core->id * route->_upstream_schedule.length / config->workers;
+  }
+
+  retired->config = core->config;
+  retired->refs = core->config_refs;
+  vec_init(&(retired->listeners));
+
+  core->config = config;
+  core->config_refs = 0;
+  core->metrics->server_name = config->server_name;
+
+  reload_switch_listeners(core, config, retired);
+  reload_switch_udp_proxies(core, config);
+  xps_health_update(core, config);
+
+  __atomic_add_fetch(&(config->_n_switched), 1, __ATOMIC_RELEASE);
+
+  if (retired->refs == 0)
+    reload_release(core, retired);
+  else
+    vec_push(&(core->retired_configs), retired);
+
+  logger(LOG_DEBUG, "reload_switch()", "core %u switched config", core->id);
+
+  return OK;
+}
+
+/* Keeps listeners config still has, closes the others and starts the new ones */
+void reload_switch_listeners(xps_core_t *core, xps_config_t *config,
+                             xps_reload_retired_t *retired) {
+  assert(core != NULL);
+  assert(config != NULL);
+  assert(retired != NULL);
+
+  for (int i = 0; i < core->listeners.length; i++) {
+    xps_listener_t *listener = core->listeners.data[i];
+    if (listener == NULL)
+      continue;
+
+    // Its host string belongs to the old config too
+    if (listener->conf == retired->config->_metrics_listener) {
+      listener->host = config->_metrics_listener->host;
+      listener->conf = config->_metrics_listener;
+      continue;
+    }
+
+    // A kept socket keeps its backlog; the rest of conf applies to new connections
+    xps_config_listener_t *conf = reload_find_listener(config, listener->host, listener->port, false);
+    if (conf) {
+      listener->host = conf->host;
+      listener->conf = conf;
+      listener->tcp_route = conf->tcp_route;
+      listener->acl_routes = &(conf->_acl_routes);
+      continue;
+    }
+
+    // Its connections still point at it, so it lives until the old config is released
+    logger(LOG_INFO, "reload_switch_listeners()", "closing listener %s:%u", listener->host,
+           listener->port);
+    xps_listener_close(listener);
+    vec_push(&(retired->listeners), listener);
+  }
+
+  for (int i = 0; i < reload_listeners.length; i++) {
+    xps_listener_t *listener = reload_listeners.data[i];
+    xps_config_listener_t *conf = reload_find_listener(config, listener->host, listener->port, false);
+    assert(conf != NULL);
+
+    xps_listener_t *dup_listener = xps_listener_dup(listener, core);
+    if (dup_listener == NULL) {
+      logger(LOG_ERROR, "reload_switch_listeners()", "xps_listener_dup() failed");
+      continue;
+    }
+    dup_listener->conf = conf;
+    dup_listener->tcp_route = conf->tcp_route;
+    dup_listener->acl_routes = &(conf->_acl_routes);
+  }
+}
+
+/* Flows carry on with the updated route; a removed udp_proxy listener drops its flows */
+void reload_switch_udp_proxies(xps_core_t *core, xps_config_t *config) {
+  assert(core != NULL);
+  assert(config != NULL);
+
+  for (int i = 0; i < core->udp_proxies.length; i++) {
+    xps_udp_proxy_t *proxy = core->udp_proxies.data[i];
+    if (proxy == NULL)
+      continue;
+
+    xps_config_listener_t *conf = reload_find_listener(config, proxy->host, proxy->port, true);
+    if (conf) {
+      proxy->host = conf->host;
+      proxy->route = conf->udp_route;
+    } else {
+      xps_udp_proxy_destroy(proxy);
+    }
+  }
+
+  for (int i = 0; i < config->_all_listeners.length; i++) {
+    xps_config_listener_t *conf = config->_all_listeners.data[i];
+    if (conf->udp_route == NULL)
+      continue;
+
+    bool bound = false;
+    for (int j = 0; j < core->udp_proxies.length && !bound; j++) {
+      xps_udp_proxy_t *proxy = core->udp_proxies.data[j];
+      bound = proxy && proxy->port == conf->port && strcmp(proxy->host, conf->host) == 0;
+    }
+    if (!bound && xps_udp_proxy_create(core, conf->host, conf->port, conf->udp_route) == NULL)
+      logger(LOG_ERROR, "reload_switch_udp_proxies()", "xps_udp_proxy_create() failed");
+  }
+}
+
+/* The last session of core on an old config has ended */
+void reload_release(xps_core_t *core, xps_reload_retired_t *retired) {
+  assert(core != NULL);
+  assert(retired != NULL);
+
+  for (int i = 0; i < retired->listeners.length; i++)
+    xps_listener_destroy(retired->listeners.data[i]);
+  vec_deinit(&(retired->listeners));
+
+  __atomic_add_fetch(&(retired->config->_n_released), 1, __ATOMIC_RELEASE);
+  free(retired);
+}
+
+xps_config_listener_t *reload_find_listener(xps_config_t *config, const char *host, u_int port,
+                                            bool udp) {
+  assert(config != NULL);
+  assert(host != NULL);
+
+  for (int i = 0; i < config->_all_listeners.length; i++) {
+    xps_config_listener_t *conf = config->_all_listeners.data[i];
+    if (conf->port == port && (conf->udp_route != NULL) == udp && strcmp(conf->host, host) == 0)
+      return conf;
+  }
+
+  return NULL;
+}
+
+u_long reload_now_msec() {
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return timeval_to_msec(time);
+}
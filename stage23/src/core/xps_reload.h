@@ -0,0 +1,40 @@
+#ifndef XPS_RELOAD_H
+#define XPS_RELOAD_H
+
+#include "../xps.h"
+
+/*
+ * Live reload. On SIGHUP a background thread parses and compiles the config
+ * file again, binds any new listeners, and publishes the result. Each core
+ * picks it up at the top of its next loop iteration, which is its quiescent
+ * point: no handler of that core is running, so nothing it holds can change
+ * under it. Sessions keep the config they were created with; the old config
+ * is freed once every core has moved off it and its sessions on every core
+ * have ended.
+ */
+
+/* A config a core has moved off, kept while sessions of that core still use it */
+struct xps_reload_retired_s {
+  xps_config_t *config;
+  u_int refs;           // sessions and tcp sessions of the core still on config
+  vec_void_t listeners; // closed listeners whose connections may still be open
+};
+
+struct xps_reload_stats_s {
+  u_long reloads;
+  u_long failures;
+  u_long last_msec; // signal to every core serving the new config
+  u_int draining;   // old configs still in use by sessions
+};
+
+int xps_reload_start(xps_config_t *config);
+void xps_reload_stop();
+void xps_reload_destroy();
+void xps_reload_request();
+void xps_reload_sync(xps_core_t *core);
+void xps_reload_get_stats(xps_reload_stats_t *stats);
+
+xps_config_t *xps_reload_config_get(xps_core_t *core);
+void xps_reload_config_put(xps_core_t *core, xps_config_t *config);
+
+#endif
@@ -17,6 +17,18 @@ void set_from_client_buff(xps_session_t *session, xps_buffer_t *buff);
 void session_check_destroy(xps_session_t *session);
 void session_process_request(xps_session_t *session);
 void session_timer_handler(void *ptr);
+void session_error_res(xps_session_t *session, u_int status_code);
+int session_add_forwarded_for(xps_session_t *session);
+bool session_req_complete(xps_session_t *session);
+int session_write_chunk(xps_session_t *session, xps_pipe_source_t *source);
+void session_end_chunked(xps_session_t *session);
+void session_upstream_release(xps_session_t *session);
+void session_upstream_done(xps_session_t *session);
+bool session_splice_wanted(xps_session_t *session);
+void session_splice_start(xps_session_t *session);
+void session_splice_handler(void *ptr);
+void session_splice_close_handler(void *ptr);
+u_long session_timeout_msec(xps_session_t *session);
 
 // custom function
 void session_destroy_pipes(xps_session_t *session);
@@ -49,8 +61,9 @@ xps_session_t *xps_session_create(xps_core_t *core, xps_connection_t *client) {
     return NULL;
   }
 
+  xps_config_listener_t *conf = client->listener->conf;
   session->timer =
-    xps_timer_create(core, DEFAULT_HTTP_REQ_TIMEOUT_MSEC, (void *)session, session_timer_handler);
+    xps_timer_create(core, conf->req_timeout_msec, (void *)session, session_timer_handler);
   if (session->timer == NULL) {
     logger(LOG_ERROR, "xps_session_create()", "xps_timer_create() failed");
     free(session);
@@ -81,15 +94,24 @@ xps_session_t *xps_session_create(xps_core_t *core, xps_connection_t *client) {
 
   // Init values
   session->core = core;
+  session->config = xps_reload_config_get(core);
   session->client = client;
   session->upstream = NULL;
   session->upstream_connected = false;
   session->upstream_error_res_set = false;
   session->upstream_write_bytes = 0;
+  session->upstream_res = NULL;
+  session->upstream_active = false;
+  session->splice = NULL;
+  session->splice_pending = false;
   session->file = NULL;
   session->to_client_buff = NULL;
+  session->to_client_chunk = false;
+  session->res_chunked = false;
+  session->res_last_chunk_set = false;
   session->from_client_buff = NULL;
   session->http_req = NULL;
+  session->req_body = NULL;
   session->lookup = NULL;
   session->gzip = NULL;
   session->client_sink->ready = true;
@@ -97,15 +119,17 @@ xps_session_t *xps_session_create(xps_core_t *core, xps_connection_t *client) {
   session->file_sink->ready = true;
 
   session->req_create_time_msec = -1;
-  session->res_time = -1;
+  session->req_start_usec = 0;
+  session->upstream_start_usec = 0;
+  session->ttfb_usec = -1;
 
   // Add to 'sessions' list of core
   vec_push(&(core->sessions), session);
 
   // Attach client
-  if (xps_pipe_create(core, DEFAULT_PIPE_BUFF_THRESH, client->source, session->client_sink) ==
+  if (xps_pipe_create(core, conf->pipe_buff_thresh, client->source, session->client_sink) ==
         NULL ||
-      xps_pipe_create(core, DEFAULT_PIPE_BUFF_THRESH, session->client_source, client->sink) ==
+      xps_pipe_create(core, conf->pipe_buff_thresh, session->client_source, client->sink) ==
         NULL) {
     logger(LOG_ERROR, "xps_session_create()", "failed to create client pipes");
 
@@ -127,24 +151,32 @@ void client_source_handler(void *ptr) {
   xps_pipe_source_t *source = ptr;
   xps_session_t *session = source->ptr;
 
-  // write to session->to_client_buff
-  if (xps_pipe_source_write(source, session->to_client_buff) != OK) {
-    logger(LOG_ERROR, "client_source_handler()", "xps_pipe_source_write() failed");
-    return;
+  // write to session->to_client_buff; a chunk's data buffer is handed to the pipe as it is
+  if (session->to_client_chunk) {
+    if (session_write_chunk(session, source) != OK) {
+      logger(LOG_ERROR, "client_source_handler()", "session_write_chunk() failed");
+      return;
+    }
+  } else {
+    if (xps_pipe_source_write(source, session->to_client_buff) != OK) {
+      logger(LOG_ERROR, "client_source_handler()", "xps_pipe_source_write() failed");
+      return;
+    }
+    xps_buffer_destroy(session->to_client_buff);
   }
-  xps_buffer_destroy(session->to_client_buff);
-
 
-  if (session->res_time == -1 && session->req_create_time_msec != -1) {
 
-    u_long res_time = session->core->curr_time_msec - session->req_create_time_msec;
-    session->res_time = res_time;
-    xps_metrics_set(session->core, M_RES_TIME, res_time);
+  if (session->ttfb_usec == -1 && session->req_start_usec != 0) {
+    session->ttfb_usec = monotonic_usec() - session->req_start_usec;
+    xps_metrics_set(session->core, M_RES_TTFB, session->ttfb_usec);
   }
 
-  xps_timer_update(session->timer, DEFAULT_HTTP_REQ_TIMEOUT_MSEC);
+  xps_timer_update(session->timer, session_timeout_msec(session));
 
   set_to_client_buff(session, NULL);
+  if (session->splice_pending)
+    session_splice_start(session);
+  session_end_chunked(session);
   session_check_destroy(session);
 }
 
@@ -169,15 +201,14 @@ void client_sink_handler(void *ptr) {
     return;
   }
 
-  xps_timer_update(session->timer, DEFAULT_HTTP_REQ_TIMEOUT_MSEC);
+  xps_timer_update(session->timer, session_timeout_msec(session));
 
   if (session->http_req == NULL) { // http requset is not recieved till now//
     int error;
-    /*create http_req for the buff read from pipe and destroy the buff*/
+    /*create http_req for the buff read from pipe*/
     xps_http_req_t *http_req = xps_http_req_create(session->core, buff, &error);
-    size_t buff_len = buff->len;
-    xps_buffer_destroy(buff);
     if (error == E_FAIL) {
+      xps_buffer_destroy(buff);
       /*process the session and return*/
       session_process_request(session);
       return;
@@ -185,26 +216,56 @@ void client_sink_handler(void *ptr) {
     /*handle E_AGAIN*/
     if (error == E_AGAIN) {
       logger(LOG_DEBUG, "client_sink_handler()", "http_req parsing E_AGAIN");
+      xps_buffer_destroy(buff);
       return;
     }
     session->http_req = http_req;
 
     session->req_create_time_msec = session->core->curr_time_msec;
+    session->req_start_usec = monotonic_usec();
 
-    /*serialize http_req into buffer http_req_buff*/
-    xps_buffer_t *http_req_buff = xps_http_req_serialize(http_req);
-    if (http_req_buff == NULL) {
-      logger(LOG_ERROR, "client_sink_handler()", "xps_http_req_serialize() failed");
+    session->req_body = xps_http_body_create(http_req->body_type, http_req->body_len);
+    if (session->req_body == NULL) {
+      logger(LOG_ERROR, "client_sink_handler()", "xps_http_body_create() failed");
+      xps_buffer_destroy(buff);
       xps_session_destroy(session);
       return;
     }
-    /*set http_req_buff to from_client_buff and clear the pipe*/
-    set_from_client_buff(session, http_req_buff);
-    xps_pipe_sink_clear(sink, buff_len);
+
+    /*frame the body bytes that arrived together with the headers*/
+    size_t body_n;
+    if (xps_http_body_parse(session->req_body, buff->data + http_req->header_len,
+                            buff->len - http_req->header_len, &body_n) == E_FAIL) {
+      logger(LOG_DEBUG, "client_sink_handler()", "malformed request body framing");
+      xps_buffer_destroy(buff);
+      xps_http_req_destroy(session->core, session->http_req);
+      session->http_req = NULL;
+      session_process_request(session);
+      return;
+    }
+
+    /*forward the original request bytes as they are, up to the end of the request*/
+    buff->len = http_req->header_len + body_n;
+    set_from_client_buff(session, buff);
+    xps_pipe_sink_clear(sink, buff->len);
     /*process the session*/
     session_process_request(session);
   } else {
 
+    size_t body_n;
+    if (xps_http_body_parse(session->req_body, buff->data, buff->len, &body_n) == E_FAIL) {
+      logger(LOG_DEBUG, "client_sink_handler()", "malformed request body framing");
+      xps_buffer_destroy(buff);
+      xps_session_destroy(session);
+      return;
+    }
+    if (body_n == 0) {
+      xps_buffer_destroy(buff);
+      set_from_client_buff(session, NULL);
+      return;
+    }
+
+    buff->len = body_n;
     set_from_client_buff(session, buff);
     xps_pipe_sink_clear(sink, buff->len);
   }
@@ -276,8 +337,37 @@ void upstream_sink_handler(void *ptr) {
     return;
   }
 
+  // Track response framing so the connection can be reused once it ends
+  xps_http_res_parser_t *parser = session->upstream_res;
+  bool res_complete = false;
+  if (parser != NULL && parser->state != RES_DONE) {
+    bool head_seen = parser->status_code != 0;
+    res_complete = xps_http_res_parser_feed(parser, buff->data, buff->len) == OK;
+
+    u_long elapsed_msec = session->core->curr_time_msec - session->req_create_time_msec;
+    xps_health_entry_t *health = session->lookup->upstream_health;
+
+    if (!head_seen && parser->status_code != 0) {
+      xps_http_res_set_metrics(session->core, parser->status_code);
+      if (health) {
+        xps_health_report(health, parser->status_code < 500, session->core->curr_time_msec);
+        xps_health_observe(health, elapsed_msec, session->core->curr_time_msec);
+      }
+    }
+    if (res_complete) {
+      xps_metrics_set(session->core, M_UPSTREAM_RES_TIME,
+                      monotonic_usec() - session->upstream_start_usec);
+      session_upstream_done(session);
+    }
+  }
+
+  session->splice_pending = !res_complete && session_splice_wanted(session);
+
   set_to_client_buff(session, buff);
   xps_pipe_sink_clear(sink, buff->len);
+
+  if (res_complete)
+    session_upstream_release(session);
 }
 
 void upstream_sink_close_handler(void *ptr) {
@@ -297,6 +387,13 @@ void upstream_error_res(xps_session_t *session) {
   assert(session != NULL);
 
   session->upstream_error_res_set = true;
+
+  if (session->lookup && session->lookup->upstream_health)
+    xps_health_report(session->lookup->upstream_health, false, session->core->curr_time_msec);
+
+  // Connecting to the upstream failed before any response reached the client
+  if (session->to_client_buff == NULL && session->ttfb_usec == -1)
+    session_error_res(session, HTTP_BAD_GATEWAY);
 }
 
 void file_sink_handler(void *ptr) {
@@ -312,6 +409,7 @@ void file_sink_handler(void *ptr) {
   }
 
   set_to_client_buff(session, buff);
+  session->to_client_chunk = session->res_chunked;
   xps_pipe_sink_clear(sink, buff->len);
 }
 
@@ -322,6 +420,7 @@ void file_sink_close_handler(void *ptr) {
   xps_pipe_sink_t *sink = ptr;
   xps_session_t *session = sink->ptr;
 
+  session_end_chunked(session);
   session_check_destroy(session);
 }
 
@@ -330,6 +429,7 @@ void set_to_client_buff(xps_session_t *session, xps_buffer_t *buff) {
   assert(session != NULL);
 
   session->to_client_buff = buff;
+  session->to_client_chunk = false;
 
   if (buff == NULL) {
     session->client_source->ready = false;
@@ -349,7 +449,8 @@ void set_from_client_buff(xps_session_t *session, xps_buffer_t *buff) {
   session->from_client_buff = buff;
 
   if (buff == NULL) {
-    session->client_sink->ready = true;
+    // Bytes past the end of the request are left in the client pipe
+    session->client_sink->ready = !session_req_complete(session);
     session->upstream_source->ready = false;
   } else {
     session->client_sink->ready = false;
@@ -380,6 +481,9 @@ void xps_session_destroy(xps_session_t *session) {
 
   assert(session != NULL);
 
+  if (session->splice)
+    xps_splice_destroy(session->splice);
+
   /* destroy client_source, client_sink, upstream_source, upstream_sink and
    * file_sink attached to session */
   session_destroy_pipes(session);
@@ -387,8 +491,16 @@ void xps_session_destroy(xps_session_t *session) {
   if (session->http_req)
     xps_http_req_destroy(session->core, session->http_req);
 
+  if (session->req_body)
+    xps_http_body_destroy(session->req_body);
+
+  if (session->upstream_res)
+    xps_http_res_parser_destroy(session->upstream_res);
+
+  session_upstream_done(session);
+
   if (session->lookup)
-    xps_config_lookup_destroy(session->lookup, session->core);
+    xps_config_lookup_clear(session->lookup);
 
   if (session->timer)
     xps_timer_destroy(session->timer);
@@ -407,6 +519,11 @@ void xps_session_destroy(xps_session_t *session) {
     }
   }
 
+  if (session->req_start_usec != 0)
+    xps_metrics_set(session->core, M_REQ_TIME, monotonic_usec() - session->req_start_usec);
+
+  xps_reload_config_put(session->core, session->config);
+
   free(session);
 
   logger(LOG_DEBUG, "xps_session_destroy()", "destroyed session");
@@ -417,16 +534,7 @@ void session_process_request(xps_session_t *session) {
 
   // BAD REQUEST
   if (session->http_req == NULL) {
-    xps_http_res_t *res = xps_http_res_create(session->core, HTTP_BAD_REQUEST);
-    if (res == NULL) {
-      logger(LOG_ERROR, "session_process_request()",
-             "xps_http_res_create() failed for BAD_REQUEST");
-      return;
-    }
-    xps_buffer_t *buff = xps_http_res_serialize(res);
-    /*set buff to to_client_buff*/
-    set_to_client_buff(session, buff);
-    xps_http_res_destroy(res);
+    session_error_res(session, HTTP_BAD_REQUEST);
     return;
   }
 
@@ -434,62 +542,29 @@ void session_process_request(xps_session_t *session) {
   sprintf(temp_str, "%s:%u", session->client->listener->host, session->client->listener->port);
   logger(LOG_HTTP, temp_str, "%s %s", session->http_req->method, session->http_req->path);
 
-  int lookup_error;
-  xps_config_lookup_t *lookup =
-    xps_config_lookup(session->core->config, session->http_req, session->client, &lookup_error);
+  xps_config_lookup_t *lookup = &(session->lookup_buf);
+  int lookup_error =
+    xps_config_lookup(session->config, session->http_req, session->client, lookup);
 
   if (lookup_error == E_FAIL) {
     logger(LOG_ERROR, "session_process_request()", "xps_config_lookup() failed");
-    xps_http_res_t *http_res = xps_http_res_create(session->core, HTTP_INTERNAL_SERVER_ERROR);
-    xps_buffer_t *http_res_buff = xps_http_res_serialize(http_res);
-    set_to_client_buff(session, http_res_buff);
-    xps_http_res_destroy(http_res);
+    session_error_res(session, HTTP_INTERNAL_SERVER_ERROR);
     return;
   } else if (lookup_error == E_NOTFOUND) {
-    xps_http_res_t *http_res = xps_http_res_create(session->core, HTTP_NOT_FOUND);
-    xps_buffer_t *http_res_buff = xps_http_res_serialize(http_res);
-    set_to_client_buff(session, http_res_buff);
-    xps_http_res_destroy(http_res);
+    session_error_res(session, HTTP_NOT_FOUND);
     return;
   }
 
   session->lookup = lookup;
-
-  // check whitelist exist
-  if (lookup->ip_whitelist.length > 0) {
-    const char *client_ip = session->client->remote_ip;
-    bool is_allowed = false;
-    for (size_t i = 0; i < lookup->ip_whitelist.length; i++) {
-      const char *ip_w = lookup->ip_whitelist.data[i];
-      if (strcmp(client_ip, ip_w) == 0) {
-        is_allowed = true;
-        break;
-      }
-    }
-    if (!is_allowed) { // ip is not whitelisted
-      logger(LOG_DEBUG, "session_process_request()", "client ip %s is not whitelisted", client_ip);
-      xps_http_res_t *http_res = xps_http_res_create(session->core, HTTP_FORBIDDEN);
-      xps_buffer_t *http_res_buff = xps_http_res_serialize(http_res);
-      set_to_client_buff(session, http_res_buff);
-      xps_http_res_destroy(http_res);
-      return;
-    }
-  }
-
-  // check in blacklist
-  if (lookup->ip_blacklist.length > 0) {
-    const char *client_ip = session->client->remote_ip;
-    for (size_t i = 0; i < lookup->ip_blacklist.length; i++) {
-      const char *ip_b = lookup->ip_blacklist.data[i];
-      if (strcmp(client_ip, ip_b) == 0) { // ip is blacklisted so not allowed
-        logger(LOG_DEBUG, "session_process_request()", "client ip %s is blacklisted", client_ip);
-        xps_http_res_t *http_res = xps_http_res_create(session->core, HTTP_FORBIDDEN);
-        xps_buffer_t *http_res_buff = xps_http_res_serialize(http_res);
-        set_to_client_buff(session, http_res_buff);
-        xps_http_res_destroy(http_res);
-        return;
-      }
-    }
+  xps_timer_update(session->timer, session_timeout_msec(session));
+
+  // Whitelist takes priority over blacklist
+  xps_config_route_t *route = lookup->route;
+  if (route && !xps_config_ip_allowed(route, &(session->client->remote_addr))) {
+    logger(LOG_DEBUG, "session_process_request()", "client ip %s is not allowed",
+           session->client->remote_ip);
+    session_error_res(session, HTTP_FORBIDDEN);
+    return;
   }
 
   if (lookup->type == REQ_FILE_SERVE) {
@@ -499,18 +574,16 @@ void session_process_request(xps_session_t *session) {
       xps_buffer_t *dir_html =
         xps_directory_browsing(lookup->dir_path, session->http_req->pathname);
 
-      if (dir_html == NULL)
+      if (dir_html == NULL) {
         logger(LOG_ERROR, "session_process_request()", "xps_directory_browsing() failed");
-
-      // if dir_html found then status code is OK else interbal server error
-      xps_http_res_t *http_res =
-        xps_http_res_create(session->core, dir_html ? HTTP_OK : HTTP_INTERNAL_SERVER_ERROR);
-
-      if (dir_html) {
-        xps_http_res_set_body(http_res, dir_html);
-        xps_http_set_header(&(http_res->headers), "Content-Type", "text/html");
+        session_error_res(session, HTTP_INTERNAL_SERVER_ERROR);
+        return;
       }
 
+      xps_http_res_t *http_res = xps_http_res_create(session->core, HTTP_OK);
+      xps_http_res_set_body(http_res, dir_html);
+      xps_http_set_header(&(http_res->headers), "Content-Type", "text/html");
+
       xps_buffer_t *http_res_buf = xps_http_res_serialize(http_res);
       set_to_client_buff(session, http_res_buf);
       xps_http_res_destroy(http_res);
@@ -541,16 +614,7 @@ void session_process_request(xps_session_t *session) {
           perror("Error Message");
           status_code = HTTP_INTERNAL_SERVER_ERROR;
         }
-        xps_http_res_t *res = xps_http_res_create(session->core, status_code);
-        if (res == NULL) {
-          logger(LOG_ERROR, "session_process_request()",
-                 "xps_http_re_create() failed for file error");
-          xps_file_destroy(file);
-          return;
-        }
-        xps_buffer_t *buff = xps_http_res_serialize(res);
-        set_to_client_buff(session, buff);
-        xps_http_res_destroy(res);
+        session_error_res(session, status_code);
         return;
       }
 
@@ -565,6 +629,11 @@ void session_process_request(xps_session_t *session) {
         } else {
           // Tell browser that content is gzip compressed
           xps_http_set_header(&(res->headers), "Content-Encoding", "gzip");
+          // HTTP/1.0 clients get a body delimited by connection close instead
+          if (strcmp(session->http_req->http_version, "1.0") != 0) {
+            xps_http_set_header(&(res->headers), "Transfer-Encoding", "chunked");
+            session->res_chunked = true;
+          }
         }
         xps_http_set_header(&(res->headers), "Content-Type", session->file->mime_type);
       }
@@ -580,52 +649,81 @@ void session_process_request(xps_session_t *session) {
 
         /*create pipes with file->source and gzip->sink and then with gzip->source and
          * session->file_sink*/
-        xps_gzip_t *gzip = xps_gzip_create(lookup->gzip_level);
+        xps_gzip_t *gzip = xps_gzip_create(route->gzip_level);
         session->gzip = gzip;
-        xps_pipe_create(session->core, DEFAULT_PIPE_BUFF_THRESH, session->file->source, gzip->sink);
-        xps_pipe_create(session->core, DEFAULT_PIPE_BUFF_THRESH, gzip->source, session->file_sink);
+        xps_pipe_create(session->core, route->pipe_buff_thresh, session->file->source, gzip->sink);
+        xps_pipe_create(session->core, route->pipe_buff_thresh, gzip->source, session->file_sink);
       } else {
         /*create pipe with session->file->source and session->file_sink*/
-        xps_pipe_create(session->core, DEFAULT_PIPE_BUFF_THRESH, session->file->source,
+        xps_pipe_create(session->core, route->pipe_buff_thresh, session->file->source,
                         session->file_sink);
       }
     } else {
-      xps_http_res_t *http_res = xps_http_res_create(session->core, HTTP_NOT_FOUND);
-      xps_buffer_t *http_res_buff = xps_http_res_serialize(http_res);
-      set_to_client_buff(session, http_res_buff);
-      xps_http_res_destroy(http_res);
+      session_error_res(session, HTTP_NOT_FOUND);
     }
   } else if (lookup->type == REQ_REVERSE_PROXY) {
     xps_metrics_set(session->core, M_REQ_REVERSE_PROXY, 1);
 
+    if (route->x_forwarded_for && session_add_forwarded_for(session) != OK)
+      logger(LOG_ERROR, "session_process_request()", "session_add_forwarded_for() failed");
+
     char host[128];
     u_int port = 0;
 
-    sscanf(lookup->upstream, "%[^:]:%u", host, &port);
-    session->upstream = xps_upstream_create(session->core, host, port);
+    sscanf(lookup->upstream, "%127[^:]:%u", host, &port);
+    session->upstream_start_usec = monotonic_usec();
+    session->upstream = xps_upstream_pool_get(session->core, lookup->upstream);
+    if (session->upstream == NULL)
+      session->upstream = xps_upstream_create(session->core, host, port);
+
+    session->upstream_res = xps_http_res_parser_create(session->http_req->method_n);
 
     if (session->upstream == NULL) {
       logger(LOG_ERROR, "session_process_request()", "failed to connect to upstream %s:%u", host,
              port);
-      xps_http_res_t *http_res = xps_http_res_create(session->core, HTTP_BAD_GATEWAY);
-      xps_buffer_t *buff = xps_http_res_serialize(http_res);
-      set_to_client_buff(session, buff);
-      xps_http_res_destroy(http_res);
+      if (lookup->upstream_health)
+        xps_health_report(lookup->upstream_health, false, session->core->curr_time_msec);
+      session_error_res(session, HTTP_BAD_GATEWAY);
     } else {
+      if (lookup->upstream_health) {
+        xps_health_conn_start(lookup->upstream_health);
+        session->upstream_active = true;
+      }
 
-      xps_pipe_create(session->core, DEFAULT_PIPE_BUFF_THRESH, session->upstream->source,
+      session->upstream->buffer_size = route->buffer_size;
+      xps_pipe_create(session->core, route->pipe_buff_thresh, session->upstream->source,
                       session->upstream_sink);
-      xps_pipe_create(session->core, DEFAULT_PIPE_BUFF_THRESH, session->upstream_source,
+      xps_pipe_create(session->core, route->pipe_buff_thresh, session->upstream_source,
                       session->upstream->sink);
     }
 
   } else if (lookup->type == REQ_REDIRECT) {
     xps_metrics_set(session->core, M_REQ_REDIRECT, 1);
-    xps_http_res_t *http_res = xps_http_res_create(session->core, lookup->http_status_code);
-    xps_http_set_header(&http_res->headers, "Location", lookup->redirect_url);
-    xps_buffer_t *http_res_buff = xps_http_res_serialize(http_res);
+
+    // Pre-serialized at config load; built here when there is none or rendering it fails
+    xps_buffer_t *http_res_buff = NULL;
+    if (route->_redirect_res) {
+      http_res_buff = xps_http_res_template_render(session->core, route->_redirect_res);
+      if (http_res_buff == NULL)
+        logger(LOG_ERROR, "session_process_request()", "xps_http_res_template_render() failed");
+    }
+    if (http_res_buff == NULL) {
+      xps_http_res_t *http_res = xps_http_res_create(session->core, route->http_status_code);
+      if (http_res == NULL) {
+        logger(LOG_ERROR, "session_process_request()", "xps_http_res_create() failed");
+        xps_session_destroy(session);
+        return;
+      }
+      xps_http_set_header(&http_res->headers, "Location", route->redirect_url);
+      http_res_buff = xps_http_res_serialize(http_res);
+      xps_http_res_destroy(http_res);
+      if (http_res_buff == NULL) {
+        logger(LOG_ERROR, "session_process_request()", "xps_http_res_serialize() failed");
+        xps_session_destroy(session);
+        return;
+      }
+    }
     set_to_client_buff(session, http_res_buff);
-    xps_http_res_destroy(http_res);
     return;
   } else if (lookup->type == REQ_METRICS) { // METRICS TODO: STAGE22
     if (strcmp(session->http_req->pathname, "/api") == 0) {
@@ -641,10 +739,7 @@ void session_process_request(xps_session_t *session) {
       set_to_client_buff(session, http_res_buff);
       xps_http_res_destroy(http_res);
     } else {
-      xps_http_res_t *http_res = xps_http_res_create(session->core, HTTP_NOT_FOUND);
-      xps_buffer_t *http_res_buff = xps_http_res_serialize(http_res);
-      set_to_client_buff(session, http_res_buff);
-      xps_http_res_destroy(http_res);
+      session_error_res(session, HTTP_NOT_FOUND);
     }
   } else {
     logger(LOG_ERROR, "session_process_request()", "invalid lookup type");
@@ -661,4 +756,238 @@ void session_timer_handler(void *ptr) {
   logger(LOG_WARNING, "session_timer_handler()", "http req timeout");
   xps_metrics_set(session->core, M_CONN_TIMEOUT, 1);
   xps_session_destroy(session);
-}
\ No newline at end of file
+}
+void session_error_res(xps_session_t *session, u_int status_code) {
+  assert(session != NULL);
+
+  // Use the response pre-serialized at config load when available
+  xps_http_res_template_t *tmpl = xps_config_error_res(session->config, status_code);
+  if (tmpl) {
+    xps_buffer_t *http_res_buff = xps_http_res_template_render(session->core, tmpl);
+    if (http_res_buff) {
+      set_to_client_buff(session, http_res_buff);
+      return;
+    }
+    logger(LOG_ERROR, "session_error_res()", "xps_http_res_template_render() failed");
+  }
+
+  xps_http_res_t *http_res = xps_http_res_create(session->core, status_code);
+  if (http_res == NULL) {
+    logger(LOG_ERROR, "session_error_res()", "xps_http_res_create() failed");
+    return;
+  }
+  xps_buffer_t *http_res_buff = xps_http_res_serialize(http_res);
+  set_to_client_buff(session, http_res_buff);
+  xps_http_res_destroy(http_res);
+}
+
+int session_add_forwarded_for(xps_session_t *session) {
+  assert(session != NULL);
+
+  if (session->from_client_buff == NULL || session->client->remote_ip[0] == '\0')
+    return E_FAIL;
+
+  // Insert header just before the empty line that ends the header section
+  char header_str[INET6_ADDRSTRLEN + 24];
+  int header_str_len =
+    snprintf(header_str, sizeof(header_str), "X-Forwarded-For: %s\r\n", session->client->remote_ip);
+
+  return xps_buffer_insert(session->from_client_buff, session->http_req->header_fields_len,
+                           (u_char *)header_str, header_str_len);
+}
+
+/* True once every byte of the request, body included, has been read from the client */
+bool session_req_complete(xps_session_t *session) {
+  assert(session != NULL);
+
+  return session->req_body != NULL && session->req_body->done;
+}
+
+/* Writes to_client_buff framed as one chunk: size line, data, CRLF; on OK the pipe owns it */
+int session_write_chunk(xps_session_t *session, xps_pipe_source_t *source) {
+  assert(session != NULL);
+  assert(source != NULL);
+
+  xps_buffer_t *data = session->to_client_buff;
+  if (data->len == 0) {
+    xps_buffer_destroy(data);
+    return OK;
+  }
+
+  u_char size_line[24];
+  int size_line_len = snprintf((char *)size_line, sizeof(size_line), "%zx\r\n", data->len);
+
+  // Only the framing is allocated; the data buffer goes to the pipe as it is
+  xps_buffer_t *head = xps_buffer_create(size_line_len, size_line_len, NULL);
+  xps_buffer_t *tail = xps_buffer_create(2, 2, NULL);
+  if (head == NULL || tail == NULL) {
+    logger(LOG_ERROR, "session_write_chunk()", "xps_buffer_create() failed");
+    if (head)
+      xps_buffer_destroy(head);
+    if (tail)
+      xps_buffer_destroy(tail);
+    return E_FAIL;
+  }
+  memcpy(head->data, size_line, size_line_len);
+  memcpy(tail->data, "\r\n", 2);
+
+  xps_buffer_t *buffs[] = {head, data, tail};
+  if (xps_pipe_source_writev(source, buffs, 3) != OK) {
+    xps_buffer_destroy(head);
+    xps_buffer_destroy(tail);
+    return E_FAIL;
+  }
+
+  return OK;
+}
+
+/* Queues the last chunk once the file has been fully read and sent on */
+void session_end_chunked(xps_session_t *session) {
+  assert(session != NULL);
+
+  if (!session->res_chunked || session->res_last_chunk_set)
+    return;
+  if (session->file_sink->active || session->to_client_buff != NULL)
+    return;
+
+  xps_buffer_t *buff = xps_buffer_create(5, 5, NULL);
+  if (buff == NULL) {
+    logger(LOG_ERROR, "session_end_chunked()", "xps_buffer_create() failed");
+    return;
+  }
+  memcpy(buff->data, "0\r\n\r\n", 5);
+
+  session->res_last_chunk_set = true;
+  set_to_client_buff(session, buff);
+}
+
+/* Hands a keep-alive upstream back to the core's pool once request and response have both ended */
+void session_upstream_release(xps_session_t *session) {
+  assert(session != NULL);
+
+  xps_connection_t *upstream = session->upstream;
+  if (upstream == NULL || !session->upstream_res->keep_alive)
+    return;
+
+  // The request is forwarded as is, so the upstream may close after answering it
+  const char *connection = session->http_req->known_headers[HTTP_H_CONNECTION];
+  bool req_close = connection ? xps_http_has_token(connection, strlen(connection), "close")
+                              : strcmp(session->http_req->http_version, "1.0") == 0;
+  if (req_close || session->http_req->framing_ambiguous)
+    return;
+
+  // Every request byte must have been written and every response byte read
+  xps_pipe_t *to_upstream = upstream->sink->pipe;
+  xps_pipe_t *from_upstream = upstream->source->pipe;
+  if (!session_req_complete(session) || session->from_client_buff != NULL ||
+      to_upstream == NULL || from_upstream == NULL || to_upstream->buff_list->len > 0 ||
+      from_upstream->buff_list->len > 0)
+    return;
+
+  xps_pipe_detach_sink(to_upstream);
+  xps_pipe_detach_source(from_upstream);
+  session->upstream = NULL;
+
+  xps_upstream_pool_put(session->core, upstream, session->lookup->upstream);
+}
+
+/* The upstream no longer has a request of this session in flight */
+void session_upstream_done(xps_session_t *session) {
+  assert(session != NULL);
+
+  if (!session->upstream_active)
+    return;
+
+  xps_health_conn_end(session->lookup->upstream_health);
+  session->upstream_active = false;
+}
+
+
+/* Only bodies framed by length or by connection close can bypass the response parser */
+bool session_splice_wanted(xps_session_t *session) {
+  assert(session != NULL);
+
+  xps_http_res_parser_t *parser = session->upstream_res;
+  if (!session->lookup->route->splice || parser == NULL || parser->state != RES_BODY)
+    return false;
+
+  xps_http_body_t *body = parser->body;
+  return body->type == HTTP_BODY_CLOSE ||
+         (body->type == HTTP_BODY_LENGTH && body->remaining >= DEFAULT_SPLICE_MIN_BYTES);
+}
+
+/* Moves the rest of the response body kernel-side, after what was already read */
+void session_splice_start(xps_session_t *session) {
+  assert(session != NULL);
+
+  // Bytes read from the upstream meanwhile go through the parser and to the client first
+  xps_pipe_t *from_upstream = session->upstream_sink->pipe;
+  if (from_upstream == NULL || from_upstream->source == NULL) {
+    session->splice_pending = false;
+    return;
+  }
+  if (xps_pipe_is_readable(from_upstream))
+    return;
+
+  session->splice_pending = false;
+
+  xps_http_body_t *body = session->upstream_res->body;
+  long len = body->type == HTTP_BODY_LENGTH ? (long)body->remaining : -1;
+
+  session->splice = xps_splice_create(session->core, session->upstream, session->client, len,
+                                      session, session_splice_handler,
+                                      session_splice_close_handler);
+  if (session->splice == NULL)
+    logger(LOG_ERROR, "session_splice_start()", "xps_splice_create() failed, copying instead");
+}
+
+void session_splice_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_session_t *session = ptr;
+
+  xps_timer_update(session->timer, session_timeout_msec(session));
+}
+
+void session_splice_close_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_session_t *session = ptr;
+  xps_splice_t *splice = session->splice;
+
+  bool complete = !splice->error && splice->remaining == 0;
+  bool upstream_alive = splice->from != NULL;
+
+  session->splice = NULL;
+  xps_splice_destroy(splice);
+
+  // A body that ends with the connection, or was cut short, leaves nothing to reuse
+  if (!complete) {
+    if (upstream_alive)
+      xps_connection_destroy(session->upstream);
+    session->upstream = NULL;
+    return;
+  }
+
+  // The body never went through the parser, so finish its framing here
+  xps_http_res_parser_t *parser = session->upstream_res;
+  parser->body->remaining = 0;
+  parser->body->done = true;
+  parser->state = RES_DONE;
+
+  xps_metrics_set(session->core, M_UPSTREAM_RES_TIME,
+                  monotonic_usec() - session->upstream_start_usec);
+  session_upstream_done(session);
+  session_upstream_release(session);
+}
+/* Idle timeout of the route the request went to, or of the client's listener */
+u_long session_timeout_msec(xps_session_t *session) {
+  assert(session != NULL);
+
+  if (session->lookup && session->lookup->route)
+    return session->lookup->route->req_timeout_msec;
+  if (session->client && session->client->listener)
+    return session->client->listener->conf->req_timeout_msec;
+
+  return session->config->req_timeout_msec;
+}
@@ -5,12 +5,17 @@
 
 struct xps_session_s {
   xps_core_t *core;
+  xps_config_t *config; // the core's config when the session started, kept across reloads
 
   xps_connection_t *client;
   xps_connection_t *upstream;
   bool upstream_connected;
   bool upstream_error_res_set;
   u_long upstream_write_bytes;
+  xps_http_res_parser_t *upstream_res;
+  bool upstream_active; // counted in lookup->upstream_health->active
+  xps_splice_t *splice; // response body passing kernel-side from upstream to client
+  bool splice_pending;  // start the splice once the bytes read so far are queued
   xps_file_t *file;
   xps_gzip_t *gzip;
 
@@ -21,13 +26,20 @@ struct xps_session_s {
   xps_pipe_sink_t *file_sink;
 
   xps_buffer_t *to_client_buff;
+  bool to_client_chunk; // to_client_buff is body data to be sent as one chunk
+  bool res_chunked;     // response body uses Transfer-Encoding: chunked
+  bool res_last_chunk_set;
   xps_buffer_t *from_client_buff;
 
   xps_http_req_t *http_req;
+  xps_http_body_t *req_body;
   u_long req_create_time_msec;
-  long res_time;
+  u_long req_start_usec;      // monotonic, 0 until a request is parsed
+  u_long upstream_start_usec; // monotonic, when the upstream connection was picked
+  long ttfb_usec;             // -1 until the first response bytes are queued
 
-  xps_config_lookup_t *lookup;
+  xps_config_lookup_t *lookup; // &lookup_buf once the request is routed
+  xps_config_lookup_t lookup_buf;
   xps_timer_t *timer;
 };
 
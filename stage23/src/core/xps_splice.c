@@ -0,0 +1,217 @@
+#include "xps_splice.h"
+
+bool splice_is_done(xps_splice_t *splice);
+bool splice_can_read(xps_splice_t *splice);
+bool splice_to_drained(xps_splice_t *splice);
+void splice_read(xps_splice_t *splice);
+void splice_write(xps_splice_t *splice);
+ssize_t splice_move(int fd_in, int fd_out, size_t len);
+
+xps_splice_t *xps_splice_create(xps_core_t *core, xps_connection_t *from, xps_connection_t *to,
+                                long len, void *ptr, xps_handler_t handler_cb,
+                                xps_handler_t close_cb) {
+  assert(core != NULL);
+  assert(from != NULL);
+  assert(to != NULL);
+  assert(ptr != NULL);
+  assert(handler_cb != NULL);
+  assert(close_cb != NULL);
+
+  if (from->splice_from != NULL || to->splice_to != NULL) {
+    logger(LOG_ERROR, "xps_splice_create()", "connection is already spliced");
+    return NULL;
+  }
+
+  xps_splice_t *splice = malloc(sizeof(xps_splice_t));
+  if (splice == NULL) {
+    logger(LOG_ERROR, "xps_splice_create()", "malloc() failed for 'splice'");
+    return NULL;
+  }
+
+  if (pipe2(splice->pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+    logger(LOG_ERROR, "xps_splice_create()", "pipe2() failed");
+    perror("Error message");
+    free(splice);
+    return NULL;
+  }
+
+  // A bigger pipe means fewer splice() calls; the default size is kept if it is refused
+  fcntl(splice->pipe_fds[1], F_SETPIPE_SZ, DEFAULT_SPLICE_PIPE_SIZE);
+  int pipe_size = fcntl(splice->pipe_fds[1], F_GETPIPE_SZ);
+
+  splice->core = core;
+  splice->from = from;
+  splice->to = to;
+  splice->pipe_size = pipe_size > 0 ? pipe_size : 65536;
+  splice->pipe_len = 0;
+  splice->remaining = len;
+  splice->from_ready = from->source->ready;
+  splice->from_eof = false;
+  splice->pipe_full = false;
+  splice->error = false;
+  splice->write_n = 0;
+  splice->handler_cb = handler_cb;
+  splice->close_cb = close_cb;
+  splice->ptr = ptr;
+
+  // Reads from 'from' are ours now; the pipe from from->source sees no readiness
+  from->source->ready = false;
+  from->splice_from = splice;
+  to->splice_to = splice;
+
+  vec_push(&(core->splices), splice);
+
+  logger(LOG_DEBUG, "xps_splice_create()", "created splice");
+
+  return splice;
+}
+
+void xps_splice_destroy(xps_splice_t *splice) {
+  assert(splice != NULL);
+
+  for (int i = 0; i < splice->core->splices.length; i++) {
+    if (splice->core->splices.data[i] == splice) {
+      splice->core->splices.data[i] = NULL;
+      splice->core->n_null_splices++;
+      break;
+    }
+  }
+
+  // Hand reading back to the pipe from from->source
+  if (splice->from) {
+    splice->from->source->ready = splice->from_ready;
+    splice->from->splice_from = NULL;
+  }
+  if (splice->to)
+    splice->to->splice_to = NULL;
+
+  close(splice->pipe_fds[0]);
+  close(splice->pipe_fds[1]);
+  free(splice);
+
+  logger(LOG_DEBUG, "xps_splice_destroy()", "destroyed splice");
+}
+
+/* Called when one of the connections is destroyed while spliced */
+void xps_splice_detach(xps_splice_t *splice, xps_connection_t *connection) {
+  assert(splice != NULL);
+  assert(connection != NULL);
+
+  // Bytes already in the kernel pipe can still be sent on
+  if (connection == splice->from) {
+    splice->from = NULL;
+    splice->from_eof = true;
+    connection->splice_from = NULL;
+  }
+  if (connection == splice->to) {
+    splice->to = NULL;
+    splice->error = true;
+    connection->splice_to = NULL;
+  }
+}
+
+bool xps_splice_is_ready(xps_splice_t *splice) {
+  assert(splice != NULL);
+
+  if (splice->error || splice_is_done(splice) || splice_can_read(splice))
+    return true;
+
+  // Pending bytes in the pipe to to->sink are reported by the pipe itself
+  return splice->pipe_len > 0 && splice->to->sink->ready;
+}
+
+/* Makes one pass: fills the kernel pipe from 'from', then empties it into 'to' */
+void xps_splice_handler(xps_splice_t *splice) {
+  assert(splice != NULL);
+
+  if (!splice->error && splice_can_read(splice))
+    splice_read(splice);
+
+  if (!splice->error && splice->pipe_len > 0 && splice->to->sink->ready &&
+      splice_to_drained(splice))
+    splice_write(splice);
+
+  if (splice->error || splice_is_done(splice))
+    splice->close_cb(splice->ptr);
+}
+
+bool splice_is_done(xps_splice_t *splice) {
+  return splice->pipe_len == 0 && (splice->remaining == 0 || splice->from_eof);
+}
+
+bool splice_can_read(xps_splice_t *splice) {
+  return splice->from != NULL && splice->from_ready && !splice->from_eof &&
+         !splice->pipe_full && splice->remaining != 0 && splice->pipe_len < splice->pipe_size;
+}
+
+/* Bytes written to 'to' by the copy path must all be sent before the spliced ones */
+bool splice_to_drained(xps_splice_t *splice) {
+  xps_pipe_t *pipe = splice->to->sink->pipe;
+
+  return pipe == NULL || !xps_pipe_is_readable(pipe);
+}
+
+void splice_read(xps_splice_t *splice) {
+  size_t len = splice->pipe_size - splice->pipe_len;
+  if (splice->remaining > 0 && (size_t)splice->remaining < len)
+    len = splice->remaining;
+
+  ssize_t read_n = splice_move(splice->from->sock_fd, splice->pipe_fds[1], len);
+
+  if (read_n > 0) {
+    splice->pipe_len += read_n;
+    if (splice->remaining > 0)
+      splice->remaining -= read_n;
+    xps_metrics_set(splice->core, M_TRAFFIC_RECV_BYTES, read_n);
+    return;
+  }
+
+  if (read_n == 0) {
+    splice->from_eof = true;
+    return;
+  }
+
+  if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    // The pipe can fill up before pipe_size when it holds many small segments
+    int avail_n = 0;
+    if (splice->pipe_len > 0 && ioctl(splice->from->sock_fd, FIONREAD, &avail_n) == 0 &&
+        avail_n > 0)
+      splice->pipe_full = true;
+    else
+      splice->from_ready = false;
+    return;
+  }
+
+  logger(LOG_ERROR, "splice_read()", "splice() failed");
+  perror("Error message");
+  xps_metrics_set(splice->core, M_CONN_ERROR, 1);
+  splice->error = true;
+}
+
+void splice_write(xps_splice_t *splice) {
+  ssize_t write_n = splice_move(splice->pipe_fds[0], splice->to->sock_fd, splice->pipe_len);
+
+  if (write_n > 0) {
+    splice->pipe_len -= write_n;
+    splice->pipe_full = false;
+    splice->write_n = write_n;
+    xps_metrics_set(splice->core, M_TRAFFIC_SEND_BYTES, write_n);
+    splice->handler_cb(splice->ptr);
+    return;
+  }
+
+  if (write_n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    splice->to->sink->ready = false;
+    return;
+  }
+
+  logger(LOG_ERROR, "splice_write()", "splice() failed");
+  perror("Error message");
+  xps_metrics_set(splice->core, M_CONN_ERROR, 1);
+  splice->error = true;
+}
+
+/* splice() itself, which the 'splice' variables above hide */
+ssize_t splice_move(int fd_in, int fd_out, size_t len) {
+  return splice(fd_in, NULL, fd_out, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+}
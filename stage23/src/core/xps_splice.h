@@ -0,0 +1,39 @@
+#ifndef XPS_SPLICE_H
+#define XPS_SPLICE_H
+
+#include "../xps.h"
+
+/*
+ * Moves bytes from one connection's socket to another's through a kernel pipe
+ * with splice(), so they are never copied into user space. While a splice is
+ * active it owns reading from 'from'; 'to' shares its write readiness with the
+ * pipe attached to to->sink, which is drained before any spliced byte is sent.
+ * A connection can be the 'from' of one splice and the 'to' of another.
+ */
+struct xps_splice_s {
+  xps_core_t *core;
+  xps_connection_t *from; // NULL once the connection is destroyed
+  xps_connection_t *to;   // NULL once the connection is destroyed
+  int pipe_fds[2];
+  size_t pipe_size;
+  size_t pipe_len;  // bytes sitting in the kernel pipe
+  long remaining;   // bytes still to read from 'from', -1 to read until EOF
+  bool from_ready;  // stands in for from->source->ready
+  bool from_eof;
+  bool pipe_full;   // kernel pipe took no more, though 'from' had data
+  bool error;
+  size_t write_n;           // bytes sent to 'to' by the last write, for handler_cb
+  xps_handler_t handler_cb; // bytes were sent to 'to'
+  xps_handler_t close_cb;   // finished or failed, the owner must destroy the splice
+  void *ptr;
+};
+
+xps_splice_t *xps_splice_create(xps_core_t *core, xps_connection_t *from, xps_connection_t *to,
+                                long len, void *ptr, xps_handler_t handler_cb,
+                                xps_handler_t close_cb);
+void xps_splice_destroy(xps_splice_t *splice);
+void xps_splice_detach(xps_splice_t *splice, xps_connection_t *connection);
+bool xps_splice_is_ready(xps_splice_t *splice);
+void xps_splice_handler(xps_splice_t *splice);
+
+#endif
@@ -0,0 +1,241 @@
+#include "xps_tcp_session.h"
+
+void tcp_session_to_upstream_handler(void *ptr);
+void tcp_session_to_upstream_close_handler(void *ptr);
+void tcp_session_to_client_handler(void *ptr);
+void tcp_session_to_client_close_handler(void *ptr);
+void tcp_session_timer_handler(void *ptr);
+void tcp_session_sync(xps_tcp_session_t *session);
+void tcp_session_traffic(xps_tcp_session_t *session);
+void tcp_session_splice_done(xps_tcp_session_t *session, xps_splice_t *splice);
+
+xps_tcp_session_t *xps_tcp_session_create(xps_core_t *core, xps_connection_t *client,
+                                          xps_config_route_t *route) {
+  assert(core != NULL);
+  assert(client != NULL);
+  assert(route != NULL);
+
+  if (route->upstreams.length == 0) {
+    logger(LOG_ERROR, "xps_tcp_session_create()", "route has no upstreams");
+    return NULL;
+  }
+
+  if (!xps_config_ip_allowed(route, &(client->remote_addr))) {
+    logger(LOG_DEBUG, "xps_tcp_session_create()", "client ip %s is not allowed", client->remote_ip);
+    return NULL;
+  }
+
+  xps_tcp_session_t *session = malloc(sizeof(xps_tcp_session_t));
+  if (session == NULL) {
+    logger(LOG_ERROR, "xps_tcp_session_create()", "malloc() failed for 'session'");
+    return NULL;
+  }
+
+  session->timer =
+    xps_timer_create(core, route->idle_timeout_msec, (void *)session, tcp_session_timer_handler);
+  if (session->timer == NULL) {
+    logger(LOG_ERROR, "xps_tcp_session_create()", "xps_timer_create() failed");
+    free(session);
+    return NULL;
+  }
+
+  // There is no request, so ip_hash keys on the client address
+  int index = xps_config_balance(route, NULL, core, &(client->remote_addr));
+  const char *upstream_name = route->upstreams.data[index];
+
+  // Init values
+  session->core = core;
+  session->route = route;
+  session->client = client;
+  session->upstream = NULL;
+  session->upstream_health =
+    route->_upstream_health.length > 0 ? route->_upstream_health.data[index] : NULL;
+  session->upstream_up = false;
+  session->upstream_active = false;
+  session->to_upstream = NULL;
+  session->to_client = NULL;
+
+  char host[128];
+  u_int port = 0;
+  sscanf(upstream_name, "%127[^:]:%u", host, &port);
+
+  session->upstream = xps_upstream_create(core, host, port);
+  if (session->upstream == NULL) {
+    logger(LOG_ERROR, "xps_tcp_session_create()", "failed to connect to upstream %s:%u", host,
+           port);
+    if (session->upstream_health)
+      xps_health_report(session->upstream_health, false, core->curr_time_msec);
+    xps_timer_destroy(session->timer);
+    free(session);
+    return NULL;
+  }
+
+  if (session->upstream_health) {
+    xps_health_conn_start(session->upstream_health);
+    session->upstream_active = true;
+  }
+
+  // route belongs to the core's current config
+  session->config = xps_reload_config_get(core);
+
+  // Add to 'tcp_sessions' list of core
+  vec_push(&(core->tcp_sessions), session);
+  xps_metrics_set(core, M_TCP_SESSION_CREATE, 1);
+
+  session->to_upstream = xps_splice_create(core, client, session->upstream, -1, session,
+                                           tcp_session_to_upstream_handler,
+                                           tcp_session_to_upstream_close_handler);
+  session->to_client = xps_splice_create(core, session->upstream, client, -1, session,
+                                         tcp_session_to_client_handler,
+                                         tcp_session_to_client_close_handler);
+  if (session->to_upstream == NULL || session->to_client == NULL) {
+    logger(LOG_ERROR, "xps_tcp_session_create()", "xps_splice_create() failed");
+    // The client is left to the caller
+    session->client = NULL;
+    xps_tcp_session_destroy(session);
+    return NULL;
+  }
+
+  logger(LOG_DEBUG, "xps_tcp_session_create()", "created tcp session to %s", upstream_name);
+
+  return session;
+}
+
+void xps_tcp_session_destroy(xps_tcp_session_t *session) {
+  assert(session != NULL);
+
+  tcp_session_sync(session);
+
+  // An upstream that went away before carrying a byte counts as a failed connect
+  if (session->upstream == NULL && !session->upstream_up && session->upstream_health)
+    xps_health_report(session->upstream_health, false, session->core->curr_time_msec);
+
+  if (session->to_upstream)
+    xps_splice_destroy(session->to_upstream);
+  if (session->to_client)
+    xps_splice_destroy(session->to_client);
+
+  if (session->client)
+    xps_connection_destroy(session->client);
+  if (session->upstream)
+    xps_connection_destroy(session->upstream);
+
+  if (session->upstream_active)
+    xps_health_conn_end(session->upstream_health);
+
+  xps_timer_destroy(session->timer);
+
+  // Set NULL in core's list of tcp sessions
+  for (int i = 0; i < session->core->tcp_sessions.length; i++) {
+    if (session->core->tcp_sessions.data[i] == session) {
+      session->core->tcp_sessions.data[i] = NULL;
+      session->core->n_null_tcp_sessions++;
+      break;
+    }
+  }
+
+  xps_metrics_set(session->core, M_TCP_SESSION_DESTROY, 1);
+  xps_reload_config_put(session->core, session->config);
+
+  free(session);
+
+  logger(LOG_DEBUG, "xps_tcp_session_destroy()", "destroyed tcp session");
+}
+
+void tcp_session_to_upstream_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_tcp_session_t *session = ptr;
+
+  xps_metrics_set(session->core, M_TCP_TO_UPSTREAM_BYTES, session->to_upstream->write_n);
+  tcp_session_traffic(session);
+}
+
+void tcp_session_to_upstream_close_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_tcp_session_t *session = ptr;
+
+  tcp_session_splice_done(session, session->to_upstream);
+}
+
+void tcp_session_to_client_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_tcp_session_t *session = ptr;
+
+  xps_metrics_set(session->core, M_TCP_TO_CLIENT_BYTES, session->to_client->write_n);
+  tcp_session_traffic(session);
+}
+
+void tcp_session_to_client_close_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_tcp_session_t *session = ptr;
+
+  tcp_session_splice_done(session, session->to_client);
+}
+
+void tcp_session_timer_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_tcp_session_t *session = ptr;
+
+  logger(LOG_INFO, "tcp_session_timer_handler()", "tcp session idle timeout");
+  xps_metrics_set(session->core, M_CONN_TIMEOUT, 1);
+  xps_tcp_session_destroy(session);
+}
+
+/* Forgets connections that were destroyed while spliced; the splices know which */
+void tcp_session_sync(xps_tcp_session_t *session) {
+  assert(session != NULL);
+
+  xps_splice_t *splice = session->to_upstream;
+  if (splice && splice->from == NULL)
+    session->client = NULL;
+  if (splice && splice->to == NULL)
+    session->upstream = NULL;
+
+  splice = session->to_client;
+  if (splice && splice->from == NULL)
+    session->upstream = NULL;
+  if (splice && splice->to == NULL)
+    session->client = NULL;
+}
+
+void tcp_session_traffic(xps_tcp_session_t *session) {
+  assert(session != NULL);
+
+  xps_timer_update(session->timer, session->route->idle_timeout_msec);
+
+  if (!session->upstream_up && session->upstream_health)
+    xps_health_report(session->upstream_health, true, session->core->curr_time_msec);
+  session->upstream_up = true;
+}
+
+/* One direction has ended: pass its EOF on, and end the session once both have */
+void tcp_session_splice_done(xps_tcp_session_t *session, xps_splice_t *splice) {
+  assert(session != NULL);
+  assert(splice != NULL);
+
+  tcp_session_sync(session);
+
+  if (splice == session->to_upstream)
+    session->to_upstream = NULL;
+  else
+    session->to_client = NULL;
+
+  bool failed = splice->error;
+  xps_connection_t *to = splice->to;
+  xps_splice_destroy(splice);
+
+  if (failed || (session->to_upstream == NULL && session->to_client == NULL)) {
+    xps_tcp_session_destroy(session);
+    return;
+  }
+
+  if (shutdown(to->sock_fd, SHUT_WR) < 0) {
+    logger(LOG_ERROR, "tcp_session_splice_done()", "shutdown() failed");
+    xps_tcp_session_destroy(session);
+  }
+}
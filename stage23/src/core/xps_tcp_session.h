@@ -0,0 +1,27 @@
+#ifndef XPS_TCP_SESSION_H
+#define XPS_TCP_SESSION_H
+
+#include "../xps.h"
+
+/* A client connection of a tcp_proxy listener, spliced to one upstream both ways */
+struct xps_tcp_session_s {
+  xps_core_t *core;
+  xps_config_t *config; // holds route across reloads
+  xps_config_route_t *route;
+
+  xps_connection_t *client;   // NULL once destroyed
+  xps_connection_t *upstream; // NULL once destroyed
+  xps_health_entry_t *upstream_health;
+  bool upstream_up;     // bytes went to or came from the upstream
+  bool upstream_active; // counted in upstream_health->active
+
+  xps_splice_t *to_upstream; // NULL once the client has sent EOF
+  xps_splice_t *to_client;   // NULL once the upstream has sent EOF
+  xps_timer_t *timer;
+};
+
+xps_tcp_session_t *xps_tcp_session_create(xps_core_t *core, xps_connection_t *client,
+                                          xps_config_route_t *route);
+void xps_tcp_session_destroy(xps_tcp_session_t *session);
+
+#endif
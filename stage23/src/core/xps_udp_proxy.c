@@ -0,0 +1,487 @@
+#include "xps_udp_proxy.h"
+
+void udp_proxy_read_handler(void *ptr);
+void udp_proxy_read(xps_udp_proxy_t *proxy);
+void udp_proxy_batch_reset(xps_udp_proxy_t *proxy);
+u_int udp_proxy_hash(struct sockaddr_in *addr);
+xps_udp_flow_t *udp_flow_get(xps_udp_proxy_t *proxy, struct sockaddr_in *client_addr);
+xps_udp_flow_t *udp_flow_create(xps_udp_proxy_t *proxy, struct sockaddr_in *client_addr);
+void udp_flow_destroy(xps_udp_flow_t *flow);
+void udp_flow_read_handler(void *ptr);
+void udp_flow_timer_handler(void *ptr);
+void udp_flow_set_ready(xps_udp_flow_t *flow);
+void udp_flow_read(xps_udp_flow_t *flow);
+void udp_flow_send(xps_udp_flow_t *flow, struct mmsghdr *msgs, int n);
+void udp_flow_fail(xps_udp_flow_t *flow, const char *func);
+
+xps_udp_proxy_t *xps_udp_proxy_create(xps_core_t *core, const char *host, u_int port,
+                                      xps_config_route_t *route) {
+  assert(core != NULL);
+  assert(host != NULL);
+  assert(is_valid_port(port));
+  assert(route != NULL);
+
+  int sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  if (sock_fd < 0) {
+    logger(LOG_ERROR, "xps_udp_proxy_create()", "socket() failed");
+    perror("Error message");
+    return NULL;
+  }
+
+  // Every core binds its own socket; the kernel spreads clients over them by address
+  const int enable = 1;
+  if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0 ||
+      setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)) < 0) {
+    logger(LOG_ERROR, "xps_udp_proxy_create()", "setsockopt() failed");
+    perror("Error message");
+    close(sock_fd);
+    return NULL;
+  }
+
+  struct addrinfo *addr_info = xps_getaddrinfo(host, port);
+  if (addr_info == NULL) {
+    logger(LOG_ERROR, "xps_udp_proxy_create()", "xps_getaddrinfo() failed");
+    close(sock_fd);
+    return NULL;
+  }
+
+  if (bind(sock_fd, addr_info->ai_addr, addr_info->ai_addrlen) < 0) {
+    logger(LOG_ERROR, "xps_udp_proxy_create()", "failed to bind() to %s:%u", host, port);
+    perror("Error message");
+    freeaddrinfo(addr_info);
+    close(sock_fd);
+    return NULL;
+  }
+  freeaddrinfo(addr_info);
+
+  xps_udp_proxy_t *proxy = malloc(sizeof(xps_udp_proxy_t));
+  if (proxy == NULL) {
+    logger(LOG_ERROR, "xps_udp_proxy_create()", "malloc() failed for 'proxy'");
+    close(sock_fd);
+    return NULL;
+  }
+
+  proxy->flows = calloc(DEFAULT_UDP_MAX_FLOWS, sizeof(xps_udp_flow_t *));
+  proxy->bufs = malloc(DEFAULT_UDP_BATCH_SIZE * DEFAULT_UDP_DGRAM_SIZE);
+  if (proxy->flows == NULL || proxy->bufs == NULL) {
+    logger(LOG_ERROR, "xps_udp_proxy_create()", "malloc() failed for batch buffers");
+    free(proxy->flows);
+    free(proxy->bufs);
+    free(proxy);
+    close(sock_fd);
+    return NULL;
+  }
+
+  // Init values
+  proxy->core = core;
+  proxy->route = route;
+  proxy->host = host;
+  proxy->port = port;
+  proxy->sock_fd = sock_fd;
+  proxy->ready = false;
+  proxy->n_flows = 0;
+  vec_init(&(proxy->ready_flows));
+
+  if (xps_loop_attach(core->loop, sock_fd, EPOLLIN | EPOLLET, proxy, udp_proxy_read_handler, NULL,
+                      udp_proxy_read_handler) != OK) {
+    logger(LOG_ERROR, "xps_udp_proxy_create()", "xps_loop_attach() failed");
+    vec_deinit(&(proxy->ready_flows));
+    free(proxy->flows);
+    free(proxy->bufs);
+    free(proxy);
+    close(sock_fd);
+    return NULL;
+  }
+
+  vec_push(&(core->udp_proxies), proxy);
+
+  logger(LOG_DEBUG, "xps_udp_proxy_create()", "created udp proxy on port %u", port);
+
+  return proxy;
+}
+
+void xps_udp_proxy_destroy(xps_udp_proxy_t *proxy) {
+  assert(proxy != NULL);
+
+  for (int i = 0; i < DEFAULT_UDP_MAX_FLOWS; i++) {
+    while (proxy->flows[i] != NULL)
+      udp_flow_destroy(proxy->flows[i]);
+  }
+
+  xps_loop_detach(proxy->core->loop, proxy->sock_fd);
+  close(proxy->sock_fd);
+
+  for (int i = 0; i < proxy->core->udp_proxies.length; i++) {
+    if (proxy->core->udp_proxies.data[i] == proxy) {
+      proxy->core->udp_proxies.data[i] = NULL;
+      break;
+    }
+  }
+
+  vec_deinit(&(proxy->ready_flows));
+  free(proxy->flows);
+  free(proxy->bufs);
+  free(proxy);
+
+  logger(LOG_DEBUG, "xps_udp_proxy_destroy()", "destroyed udp proxy");
+}
+
+bool xps_udp_proxy_is_ready(xps_udp_proxy_t *proxy) {
+  assert(proxy != NULL);
+
+  return proxy->ready || proxy->ready_flows.length > 0;
+}
+
+/* Moves one batch from the clients, then one batch from each flow that has replies */
+void xps_udp_proxy_handler(xps_udp_proxy_t *proxy) {
+  assert(proxy != NULL);
+
+  if (proxy->ready)
+    udp_proxy_read(proxy);
+
+  // Flows that fill a whole batch are queued again behind the ones taken here
+  int n_ready = proxy->ready_flows.length;
+  for (int i = 0; i < n_ready; i++) {
+    xps_udp_flow_t *flow = proxy->ready_flows.data[i];
+    if (flow == NULL)
+      continue;
+    proxy->ready_flows.data[i] = NULL;
+    flow->ready = false;
+    udp_flow_read(flow);
+  }
+  vec_splice(&(proxy->ready_flows), 0, n_ready);
+}
+
+void udp_proxy_read_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_udp_proxy_t *proxy = ptr;
+
+  proxy->ready = true;
+}
+
+void udp_proxy_read(xps_udp_proxy_t *proxy) {
+  udp_proxy_batch_reset(proxy);
+
+  int n = recvmmsg(proxy->sock_fd, proxy->msgs, DEFAULT_UDP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+  if (n < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      logger(LOG_ERROR, "udp_proxy_read()", "recvmmsg() failed");
+      perror("Error message");
+    }
+    proxy->ready = false;
+    return;
+  }
+
+  // A short batch means the socket is drained; the next datagram brings a new event
+  if (n < DEFAULT_UDP_BATCH_SIZE)
+    proxy->ready = false;
+
+  // Consecutive datagrams of one flow go out with one sendmmsg()
+  xps_udp_flow_t *run_flow = NULL;
+  int run_start = 0;
+  for (int i = 0; i <= n; i++) {
+    xps_udp_flow_t *flow = NULL;
+
+    if (i < n) {
+      struct mmsghdr *msg = &(proxy->msgs[i]);
+      xps_metrics_set(proxy->core, M_TRAFFIC_RECV_BYTES, msg->msg_len);
+
+      if (msg->msg_hdr.msg_flags & MSG_TRUNC)
+        xps_metrics_set(proxy->core, M_UDP_DROP_DGRAMS, 1);
+      else
+        flow = udp_flow_get(proxy, &(proxy->addrs[i]));
+
+      // The flow's socket is connected, so no address goes with the send
+      msg->msg_hdr.msg_name = NULL;
+      msg->msg_hdr.msg_namelen = 0;
+      proxy->iovs[i].iov_len = msg->msg_len;
+    }
+
+    if (i == n || flow != run_flow) {
+      if (run_flow)
+        udp_flow_send(run_flow, &(proxy->msgs[run_start]), i - run_start);
+      run_flow = flow;
+      run_start = i;
+    }
+  }
+}
+
+void udp_proxy_batch_reset(xps_udp_proxy_t *proxy) {
+  for (int i = 0; i < DEFAULT_UDP_BATCH_SIZE; i++) {
+    proxy->iovs[i].iov_base = proxy->bufs + (size_t)i * DEFAULT_UDP_DGRAM_SIZE;
+    proxy->iovs[i].iov_len = DEFAULT_UDP_DGRAM_SIZE;
+
+    struct msghdr *hdr = &(proxy->msgs[i].msg_hdr);
+    memset(hdr, 0, sizeof(struct msghdr));
+    hdr->msg_name = &(proxy->addrs[i]);
+    hdr->msg_namelen = sizeof(struct sockaddr_in);
+    hdr->msg_iov = &(proxy->iovs[i]);
+    hdr->msg_iovlen = 1;
+  }
+}
+
+u_int udp_proxy_hash(struct sockaddr_in *addr) {
+  u_long key = ((u_long)addr->sin_addr.s_addr << 16) | addr->sin_port;
+
+  return hash_bytes(&key, sizeof(key), 0) % DEFAULT_UDP_MAX_FLOWS;
+}
+
+/* Flow of the client, created on its first datagram; NULL if the datagram must be dropped */
+xps_udp_flow_t *udp_flow_get(xps_udp_proxy_t *proxy, struct sockaddr_in *client_addr) {
+  for (xps_udp_flow_t *flow = proxy->flows[udp_proxy_hash(client_addr)]; flow != NULL;
+       flow = flow->next) {
+    if (flow->client_addr.sin_addr.s_addr == client_addr->sin_addr.s_addr &&
+        flow->client_addr.sin_port == client_addr->sin_port)
+      return flow;
+  }
+
+  xps_udp_flow_t *flow = udp_flow_create(proxy, client_addr);
+  if (flow == NULL)
+    xps_metrics_set(proxy->core, M_UDP_DROP_DGRAMS, 1);
+
+  return flow;
+}
+
+xps_udp_flow_t *udp_flow_create(xps_udp_proxy_t *proxy, struct sockaddr_in *client_addr) {
+  xps_core_t *core = proxy->core;
+  xps_config_route_t *route = proxy->route;
+
+  struct in6_addr addr;
+  addr_from_ipv4(&(client_addr->sin_addr), &addr);
+  char client_ip[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &(client_addr->sin_addr), client_ip, sizeof(client_ip));
+
+  if (!xps_config_ip_allowed(route, &addr)) {
+    logger(LOG_DEBUG, "udp_flow_create()", "client ip %s is not allowed", client_ip);
+    return NULL;
+  }
+
+  if (proxy->n_flows >= DEFAULT_UDP_MAX_FLOWS || route->upstreams.length == 0) {
+    logger(LOG_ERROR, "udp_flow_create()", "no flow for %s, %u flows open", client_ip,
+           proxy->n_flows);
+    return NULL;
+  }
+
+  // ip_hash keys on the client address, as there is no request
+  int index = xps_config_balance(route, NULL, core, &addr);
+  const char *upstream_name = route->upstreams.data[index];
+
+  char host[128];
+  u_int port = 0;
+  sscanf(upstream_name, "%127[^:]:%u", host, &port);
+
+  struct sockaddr_in upstream_addr;
+  int lookup_error = xps_dns_cache_lookup(core->dns_cache, host, port, &upstream_addr);
+  if (lookup_error != OK) {
+    logger(LOG_ERROR, "udp_flow_create()", "no resolved address for %s%s", upstream_name,
+           lookup_error == E_AGAIN ? " yet" : "");
+    return NULL;
+  }
+
+  int sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  if (sock_fd < 0) {
+    logger(LOG_ERROR, "udp_flow_create()", "socket() failed");
+    perror("Error message");
+    return NULL;
+  }
+
+  // Connected, so the kernel only passes on datagrams from the upstream
+  if (connect(sock_fd, (struct sockaddr *)&upstream_addr, sizeof(upstream_addr)) < 0) {
+    logger(LOG_ERROR, "udp_flow_create()", "connect() failed");
+    perror("Error message");
+    close(sock_fd);
+    return NULL;
+  }
+
+  xps_udp_flow_t *flow = malloc(sizeof(xps_udp_flow_t));
+  if (flow == NULL) {
+    logger(LOG_ERROR, "udp_flow_create()", "malloc() failed for 'flow'");
+    close(sock_fd);
+    return NULL;
+  }
+
+  flow->timer = xps_timer_create(core, route->idle_timeout_msec, flow, udp_flow_timer_handler);
+  if (flow->timer == NULL) {
+    logger(LOG_ERROR, "udp_flow_create()", "xps_timer_create() failed");
+    free(flow);
+    close(sock_fd);
+    return NULL;
+  }
+
+  // ICMP errors from the upstream come back as EPOLLERR, read_cb picks them up
+  if (xps_loop_attach(core->loop, sock_fd, EPOLLIN | EPOLLET, flow, udp_flow_read_handler, NULL,
+                      udp_flow_read_handler) != OK) {
+    logger(LOG_ERROR, "udp_flow_create()", "xps_loop_attach() failed");
+    xps_timer_destroy(flow->timer);
+    free(flow);
+    close(sock_fd);
+    return NULL;
+  }
+
+  // Init values
+  flow->proxy = proxy;
+  flow->client_addr = *client_addr;
+  flow->sock_fd = sock_fd;
+  flow->upstream_health =
+    route->_upstream_health.length > 0 ? route->_upstream_health.data[index] : NULL;
+  flow->upstream_up = false;
+  flow->ready = false;
+
+  u_int hash = udp_proxy_hash(client_addr);
+  flow->next = proxy->flows[hash];
+  proxy->flows[hash] = flow;
+  proxy->n_flows++;
+
+  if (flow->upstream_health)
+    xps_health_conn_start(flow->upstream_health);
+  xps_metrics_set(core, M_UDP_FLOW_CREATE, 1);
+
+  logger(LOG_DEBUG, "udp_flow_create()", "created udp flow from %s to %s", client_ip,
+         upstream_name);
+
+  return flow;
+}
+
+void udp_flow_destroy(xps_udp_flow_t *flow) {
+  assert(flow != NULL);
+
+  xps_udp_proxy_t *proxy = flow->proxy;
+
+  xps_udp_flow_t **link = &(proxy->flows[udp_proxy_hash(&(flow->client_addr))]);
+  while (*link != flow)
+    link = &((*link)->next);
+  *link = flow->next;
+  proxy->n_flows--;
+
+  if (flow->ready) {
+    for (int i = 0; i < proxy->ready_flows.length; i++) {
+      if (proxy->ready_flows.data[i] == flow) {
+        proxy->ready_flows.data[i] = NULL;
+        break;
+      }
+    }
+  }
+
+  if (flow->upstream_health)
+    xps_health_conn_end(flow->upstream_health);
+
+  xps_loop_detach(proxy->core->loop, flow->sock_fd);
+  close(flow->sock_fd);
+  xps_timer_destroy(flow->timer);
+  xps_metrics_set(proxy->core, M_UDP_FLOW_DESTROY, 1);
+
+  free(flow);
+
+  logger(LOG_DEBUG, "udp_flow_destroy()", "destroyed udp flow");
+}
+
+void udp_flow_read_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  udp_flow_set_ready(ptr);
+}
+
+void udp_flow_timer_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  logger(LOG_DEBUG, "udp_flow_timer_handler()", "udp flow idle timeout");
+  udp_flow_destroy(ptr);
+}
+
+void udp_flow_set_ready(xps_udp_flow_t *flow) {
+  if (flow->ready)
+    return;
+
+  flow->ready = true;
+  vec_push(&(flow->proxy->ready_flows), flow);
+}
+
+/* Moves one batch of replies from the upstream to the client */
+void udp_flow_read(xps_udp_flow_t *flow) {
+  xps_udp_proxy_t *proxy = flow->proxy;
+
+  udp_proxy_batch_reset(proxy);
+
+  int n = recvmmsg(flow->sock_fd, proxy->msgs, DEFAULT_UDP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+  if (n < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      udp_flow_fail(flow, "recvmmsg()");
+    return;
+  }
+
+  if (n == DEFAULT_UDP_BATCH_SIZE)
+    udp_flow_set_ready(flow);
+
+  if (!flow->upstream_up && flow->upstream_health)
+    xps_health_report(flow->upstream_health, true, proxy->core->curr_time_msec);
+  flow->upstream_up = true;
+
+  // Truncated datagrams are dropped, the rest are addressed to the client
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    struct mmsghdr *msg = &(proxy->msgs[i]);
+    xps_metrics_set(proxy->core, M_TRAFFIC_RECV_BYTES, msg->msg_len);
+
+    if (msg->msg_hdr.msg_flags & MSG_TRUNC) {
+      xps_metrics_set(proxy->core, M_UDP_DROP_DGRAMS, 1);
+      continue;
+    }
+
+    proxy->iovs[i].iov_len = msg->msg_len;
+    msg->msg_hdr.msg_name = &(flow->client_addr);
+    msg->msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    if (m != i)
+      proxy->msgs[m] = *msg;
+    m++;
+  }
+
+  if (m == 0)
+    return;
+
+  int sent = sendmmsg(proxy->sock_fd, proxy->msgs, m, MSG_DONTWAIT);
+  if (sent < 0) {
+    logger(LOG_DEBUG, "udp_flow_read()", "sendmmsg() to client failed");
+    sent = 0;
+  }
+
+  for (int i = 0; i < sent; i++)
+    xps_metrics_set(proxy->core, M_TRAFFIC_SEND_BYTES, proxy->msgs[i].msg_len);
+  xps_metrics_set(proxy->core, M_UDP_TO_CLIENT_DGRAMS, sent);
+  if (sent < m)
+    xps_metrics_set(proxy->core, M_UDP_DROP_DGRAMS, m - sent);
+
+  xps_timer_update(flow->timer, proxy->route->idle_timeout_msec);
+}
+
+/* Sends n datagrams of the client to the upstream; ones the socket can't take are dropped */
+void udp_flow_send(xps_udp_flow_t *flow, struct mmsghdr *msgs, int n) {
+  xps_udp_proxy_t *proxy = flow->proxy;
+
+  int sent = sendmmsg(flow->sock_fd, msgs, n, MSG_DONTWAIT);
+  if (sent < 0) {
+    xps_metrics_set(proxy->core, M_UDP_DROP_DGRAMS, n);
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+      udp_flow_fail(flow, "sendmmsg()");
+    return;
+  }
+
+  for (int i = 0; i < sent; i++)
+    xps_metrics_set(proxy->core, M_TRAFFIC_SEND_BYTES, msgs[i].msg_len);
+  xps_metrics_set(proxy->core, M_UDP_TO_UPSTREAM_DGRAMS, sent);
+  if (sent < n)
+    xps_metrics_set(proxy->core, M_UDP_DROP_DGRAMS, n - sent);
+
+  xps_timer_update(flow->timer, proxy->route->idle_timeout_msec);
+}
+
+/* The upstream refused the flow (ICMP unreachable) or its socket broke */
+void udp_flow_fail(xps_udp_flow_t *flow, const char *func) {
+  logger(LOG_ERROR, "udp_flow_fail()", "%s failed: %s", func, strerror(errno));
+
+  if (flow->upstream_health)
+    xps_health_report(flow->upstream_health, false, flow->proxy->core->curr_time_msec);
+
+  xps_metrics_set(flow->proxy->core, M_CONN_ERROR, 1);
+  udp_flow_destroy(flow);
+}
@@ -0,0 +1,48 @@
+#ifndef XPS_UDP_PROXY_H
+#define XPS_UDP_PROXY_H
+
+#include "../xps.h"
+
+/*
+ * A udp_proxy listener on one core. Every core binds its own socket with
+ * SO_REUSEPORT, so the kernel keeps each client on one core and the flow
+ * table is never shared. Datagrams are moved in batches with recvmmsg() and
+ * sendmmsg(), through buffers the proxy owns.
+ */
+struct xps_udp_proxy_s {
+  xps_core_t *core;
+  xps_config_route_t *route;
+  const char *host;
+  u_int port;
+  u_int sock_fd;
+  bool ready; // client datagrams may be waiting
+
+  xps_udp_flow_t **flows; // hash table of DEFAULT_UDP_MAX_FLOWS chains, by client address
+  u_int n_flows;
+  vec_void_t ready_flows; // flows with upstream datagrams waiting, NULL once destroyed
+
+  struct mmsghdr msgs[DEFAULT_UDP_BATCH_SIZE];
+  struct iovec iovs[DEFAULT_UDP_BATCH_SIZE];
+  struct sockaddr_in addrs[DEFAULT_UDP_BATCH_SIZE];
+  u_char *bufs; // DEFAULT_UDP_BATCH_SIZE datagrams of DEFAULT_UDP_DGRAM_SIZE
+};
+
+/* One client address, with a socket connected to its upstream so replies find their way back */
+struct xps_udp_flow_s {
+  xps_udp_proxy_t *proxy;
+  struct sockaddr_in client_addr;
+  u_int sock_fd;
+  xps_health_entry_t *upstream_health;
+  bool upstream_up; // a reply came from the upstream
+  bool ready;       // in proxy->ready_flows
+  xps_timer_t *timer;
+  xps_udp_flow_t *next; // in the same hash chain
+};
+
+xps_udp_proxy_t *xps_udp_proxy_create(xps_core_t *core, const char *host, u_int port,
+                                      xps_config_route_t *route);
+void xps_udp_proxy_destroy(xps_udp_proxy_t *proxy);
+bool xps_udp_proxy_is_ready(xps_udp_proxy_t *proxy);
+void xps_udp_proxy_handler(xps_udp_proxy_t *proxy);
+
+#endif
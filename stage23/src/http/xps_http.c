@@ -329,15 +329,24 @@ int xps_http_parse_header_line(xps_http_req_t *http_req, xps_buffer_t *buff) {
   assert(buff != NULL);
 
   u_char *p_ch = buff->pos;
+  u_char *end = buff->data + buff->len;
   xps_http_parser_state_t parser_state = http_req->parser_state;
 
-  for (int i = 0; i < buff->len; p_ch++, i++) {
+  for (; p_ch < end; p_ch++) {
     char ch = *p_ch;
 
     switch (parser_state) {
     case H_START: {
       char c = ch | 0x20; /* convert to lower case for easy checking */
-      if (c >= 'a' && c <= 'z') {
+      if (ch == CR) { // request without any headers
+        http_req->headers_end = p_ch;
+        parser_state = H_LF_CR;
+      } else if (ch == LF) {
+        http_req->headers_end = p_ch;
+        buff->pos = p_ch + 1;
+        http_req->parser_state = H_START;
+        return OK;
+      } else if (c >= 'a' && c <= 'z') {
         http_req->header_key_start = p_ch;
         parser_state = H_NAME;
       } else
@@ -398,9 +407,14 @@ int xps_http_parse_header_line(xps_http_req_t *http_req, xps_buffer_t *buff) {
       break;
 
     case H_LF:
+      /*a CR or LF right after a header line starts the empty line ending the header section*/
       if (ch == LF) {
-        parser_state = H_LF_LF;
+        http_req->headers_end = p_ch;
+        buff->pos = p_ch + 1;
+        http_req->parser_state = H_START;
+        return OK; // HTTP complete header section done
       } else if (ch == CR) {
+        http_req->headers_end = p_ch;
         parser_state = H_LF_CR;
       } else {
         buff->pos = p_ch;
@@ -409,14 +423,9 @@ int xps_http_parse_header_line(xps_http_req_t *http_req, xps_buffer_t *buff) {
       }
       break;
 
-    case H_LF_LF:
-      buff->pos = p_ch;
-      http_req->parser_state = H_START;
-      return OK; // HTTP complete header section done
-
     case H_LF_CR:
       if (ch == LF) {
-        buff->pos = p_ch;
+        buff->pos = p_ch + 1;
         http_req->parser_state = H_START;
         return OK; // HTTP complete header section done
       } else {
@@ -432,6 +441,53 @@ int xps_http_parse_header_line(xps_http_req_t *http_req, xps_buffer_t *buff) {
   return E_AGAIN;
 }
 
+/*
+ * Perfect hash table for well-known header names.
+ * Slot = (len + tolower(first char)) & 31, which is collision free for the names below.
+ * When adding a name make sure its slot is still unused, otherwise pick a new hash.
+ */
+#define HTTP_HEADER_HASH(len, first) (((len) + ((first) | 0x20)) & 31)
+
+typedef struct {
+  const char *name;
+  size_t len;
+  xps_http_header_id_t id;
+} http_header_slot_t;
+
+const http_header_slot_t http_header_slots[32] = {
+  [5] = {"Transfer-Encoding", 17, HTTP_H_TRANSFER_ENCODING},
+  [7] = {"X-Forwarded-For", 15, HTTP_H_X_FORWARDED_FOR},
+  [9] = {"Cookie", 6, HTTP_H_COOKIE},
+  [11] = {"Expect", 6, HTTP_H_EXPECT},
+  [12] = {"Host", 4, HTTP_H_HOST},
+  [13] = {"Connection", 10, HTTP_H_CONNECTION},
+  [15] = {"Content-Type", 12, HTTP_H_CONTENT_TYPE},
+  [16] = {"Accept-Encoding", 15, HTTP_H_ACCEPT_ENCODING},
+  [17] = {"Content-Length", 14, HTTP_H_CONTENT_LENGTH},
+  [21] = {"Keep-Alive", 10, HTTP_H_KEEP_ALIVE},
+  [22] = {"If-None-Match", 13, HTTP_H_IF_NONE_MATCH},
+  [23] = {"Range", 5, HTTP_H_RANGE},
+  [26] = {"If-Modified-Since", 17, HTTP_H_IF_MODIFIED_SINCE},
+  [28] = {"Upgrade", 7, HTTP_H_UPGRADE},
+  [31] = {"User-Agent", 10, HTTP_H_USER_AGENT},
+};
+
+xps_http_header_id_t xps_http_header_id(const u_char *key, size_t len) {
+  assert(key != NULL);
+
+  if (len == 0)
+    return HTTP_H_UNKNOWN;
+
+  const http_header_slot_t *slot = &http_header_slots[HTTP_HEADER_HASH(len, key[0])];
+  if (slot->name == NULL || slot->len != len)
+    return HTTP_H_UNKNOWN;
+
+  if (strncasecmp((const char *)key, slot->name, len) != 0)
+    return HTTP_H_UNKNOWN;
+
+  return slot->id;
+}
+
 const char *xps_http_get_header(vec_void_t *headers, const char *key) {
 
   assert(headers != NULL);
@@ -445,39 +501,6 @@ const char *xps_http_get_header(vec_void_t *headers, const char *key) {
   return NULL;
 }
 
-xps_buffer_t *xps_http_serialize_headers(vec_void_t *headers) {
-  assert(headers != NULL);
-  /*create a buffer and initialize first byte to null terminator*/
-  xps_buffer_t *buff = xps_buffer_create(512, 0, NULL);
-  if (buff == NULL) {
-    logger(LOG_ERROR, "xps_http_serialize_headers()",
-           "xps_buffer_create() failed");
-    return NULL;
-  }
-  buff->data[0] = '\0';
-  for (int i = 0; i < headers->length; i++) {
-    xps_keyval_t *header = headers->data[i];
-    size_t header_str_len = strlen(header->key) + strlen(header->val) + 5;
-    char header_str[header_str_len];
-    sprintf(header_str, "%s: %s\r\n", header->key, header->val);
-    if ((buff->size - buff->len) < header_str_len) { // buffer is small
-      u_char *new_data = realloc(buff->data, buff->size * 2);
-      if (new_data == NULL) {
-        xps_buffer_destroy(buff);
-        logger(LOG_ERROR, "xps_http_serlize_headers()", "realloc() failed");
-        return NULL;
-      }
-
-      /*updata buff->data and buff->size*/
-      buff->data = new_data;
-      buff->size *= 2;
-    }
-    strcat(buff->data, header_str);
-    buff->len = strlen(buff->data);
-  }
-  return buff;
-}
-
 int xps_http_set_header(vec_void_t *headers, const char *key, const char *val) {
   assert(headers != NULL);
   assert(key != NULL);
@@ -510,4 +533,38 @@ int xps_http_set_header(vec_void_t *headers, const char *key, const char *val) {
   vec_push(headers, header);
 
   return OK;
-}
\ No newline at end of file
+}
+
+/* Case-insensitive search for a comma separated token, e.g. "close" in a Connection value */
+bool xps_http_has_token(const char *val, size_t len, const char *token) {
+  assert(val != NULL);
+  assert(token != NULL);
+
+  size_t token_len = strlen(token);
+  size_t i = 0;
+  while (i < len) {
+    while (i < len && (val[i] == ' ' || val[i] == '\t' || val[i] == ','))
+      i++;
+    size_t start = i;
+    while (i < len && val[i] != ',')
+      i++;
+    size_t end = i;
+    while (end > start && (val[end - 1] == ' ' || val[end - 1] == '\t'))
+      end--;
+    if (end - start == token_len && strncasecmp(val + start, token, token_len) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+/* True if chunked is the final transfer coding of a Transfer-Encoding value */
+bool xps_http_is_chunked(const char *val, size_t len) {
+  assert(val != NULL);
+
+  while (len > 0 && (val[len - 1] == ' ' || val[len - 1] == '\t'))
+    len--;
+
+  return len >= 7 && strncasecmp(val + len - 7, "chunked", 7) == 0 &&
+         (len == 7 || val[len - 8] == ',' || val[len - 8] == ' ' || val[len - 8] == '\t');
+}
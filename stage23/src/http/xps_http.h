@@ -18,8 +18,12 @@ typedef enum {
 } xps_http_method_t;
 
 typedef enum {
+  HTTP_CONTINUE = 100,
+  HTTP_SWITCHING_PROTOCOLS = 101,
+
   HTTP_OK = 200,
   HTTP_CREATED = 201,
+  HTTP_NO_CONTENT = 204,
 
   HTTP_MOVED_PERMANENTLY = 301,
   HTTP_MOVED_TEMPORARILY = 302,
@@ -83,16 +87,38 @@ typedef enum {
   H_CR,
   H_LF,
   H_LF_CR,
-  H_LF_LF,
   H_LF_CR_LF,
 
 } xps_http_parser_state_t;
 
+/* Well-known header names, classified at parse time (see xps_http_header_id()) */
+typedef enum {
+  HTTP_H_UNKNOWN = -1,
+  HTTP_H_HOST = 0,
+  HTTP_H_CONNECTION,
+  HTTP_H_CONTENT_LENGTH,
+  HTTP_H_CONTENT_TYPE,
+  HTTP_H_TRANSFER_ENCODING,
+  HTTP_H_ACCEPT_ENCODING,
+  HTTP_H_RANGE,
+  HTTP_H_IF_NONE_MATCH,
+  HTTP_H_IF_MODIFIED_SINCE,
+  HTTP_H_USER_AGENT,
+  HTTP_H_X_FORWARDED_FOR,
+  HTTP_H_COOKIE,
+  HTTP_H_EXPECT,
+  HTTP_H_KEEP_ALIVE,
+  HTTP_H_UPGRADE,
+  HTTP_H_N // number of well-known headers
+} xps_http_header_id_t;
+
 int xps_http_parse_request_line(xps_http_req_t *http_req, xps_buffer_t *buffer);
 int xps_http_parse_header_line(xps_http_req_t *http_req, xps_buffer_t *buffer);
 
+xps_http_header_id_t xps_http_header_id(const u_char *key, size_t len);
+bool xps_http_has_token(const char *val, size_t len, const char *token);
+bool xps_http_is_chunked(const char *val, size_t len);
 const char *xps_http_get_header(vec_void_t *headers, const char *key);
-xps_buffer_t *xps_http_serialize_headers(vec_void_t *headers);
 int xps_http_set_header(vec_void_t *headers, const char *key, const char *val);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,194 @@
+#include "../xps.h"
+
+int http_body_parse_chunked(xps_http_body_t *body, const u_char *data, size_t len,
+                            size_t *consumed);
+void http_body_chunk_size_done(xps_http_body_t *body);
+int http_hex_value(u_char ch);
+
+xps_http_body_t *xps_http_body_create(xps_http_body_type_t type, size_t len) {
+
+  xps_http_body_t *body = malloc(sizeof(xps_http_body_t));
+  if (body == NULL) {
+    logger(LOG_ERROR, "xps_http_body_create()", "malloc() failed for 'body'");
+    return NULL;
+  }
+
+  body->type = type;
+  body->chunk_state = CH_SIZE;
+  body->remaining = type == HTTP_BODY_LENGTH ? len : 0;
+  body->chunk_size = 0;
+  body->size_digits = 0;
+  body->framed_len = 0;
+  body->done = type == HTTP_BODY_NONE || (type == HTTP_BODY_LENGTH && len == 0);
+
+  return body;
+}
+
+void xps_http_body_destroy(xps_http_body_t *body) {
+  assert(body != NULL);
+
+  free(body);
+}
+
+/*
+ * Consumes the part of data that belongs to the body. *consumed is set to the
+ * number of bytes taken, anything after it belongs to the next message.
+ * Returns OK once the body is complete, E_AGAIN if more bytes are expected and
+ * E_FAIL on malformed chunked framing.
+ */
+int xps_http_body_parse(xps_http_body_t *body, const u_char *data, size_t len, size_t *consumed) {
+  assert(body != NULL);
+  assert(consumed != NULL);
+
+  *consumed = 0;
+
+  if (body->done)
+    return OK;
+
+  int error = OK;
+  switch (body->type) {
+    case HTTP_BODY_LENGTH: {
+      size_t n = len < body->remaining ? len : body->remaining;
+      body->remaining -= n;
+      *consumed = n;
+      error = body->remaining == 0 ? OK : E_AGAIN;
+      break;
+    }
+    case HTTP_BODY_CHUNKED:
+      error = http_body_parse_chunked(body, data, len, consumed);
+      break;
+    case HTTP_BODY_CLOSE:
+      *consumed = len;
+      error = E_AGAIN;
+      break;
+    default:
+      break;
+  }
+
+  body->framed_len += *consumed;
+  if (error == OK)
+    body->done = true;
+
+  return error;
+}
+
+int http_body_parse_chunked(xps_http_body_t *body, const u_char *data, size_t len,
+                            size_t *consumed) {
+  assert(body != NULL);
+  assert(data != NULL || len == 0);
+
+  const u_char *p_ch = data;
+  const u_char *end = data + len;
+
+  while (p_ch < end) {
+    u_char ch = *p_ch;
+
+    switch (body->chunk_state) {
+      case CH_SIZE: {
+        int val = http_hex_value(ch);
+        if (val >= 0) {
+          // 15 hex digits keep the size well inside size_t
+          if (++body->size_digits > 15)
+            return E_FAIL;
+          body->chunk_size = body->chunk_size * 16 + val;
+          break;
+        }
+        if (body->size_digits == 0)
+          return E_FAIL;
+        if (ch == ';' || ch == ' ' || ch == '\t')
+          body->chunk_state = CH_SIZE_EXT;
+        else if (ch == CR)
+          body->chunk_state = CH_SIZE_LF;
+        else if (ch == LF)
+          http_body_chunk_size_done(body);
+        else
+          return E_FAIL;
+        break;
+      }
+
+      case CH_SIZE_EXT:
+        if (ch == CR)
+          body->chunk_state = CH_SIZE_LF;
+        else if (ch == LF)
+          http_body_chunk_size_done(body);
+        break;
+
+      case CH_SIZE_LF:
+        if (ch != LF)
+          return E_FAIL;
+        http_body_chunk_size_done(body);
+        break;
+
+      case CH_DATA: {
+        // Skip over chunk data in one step
+        size_t avail = end - p_ch;
+        size_t n = avail < body->remaining ? avail : body->remaining;
+        body->remaining -= n;
+        p_ch += n;
+        if (body->remaining == 0)
+          body->chunk_state = CH_DATA_CR;
+        continue;
+      }
+
+      case CH_DATA_CR:
+        if (ch == CR)
+          body->chunk_state = CH_DATA_LF;
+        else if (ch == LF)
+          body->chunk_state = CH_SIZE;
+        else
+          return E_FAIL;
+        break;
+
+      case CH_DATA_LF:
+        if (ch != LF)
+          return E_FAIL;
+        body->chunk_state = CH_SIZE;
+        break;
+
+      case CH_TRAILER_START:
+        if (ch == CR)
+          body->chunk_state = CH_FINAL_LF;
+        else if (ch == LF) {
+          *consumed = p_ch + 1 - data;
+          return OK;
+        } else
+          body->chunk_state = CH_TRAILER;
+        break;
+
+      case CH_TRAILER:
+        if (ch == LF)
+          body->chunk_state = CH_TRAILER_START;
+        break;
+
+      case CH_FINAL_LF:
+        if (ch != LF)
+          return E_FAIL;
+        *consumed = p_ch + 1 - data;
+        return OK;
+    }
+
+    p_ch++;
+  }
+
+  *consumed = len;
+  return E_AGAIN;
+}
+
+void http_body_chunk_size_done(xps_http_body_t *body) {
+  assert(body != NULL);
+
+  // A zero sized chunk is the last one, only trailers follow
+  body->remaining = body->chunk_size;
+  body->chunk_state = body->chunk_size == 0 ? CH_TRAILER_START : CH_DATA;
+  body->chunk_size = 0;
+  body->size_digits = 0;
+}
+
+int http_hex_value(u_char ch) {
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  ch |= 0x20;
+  if (ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  return -1;
+}
@@ -0,0 +1,40 @@
+#ifndef XPS_HTTP_BODY_H
+#define XPS_HTTP_BODY_H
+
+#include "../xps.h"
+
+typedef enum {
+  HTTP_BODY_NONE,    // no body follows the headers
+  HTTP_BODY_LENGTH,  // delimited by Content-Length
+  HTTP_BODY_CHUNKED, // Transfer-Encoding: chunked
+  HTTP_BODY_CLOSE,   // runs until the connection closes (tunnels, unframed responses)
+} xps_http_body_type_t;
+
+typedef enum {
+  CH_SIZE = 0,
+  CH_SIZE_EXT,
+  CH_SIZE_LF,
+  CH_DATA,
+  CH_DATA_CR,
+  CH_DATA_LF,
+  CH_TRAILER_START,
+  CH_TRAILER,
+  CH_FINAL_LF,
+} xps_http_chunk_state_t;
+
+/* Tracks where a message body ends without altering its bytes */
+struct xps_http_body_s {
+  xps_http_body_type_t type;
+  xps_http_chunk_state_t chunk_state;
+  size_t remaining;   // bytes left in the body (LENGTH) or current chunk (CHUNKED)
+  size_t chunk_size;  // chunk size being parsed
+  size_t size_digits; // hex digits seen in the current chunk size line
+  size_t framed_len;  // body bytes consumed so far, framing included
+  bool done;
+};
+
+xps_http_body_t *xps_http_body_create(xps_http_body_type_t type, size_t len);
+void xps_http_body_destroy(xps_http_body_t *body);
+int xps_http_body_parse(xps_http_body_t *body, const u_char *data, size_t len, size_t *consumed);
+
+#endif
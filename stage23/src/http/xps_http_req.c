@@ -2,6 +2,8 @@
 
 int http_process_request_line(xps_http_req_t *http_req, xps_buffer_t *buff);
 xps_keyval_t *http_header_create(xps_http_req_t *http_req);
+int http_req_framing(xps_http_req_t *http_req);
+xps_http_body_type_t http_req_body_type(xps_http_req_t *http_req);
 
 xps_keyval_t *http_header_create(xps_http_req_t *http_req) {
   char *key =
@@ -97,6 +99,8 @@ int http_process_headers(xps_http_req_t *http_req, xps_buffer_t *buff) {
     error = xps_http_parse_header_line(http_req, buff);
     if (error == E_FAIL || error == E_AGAIN)
       break;
+    if (error == OK && http_req->header_key_start == NULL)
+      return OK; // request has no header fields
     if (error == OK || error == E_NEXT) {
       /* Alloc memory for new header*/
       /*assign key,val from their corresponding start and end pointers*/
@@ -110,6 +114,12 @@ int http_process_headers(xps_http_req_t *http_req, xps_buffer_t *buff) {
       /*push this header into headers list of http_req*/
       vec_push(&(http_req->headers), header);
 
+      /*remember first occurrence of well-known headers for O(1) lookups*/
+      xps_http_header_id_t id = xps_http_header_id(
+          http_req->header_key_start, http_req->header_key_end - http_req->header_key_start);
+      if (id != HTTP_H_UNKNOWN && http_req->known_headers[id] == NULL)
+        http_req->known_headers[id] = header->val;
+
       if (error == E_NEXT)
         continue;
     }
@@ -135,46 +145,6 @@ int http_process_headers(xps_http_req_t *http_req, xps_buffer_t *buff) {
   return error;
 }
 
-xps_buffer_t *xps_http_req_serialize(xps_http_req_t *http_req) {
-  assert(http_req != NULL);
-
-  /* Serialize headers into a buffer headers_str*/
-  xps_buffer_t *headers_str = xps_http_serialize_headers(&(http_req->headers));
-
-  if (headers_str == NULL) {
-    logger(LOG_ERROR, "xps_http_req_serialize()",
-           "xps_http_serialize_header() failed");
-    return NULL;
-  }
-
-  size_t final_len = strlen(http_req->request_line) + 1 + headers_str->len +
-                     1; // Calculate length for final buffer
-  /*Create instance for final buffer*/
-  xps_buffer_t *buff = xps_buffer_create(final_len, final_len, NULL);
-
-  if (buff == NULL) {
-    logger(LOG_ERROR, "xps_http_req_serialize()", "xps_buffer_create() failed");
-    return NULL;
-  }
-
-  // Copy everything to final buffer
-  memcpy(buff->pos, http_req->request_line, strlen(http_req->request_line));
-  buff->pos += strlen(http_req->request_line);
-  /*similarly copy "\n", headers_str, "\n"*/
-  memcpy(buff->pos, "\n", 1);
-  buff->pos += 1;
-  memcpy(buff->pos, headers_str->data, headers_str->len);
-  buff->pos += headers_str->len;
-  memcpy(buff->pos, "\n", 1);
-  buff->pos += 1;
-
-  logger(LOG_DEBUG, "xps_http_req_serialize()",
-         "http request serialized successfully");
-  /*destroy headers_str buffer*/
-  xps_buffer_destroy(headers_str);
-  return buff;
-}
-
 xps_http_req_t *xps_http_req_create(xps_core_t *core, xps_buffer_t *buff,
                                     int *error) {
   /*assert*/
@@ -218,20 +188,22 @@ xps_http_req_t *xps_http_req_create(xps_core_t *core, xps_buffer_t *buff,
   }
   // Header length
   http_req->header_len = (size_t)(buff->pos - buff->data);
+  http_req->header_fields_len = (size_t)(http_req->headers_end - buff->data);
+  xps_metrics_set(core, M_REQ_CREATE, 1);
+
   // Body length is retrieved from header Content-Length
   http_req->body_len = 0;
-  const char *body_len_str = xps_http_get_header(
-      &(http_req->headers),
-      "Content-Length"); /*get header value for key Content-Length*/
-  /*assign body_len*/
-  if (body_len_str != NULL)
-    http_req->body_len = atoi(body_len_str);
+  if (http_req_framing(http_req) == E_FAIL) {
+    logger(LOG_ERROR, "xps_http_req_create()", "http_req_framing() failed");
+    xps_http_req_destroy(core, http_req);
+    *error = E_FAIL;
+    return NULL;
+  }
+  http_req->body_type = http_req_body_type(http_req);
   *error = OK;
 
   logger(LOG_DEBUG, "xps_http_req_create()", "http_req created succesffully");
 
-  xps_metrics_set(core, M_REQ_CREATE, 1);
-
   return http_req;
 }
 
@@ -263,4 +235,69 @@ void xps_http_req_destroy(xps_core_t *core, xps_http_req_t *http_req) {
   xps_metrics_set(core, M_REQ_DESTROY, 1);
 
   logger(LOG_DEBUG, "xps_http_req_destroy()", "destroyed http_req");
-}
\ No newline at end of file
+}
+
+/* Reads Content-Length and checks Transfer-Encoding. Anything an upstream could
+ * delimit differently from us (RFC 7230 section 3.3.3) is rejected */
+int http_req_framing(xps_http_req_t *http_req) {
+  assert(http_req != NULL);
+
+  bool has_length = false;
+  int n_transfer_encoding = 0;
+  for (int i = 0; i < http_req->headers.length; i++) {
+    xps_keyval_t *header = http_req->headers.data[i];
+    xps_http_header_id_t id = xps_http_header_id((const u_char *)header->key, strlen(header->key));
+    if (id == HTTP_H_TRANSFER_ENCODING)
+      n_transfer_encoding++;
+    if (id != HTTP_H_CONTENT_LENGTH)
+      continue;
+
+    // Digits only: strtoul() alone would take signs, spaces and trailing garbage
+    char *end;
+    errno = 0;
+    unsigned long len = strtoul(header->val, &end, 10);
+    if (header->val[0] < '0' || header->val[0] > '9' || *end != '\0' || errno == ERANGE) {
+      logger(LOG_ERROR, "http_req_framing()", "invalid Content-Length '%s'", header->val);
+      return E_FAIL;
+    }
+    if (has_length && len != http_req->body_len) {
+      logger(LOG_ERROR, "http_req_framing()", "conflicting Content-Length headers");
+      return E_FAIL;
+    }
+    // Repeated but equal values are allowed, the upstream still sees them all
+    if (has_length)
+      http_req->framing_ambiguous = true;
+    has_length = true;
+    http_req->body_len = len;
+  }
+
+  const char *te = http_req->known_headers[HTTP_H_TRANSFER_ENCODING];
+  if (te == NULL)
+    return OK;
+  if (n_transfer_encoding > 1 || !xps_http_is_chunked(te, strlen(te))) {
+    logger(LOG_ERROR, "http_req_framing()", "Transfer-Encoding must be one header ending in chunked");
+    return E_FAIL;
+  }
+  if (has_length) {
+    logger(LOG_ERROR, "http_req_framing()", "both Transfer-Encoding and Content-Length present");
+    return E_FAIL;
+  }
+
+  return OK;
+}
+
+/* Works out how the request body is delimited (RFC 7230 section 3.3.3) */
+xps_http_body_type_t http_req_body_type(xps_http_req_t *http_req) {
+  assert(http_req != NULL);
+
+  // Tunnels carry raw bytes until either side closes
+  if (http_req->method_n == HTTP_CONNECT || http_req->known_headers[HTTP_H_UPGRADE] != NULL)
+    return HTTP_BODY_CLOSE;
+
+  // Transfer-Encoding overrides Content-Length; chunked must be the final coding
+  const char *te = http_req->known_headers[HTTP_H_TRANSFER_ENCODING];
+  if (te != NULL && xps_http_is_chunked(te, strlen(te)))
+    return HTTP_BODY_CHUNKED;
+
+  return http_req->body_len > 0 ? HTTP_BODY_LENGTH : HTTP_BODY_NONE;
+}
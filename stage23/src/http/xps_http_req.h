@@ -45,18 +45,22 @@ struct xps_http_req_s {
   u_char *http_minor;
 
   vec_void_t headers;
+  const char *known_headers[HTTP_H_N]; // values of well-known headers, NULL if absent
 
   u_char *header_key_start;
   u_char *header_key_end;
   u_char *header_val_start;
   u_char *header_val_end;
+  u_char *headers_end; // start of the empty line terminating the header section
 
   size_t header_len;
+  size_t header_fields_len; // request line and header fields, without the ending empty line
   size_t body_len;
+  xps_http_body_type_t body_type;
+  bool framing_ambiguous; // Content-Length repeated, the upstream connection is not reused
 };
 
 xps_http_req_t *xps_http_req_create(xps_core_t *core, xps_buffer_t *buff, int *error);
 void xps_http_req_destroy(xps_core_t *core, xps_http_req_t *http_req);
-xps_buffer_t *xps_http_req_serialize(xps_http_req_t *http_req);
 
 #endif
\ No newline at end of file
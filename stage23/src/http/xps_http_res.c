@@ -1,12 +1,16 @@
 #include "xps_http_res.h"
 
-xps_http_res_t *xps_http_res_create(xps_core_t *core, u_int status_code) {
+#define HTTP_RES_FIXED_HEADERS                                                                   \
+  "Server: " SERVER_NAME "\r\n"                                                                  \
+  "Access-Control-Allow-Origin: *\r\n"
 
-  assert(core != NULL);
+xps_http_res_t *http_res_init(u_int status_code);
+
+xps_http_res_t *http_res_init(u_int status_code) {
 
   xps_http_res_t *http_res = malloc(sizeof(xps_http_res_t));
   if (http_res == NULL) {
-    logger(LOG_ERROR, "xps_http_res_create()",
+    logger(LOG_ERROR, "http_res_init()",
            "failed to alloc memory for http_res. malloc() returned NULL");
     return NULL;
   }
@@ -19,6 +23,9 @@ xps_http_res_t *xps_http_res_create(xps_core_t *core, u_int status_code) {
     case HTTP_CREATED:
       reason_phrase = "Created";
       break;
+    case HTTP_NO_CONTENT:
+      reason_phrase = "No Content";
+      break;
     case HTTP_MOVED_PERMANENTLY:
       reason_phrase = "Moved Permanently";
       break;
@@ -76,22 +83,13 @@ xps_http_res_t *xps_http_res_create(xps_core_t *core, u_int status_code) {
            reason_phrase);
 
   vec_init(&http_res->headers);
-
-  // Get current time
-  time_t now = time(0);
-  struct tm tm = *gmtime(&now);
-  char time_buf[128];
-  strftime(time_buf, sizeof time_buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
-
-  xps_http_set_header(&(http_res->headers), "Date", time_buf);
-  xps_http_set_header(&(http_res->headers), "Server", SERVER_NAME);
-  xps_http_set_header(&(http_res->headers), "Access-Control-Allow-Origin", "*");
-
+  http_res->date[0] = '\0';
   http_res->body = NULL;
 
-  
+  return http_res;
+}
 
-  // set metrics
+void xps_http_res_set_metrics(xps_core_t *core, u_int status_code) {
   int code_start = status_code / 100;
   if (code_start == 2)
     xps_metrics_set(core, M_RES_2XX, 1);
@@ -101,6 +99,22 @@ xps_http_res_t *xps_http_res_create(xps_core_t *core, u_int status_code) {
     xps_metrics_set(core, M_RES_4XX, 1);
   else if (code_start == 5)
     xps_metrics_set(core, M_RES_5XX, 1);
+}
+
+xps_http_res_t *xps_http_res_create(xps_core_t *core, u_int status_code) {
+
+  assert(core != NULL);
+
+  xps_http_res_t *http_res = http_res_init(status_code);
+  if (http_res == NULL) {
+    logger(LOG_ERROR, "xps_http_res_create()", "http_res_init() failed");
+    return NULL;
+  }
+
+  // Date comes from the per-core cache, Server and CORS headers are written by serializer
+  memcpy(http_res->date, core->http_date, sizeof(http_res->date));
+
+  xps_http_res_set_metrics(core, status_code);
 
   return http_res;
 }
@@ -127,37 +141,62 @@ xps_buffer_t *xps_http_res_serialize(xps_http_res_t *http_res) {
   /* valid params */
   assert(http_res != NULL);
 
-  // Serialize headers
-  xps_buffer_t *headers_str = xps_http_serialize_headers(&(http_res->headers));
-  if (headers_str == NULL) {
-    logger(LOG_ERROR, "xps_http_res_serialize()", "failed to serialize headers");
-    return NULL;
-  }
+  size_t response_line_len = strlen(http_res->response_line);
+  size_t date_len = strlen(http_res->date);
+  size_t fixed_headers_len = sizeof(HTTP_RES_FIXED_HEADERS) - 1;
 
-  // Calculate length for final buffer
-  size_t final_len = strlen(http_res->response_line) + 1 + headers_str->len + 1 +
-                     (http_res->body ? http_res->body->len : 0);
+  // Calculate exact length for final buffer
+  size_t final_len = response_line_len + 2;
+  final_len += (sizeof("Date: ") - 1) + date_len + 2;
+  final_len += fixed_headers_len;
+  for (int i = 0; i < http_res->headers.length; i++) {
+    xps_keyval_t *header = http_res->headers.data[i];
+    final_len += strlen(header->key) + 2 + strlen(header->val) + 2;
+  }
+  final_len += 2;
+  if (http_res->body != NULL)
+    final_len += http_res->body->len;
 
   // Create instance for final buffer
-  xps_buffer_t *buff = xps_buffer_create(final_len, 0, NULL);
+  xps_buffer_t *buff = xps_buffer_create(final_len, final_len, NULL);
   if (buff == NULL) {
     logger(LOG_ERROR, "xps_http_res_serialize()", "failed to create buffer instance");
-    xps_buffer_destroy(headers_str);
     return NULL;
   }
 
-  // Copy everything
+  // Copy everything in a single pass
   /* copy response line */
-  memcpy(buff->pos, http_res->response_line, strlen(http_res->response_line));
-  buff->pos += strlen(http_res->response_line);
-  memcpy(buff->pos, "\n", 1);
-  buff->pos += 1;
+  memcpy(buff->pos, http_res->response_line, response_line_len);
+  buff->pos += response_line_len;
+  memcpy(buff->pos, "\r\n", 2);
+  buff->pos += 2;
+
+  /* copy Date and other fixed headers */
+  memcpy(buff->pos, "Date: ", 6);
+  buff->pos += 6;
+  memcpy(buff->pos, http_res->date, date_len);
+  buff->pos += date_len;
+  memcpy(buff->pos, "\r\n", 2);
+  buff->pos += 2;
+  memcpy(buff->pos, HTTP_RES_FIXED_HEADERS, fixed_headers_len);
+  buff->pos += fixed_headers_len;
 
   /* copy headers */
-  memcpy(buff->pos, headers_str->data, headers_str->len);
-  buff->pos += headers_str->len;
-  memcpy(buff->pos, "\n", 1);
-  buff->pos += 1;
+  for (int i = 0; i < http_res->headers.length; i++) {
+    xps_keyval_t *header = http_res->headers.data[i];
+    size_t key_len = strlen(header->key);
+    size_t val_len = strlen(header->val);
+    memcpy(buff->pos, header->key, key_len);
+    buff->pos += key_len;
+    memcpy(buff->pos, ": ", 2);
+    buff->pos += 2;
+    memcpy(buff->pos, header->val, val_len);
+    buff->pos += val_len;
+    memcpy(buff->pos, "\r\n", 2);
+    buff->pos += 2;
+  }
+  memcpy(buff->pos, "\r\n", 2);
+  buff->pos += 2;
 
   if (http_res->body != NULL) {
     /* copy response body*/
@@ -165,9 +204,8 @@ xps_buffer_t *xps_http_res_serialize(xps_http_res_t *http_res) {
     buff->pos += http_res->body->len;
   }
 
-  buff->len = final_len;
-
-  xps_buffer_destroy(headers_str);
+  assert(buff->pos == buff->data + final_len);
+  buff->pos = buff->data;
 
   logger(LOG_DEBUG, "xps_http_res_serialize()", "http response serialized succefully");
 
@@ -182,4 +220,72 @@ void xps_http_res_set_body(xps_http_res_t *http_res, xps_buffer_t *buff) {
   char body_len_str[50];
   sprintf(body_len_str, "%lu", buff->len);
   xps_http_set_header(&http_res->headers, "Content-Length", body_len_str);
-}
\ No newline at end of file
+}
+xps_http_res_template_t *xps_http_res_template_create(u_int status_code, const char *location) {
+
+  xps_http_res_template_t *tmpl = malloc(sizeof(xps_http_res_template_t));
+  if (tmpl == NULL) {
+    logger(LOG_ERROR, "xps_http_res_template_create()", "malloc() failed for 'tmpl'");
+    return NULL;
+  }
+
+  xps_http_res_t *http_res = http_res_init(status_code);
+  if (http_res == NULL) {
+    logger(LOG_ERROR, "xps_http_res_template_create()", "http_res_init() failed");
+    free(tmpl);
+    return NULL;
+  }
+
+  // Placeholder of the same length as a real Date value, patched on every render
+  memset(http_res->date, '-', HTTP_DATE_LEN);
+  http_res->date[HTTP_DATE_LEN] = '\0';
+
+  if (location != NULL)
+    xps_http_set_header(&(http_res->headers), "Location", location);
+  xps_http_set_header(&(http_res->headers), "Content-Length", "0");
+
+  xps_buffer_t *buff = xps_http_res_serialize(http_res);
+  if (buff == NULL) {
+    logger(LOG_ERROR, "xps_http_res_template_create()", "xps_http_res_serialize() failed");
+    xps_http_res_destroy(http_res);
+    free(tmpl);
+    return NULL;
+  }
+
+  // Date value always follows the response line and "Date: "
+  tmpl->status_code = status_code;
+  tmpl->buff = buff;
+  tmpl->date_offset = strlen(http_res->response_line) + 2 + (sizeof("Date: ") - 1);
+
+  xps_http_res_destroy(http_res);
+
+  logger(LOG_DEBUG, "xps_http_res_template_create()", "created template for status %u",
+         status_code);
+
+  return tmpl;
+}
+
+void xps_http_res_template_destroy(xps_http_res_template_t *tmpl) {
+  assert(tmpl != NULL);
+
+  xps_buffer_destroy(tmpl->buff);
+  free(tmpl);
+}
+
+xps_buffer_t *xps_http_res_template_render(xps_core_t *core, xps_http_res_template_t *tmpl) {
+  assert(core != NULL);
+  assert(tmpl != NULL);
+
+  xps_buffer_t *buff = xps_buffer_create(tmpl->buff->len, tmpl->buff->len, NULL);
+  if (buff == NULL) {
+    logger(LOG_ERROR, "xps_http_res_template_render()", "xps_buffer_create() failed");
+    return NULL;
+  }
+
+  memcpy(buff->data, tmpl->buff->data, tmpl->buff->len);
+  memcpy(buff->data + tmpl->date_offset, core->http_date, HTTP_DATE_LEN);
+
+  xps_http_res_set_metrics(core, tmpl->status_code);
+
+  return buff;
+}
@@ -3,15 +3,30 @@
 
 #include "../xps.h"
 
+#define HTTP_DATE_LEN 29 // strlen("Sun, 06 Nov 1994 08:49:37 GMT")
+
 struct xps_http_res_s {
   char response_line[70];
+  char date[32];
   vec_void_t headers;
   xps_buffer_t *body;
 };
 
+/* Pre-serialized response whose only varying part is the Date value */
+struct xps_http_res_template_s {
+  u_int status_code;
+  xps_buffer_t *buff;
+  size_t date_offset;
+};
+
 xps_http_res_t *xps_http_res_create(xps_core_t *core, u_int status_code);
 void xps_http_res_destroy(xps_http_res_t *res);
 xps_buffer_t *xps_http_res_serialize(xps_http_res_t *res);
 void xps_http_res_set_body(xps_http_res_t *http_res, xps_buffer_t *buff);
+void xps_http_res_set_metrics(xps_core_t *core, u_int status_code);
+
+xps_http_res_template_t *xps_http_res_template_create(u_int status_code, const char *location);
+void xps_http_res_template_destroy(xps_http_res_template_t *tmpl);
+xps_buffer_t *xps_http_res_template_render(xps_core_t *core, xps_http_res_template_t *tmpl);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,245 @@
+#include "../xps.h"
+
+int http_res_parse_head(xps_http_res_parser_t *parser);
+int http_res_head_append(xps_http_res_parser_t *parser, const u_char *data, size_t len);
+int http_res_parser_invalid(xps_http_res_parser_t *parser);
+
+xps_http_res_parser_t *xps_http_res_parser_create(xps_http_method_t req_method) {
+
+  xps_http_res_parser_t *parser = malloc(sizeof(xps_http_res_parser_t));
+  if (parser == NULL) {
+    logger(LOG_ERROR, "xps_http_res_parser_create()", "malloc() failed for 'parser'");
+    return NULL;
+  }
+
+  parser->head = xps_buffer_create(1024, 0, NULL);
+  if (parser->head == NULL) {
+    logger(LOG_ERROR, "xps_http_res_parser_create()", "xps_buffer_create() failed");
+    free(parser);
+    return NULL;
+  }
+
+  parser->state = RES_HEAD;
+  parser->req_method = req_method;
+  parser->head_line_len = 0;
+  parser->status_code = 0;
+  parser->http_minor = 0;
+  parser->keep_alive = false;
+  parser->body = NULL;
+
+  return parser;
+}
+
+void xps_http_res_parser_destroy(xps_http_res_parser_t *parser) {
+  assert(parser != NULL);
+
+  xps_buffer_destroy(parser->head);
+  if (parser->body)
+    xps_http_body_destroy(parser->body);
+  free(parser);
+}
+
+/*
+ * Feeds the next bytes read from the upstream. The bytes themselves are left
+ * untouched for the caller to forward. Returns OK once the whole response has
+ * been seen, E_AGAIN while more is expected and E_FAIL if the response cannot
+ * be parsed.
+ */
+int xps_http_res_parser_feed(xps_http_res_parser_t *parser, const u_char *data, size_t len) {
+  assert(parser != NULL);
+  assert(data != NULL || len == 0);
+
+  const u_char *p_ch = data;
+  const u_char *end = data + len;
+
+  while (p_ch < end) {
+    switch (parser->state) {
+      case RES_HEAD: {
+        // Look for the empty line, carrying line state over from earlier reads
+        const u_char *head_end = NULL;
+        for (const u_char *p = p_ch; p < end; p++) {
+          if (*p == LF) {
+            if (parser->head_line_len == 0) {
+              head_end = p + 1;
+              break;
+            }
+            parser->head_line_len = 0;
+          } else if (*p != CR)
+            parser->head_line_len++;
+        }
+
+        const u_char *copy_end = head_end ? head_end : end;
+        if (http_res_head_append(parser, p_ch, copy_end - p_ch) != OK)
+          return http_res_parser_invalid(parser);
+        p_ch = copy_end;
+
+        if (head_end == NULL)
+          return E_AGAIN;
+        if (http_res_parse_head(parser) != OK)
+          return http_res_parser_invalid(parser);
+        break;
+      }
+
+      case RES_BODY: {
+        size_t consumed;
+        int error = xps_http_body_parse(parser->body, p_ch, end - p_ch, &consumed);
+        if (error == E_FAIL)
+          return http_res_parser_invalid(parser);
+        p_ch += consumed;
+        if (error == OK)
+          parser->state = RES_DONE;
+        break;
+      }
+
+      case RES_DONE:
+        // Bytes past the end of the response; the connection is out of sync
+        parser->keep_alive = false;
+        return OK;
+
+      case RES_INVALID:
+        return E_FAIL;
+    }
+  }
+
+  if (parser->state == RES_INVALID)
+    return E_FAIL;
+
+  return parser->state == RES_DONE ? OK : E_AGAIN;
+}
+
+int http_res_head_append(xps_http_res_parser_t *parser, const u_char *data, size_t len) {
+  assert(parser != NULL);
+
+  xps_buffer_t *head = parser->head;
+
+  // One extra byte keeps room for a NUL terminator
+  if (head->len + len + 1 > head->size) {
+    if (head->len + len + 1 > HTTP_RES_HEAD_MAX_LEN) {
+      logger(LOG_DEBUG, "http_res_head_append()", "response head too large");
+      return E_FAIL;
+    }
+    size_t new_size = head->size;
+    while (new_size < head->len + len + 1)
+      new_size *= 2;
+    u_char *new_data = realloc(head->data, new_size);
+    if (new_data == NULL) {
+      logger(LOG_ERROR, "http_res_head_append()", "realloc() failed");
+      return E_FAIL;
+    }
+    head->data = new_data;
+    head->pos = new_data;
+    head->size = new_size;
+  }
+
+  memcpy(head->data + head->len, data, len);
+  head->len += len;
+  head->data[head->len] = '\0';
+
+  return OK;
+}
+
+int http_res_parse_head(xps_http_res_parser_t *parser) {
+  assert(parser != NULL);
+
+  const char *head = (const char *)parser->head->data;
+  const char *head_end = head + parser->head->len;
+
+  u_int major, minor, status_code;
+  if (sscanf(head, "HTTP/%1u.%1u %3u", &major, &minor, &status_code) != 3 || major != 1 ||
+      status_code < 100 || status_code > 599) {
+    logger(LOG_DEBUG, "http_res_parse_head()", "invalid status line");
+    return E_FAIL;
+  }
+
+  bool has_content_length = false;
+  size_t content_length = 0;
+  bool chunked = false;
+  bool conn_close = false;
+  bool conn_keep_alive = false;
+
+  // Walk the header field lines that follow the status line
+  const char *line = memchr(head, LF, head_end - head);
+  for (line = line ? line + 1 : head_end; line < head_end;) {
+    const char *line_end = memchr(line, LF, head_end - line);
+    if (line_end == NULL)
+      line_end = head_end;
+    const char *next = line_end + 1;
+    if (line_end > line && line_end[-1] == CR)
+      line_end--;
+
+    const char *colon = memchr(line, ':', line_end - line);
+    if (colon != NULL) {
+      const char *val = colon + 1;
+      while (val < line_end && (*val == ' ' || *val == '\t'))
+        val++;
+      size_t val_len = line_end - val;
+      while (val_len > 0 && (val[val_len - 1] == ' ' || val[val_len - 1] == '\t'))
+        val_len--;
+
+      switch (xps_http_header_id((const u_char *)line, colon - line)) {
+        case HTTP_H_CONTENT_LENGTH:
+          has_content_length = true;
+          content_length = strtoul(val, NULL, 10);
+          break;
+        case HTTP_H_TRANSFER_ENCODING:
+          chunked = xps_http_is_chunked(val, val_len);
+          break;
+        case HTTP_H_CONNECTION:
+          conn_close |= xps_http_has_token(val, val_len, "close");
+          conn_keep_alive |= xps_http_has_token(val, val_len, "keep-alive");
+          break;
+        default:
+          break;
+      }
+    }
+
+    line = next;
+  }
+
+  // Interim responses are followed by the final one on the same connection
+  if (status_code < 200 && status_code != HTTP_SWITCHING_PROTOCOLS) {
+    parser->head->len = 0;
+    parser->head_line_len = 0;
+    return OK;
+  }
+
+  parser->status_code = status_code;
+  parser->http_minor = minor;
+  parser->keep_alive = minor >= 1 ? !conn_close : conn_keep_alive;
+
+  // RFC 7230 section 3.3.3
+  xps_http_body_type_t body_type;
+  if (status_code == HTTP_SWITCHING_PROTOCOLS)
+    body_type = HTTP_BODY_CLOSE;
+  else if (parser->req_method == HTTP_HEAD || status_code == HTTP_NO_CONTENT ||
+           status_code == HTTP_NOT_MODIFIED)
+    body_type = HTTP_BODY_NONE;
+  else if (chunked)
+    body_type = HTTP_BODY_CHUNKED;
+  else if (has_content_length)
+    body_type = HTTP_BODY_LENGTH;
+  else
+    body_type = HTTP_BODY_CLOSE;
+
+  if (body_type == HTTP_BODY_CLOSE)
+    parser->keep_alive = false;
+
+  parser->body = xps_http_body_create(body_type, content_length);
+  if (parser->body == NULL) {
+    logger(LOG_ERROR, "http_res_parse_head()", "xps_http_body_create() failed");
+    return E_FAIL;
+  }
+
+  parser->state = parser->body->done ? RES_DONE : RES_BODY;
+
+  return OK;
+}
+
+int http_res_parser_invalid(xps_http_res_parser_t *parser) {
+  assert(parser != NULL);
+
+  parser->state = RES_INVALID;
+  parser->keep_alive = false;
+
+  return E_FAIL;
+}
@@ -0,0 +1,33 @@
+#ifndef XPS_HTTP_RES_PARSER_H
+#define XPS_HTTP_RES_PARSER_H
+
+#include "../xps.h"
+
+#define HTTP_RES_HEAD_MAX_LEN 65536 // 64 KB
+
+typedef enum {
+  RES_HEAD,    // status line and header fields
+  RES_BODY,    // body, framed by body->type
+  RES_DONE,    // whole response seen
+  RES_INVALID, // unparsable, bytes are still passed through
+} xps_http_res_parser_state_t;
+
+/* Incremental parser for responses read from an upstream */
+struct xps_http_res_parser_s {
+  xps_http_res_parser_state_t state;
+  xps_http_method_t req_method;
+
+  xps_buffer_t *head;   // response head only, body bytes are never copied
+  size_t head_line_len; // non-CR bytes in the current head line
+
+  u_int status_code;
+  u_int http_minor;
+  bool keep_alive; // connection may carry another request after this response
+  xps_http_body_t *body;
+};
+
+xps_http_res_parser_t *xps_http_res_parser_create(xps_http_method_t req_method);
+void xps_http_res_parser_destroy(xps_http_res_parser_t *parser);
+int xps_http_res_parser_feed(xps_http_res_parser_t *parser, const u_char *data, size_t len);
+
+#endif
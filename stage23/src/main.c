@@ -8,9 +8,11 @@ xps_core_t **cores;
 int n_cores = 0;
 pthread_t *thread_ids;
 int n_threads;
+bool stop_requested;
 xps_config_t *config;
 
 void sigint_handler(int signum);
+void sighup_handler(int signum);
 int cores_create(xps_config_t *config);
 void cores_destroy();
 int threads_create(xps_core_t **cores, int n_cores);
@@ -19,6 +21,7 @@ void *thread_start(void *arg);
 
 int main(int argc, char *argv[]) {
   signal(SIGINT, sigint_handler);           // for handling ctrl+c
+  signal(SIGHUP, sighup_handler);           // for reloading the config file
   cliargs = xps_cliargs_create(argc, argv); // get commandline arguments
   if (cliargs == NULL) {
     logger(LOG_ERROR, "main()", "Failed to read from command line");
@@ -35,23 +38,54 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
+  // Resolve upstream hosts off the event loops
+  if (xps_dns_resolver_start(config) != OK) {
+    logger(LOG_ERROR, "main()", "xps_dns_resolver_start() failed");
+    exit(EXIT_FAILURE);
+  }
+
+  // Shared upstream health, actively checked from the first core
+  if (xps_health_start(config, cores[0]) != OK) {
+    logger(LOG_ERROR, "main()", "xps_health_start() failed");
+    exit(EXIT_FAILURE);
+  }
+
+  // Reload the config file on SIGHUP, without stopping the cores
+  if (xps_reload_start(config) != OK) {
+    logger(LOG_ERROR, "main()", "xps_reload_start() failed");
+    exit(EXIT_FAILURE);
+  }
+
+  // Returns once SIGINT has stopped every loop
   if (threads_create(cores, n_cores) != OK) {
     logger(LOG_ERROR, "main()", "threads_create() failed");
     exit(EXIT_FAILURE);
   }
 
+  xps_reload_stop();
+  threads_destroy();
+  xps_health_stop();
+  xps_dns_resolver_stop();
+  cores_destroy();
+  xps_health_destroy();
+  xps_reload_destroy(); // the current config and any old ones still in use
+  xps_cliargs_destroy(cliargs);
+
   return EXIT_SUCCESS;
 }
 
+/* Only asks the loops to stop; main() tears down once the worker threads have returned */
 void sigint_handler(int signum) {
   logger(LOG_WARNING, "sigint_handler()", "SIGINT received");
 
-  threads_destroy();
-  cores_destroy();
-  xps_config_destroy(config);
-  xps_cliargs_destroy(cliargs);
+  __atomic_store_n(&stop_requested, true, __ATOMIC_RELEASE);
+  for (int i = 0; i < n_cores; i++)
+    xps_loop_stop(cores[i]->loop);
+}
 
-  exit(EXIT_SUCCESS);
+void sighup_handler(int signum) {
+  // The reload itself runs on its own thread
+  xps_reload_request();
 }
 
 int cores_create(xps_config_t *config) {
@@ -63,9 +97,19 @@ int cores_create(xps_config_t *config) {
     return E_FAIL;
   }
   n_cores = 0;
+
+  // Linux places a page on the NUMA node of the CPU that first touches it, so
+  // each core is built while this thread runs on that core's CPU
+  cpu_set_t main_cpus;
+  CPU_ZERO(&main_cpus);
+  if (sched_getaffinity(0, sizeof(main_cpus), &main_cpus) != 0)
+    logger(LOG_ERROR, "cores_create()", "sched_getaffinity() failed");
+
   // Create cores
   for (int i = 0; i < config->workers; i++) {
-    xps_core_t *core = xps_core_create(config);
+    if (config->_cpus.length > 0)
+      cpu_pin_thread(pthread_self(), config->_cpus.data[i]);
+    xps_core_t *core = xps_core_create(config, i);
     if (core) {
       cores[n_cores] = core;
       n_cores += 1;
@@ -75,24 +119,34 @@ int cores_create(xps_config_t *config) {
       return E_FAIL;
     }
   }
+  if (CPU_COUNT(&main_cpus) > 0 &&
+      pthread_setaffinity_np(pthread_self(), sizeof(main_cpus), &main_cpus) != 0)
+    logger(LOG_ERROR, "cores_create()", "pthread_setaffinity_np() failed");
   /* Create listeners*/
   xps_listener_t *listeners[config->_all_listeners.length + 1];
   n_listeners = 0;
 
-  //creating metrics listener TODO: Stage22
-  xps_listener_t *metrics_listener = xps_listener_create(METRICS_HOST, METRICS_PORT);
+  xps_config_listener_t *metrics_conf = config->_metrics_listener;
+  xps_listener_t *metrics_listener =
+    xps_listener_create(metrics_conf->host, metrics_conf->port, metrics_conf->backlog);
   if (metrics_listener) {
-    logger(LOG_INFO, "cores_create()", "Metrics server listening on http://%s:%d", METRICS_HOST,
-           METRICS_PORT);
+    metrics_listener->conf = metrics_conf;
+    logger(LOG_INFO, "cores_create()", "Metrics server listening on http://%s:%d",
+           metrics_conf->host, metrics_conf->port);
     listeners[n_listeners] = metrics_listener;
     n_listeners += 1;
   }
   for (int i = 0; i < config->_all_listeners.length; i++) {
     xps_config_listener_t *conf = config->_all_listeners.data[i];
-    xps_listener_t *listener = xps_listener_create(conf->host, conf->port);
+    if (conf->udp_route)
+      continue; // bound per core below
+    xps_listener_t *listener = xps_listener_create(conf->host, conf->port, conf->backlog);
     if (listener) {
-      logger(LOG_INFO, "cores_create()", "Server listening on http://%s:%d",
-             conf->host, conf->port);
+      listener->conf = conf;
+      listener->tcp_route = conf->tcp_route;
+      listener->acl_routes = &(conf->_acl_routes);
+      logger(LOG_INFO, "cores_create()", "Server listening on %s://%s:%d",
+             conf->tcp_route ? "tcp" : "http", conf->host, conf->port);
       listeners[n_listeners] = listener;
       n_listeners++;
     } else {
@@ -101,42 +155,32 @@ int cores_create(xps_config_t *config) {
   }
   /*Duplicate and add listeners to cores*/
   for (int i = 0; i < n_cores; i++) {
-    xps_core_t *curr_core = cores[i];
     for (int j = 0; j < n_listeners; j++) {
-      xps_listener_t *listener = listeners[j];
-      xps_listener_t *dup_listener = malloc(sizeof(xps_listener_t));
-      if (dup_listener == NULL) {
-        logger(LOG_ERROR, "cores_create()", "malloc() faield on dup_listener");
-        continue;
-      }
-      /* Initialize dup_listener values*/
-      dup_listener->core = curr_core;
-      dup_listener->host = listener->host;
-      dup_listener->port = listener->port;
-      int new_sock_fd = dup(listener->sock_fd);
-      if (new_sock_fd == -1) {
-        logger(LOG_ERROR, "cores_create()", "dup() failed");
-        perror("Error message");
-        free(dup_listener);
-        continue;
-      }
-      dup_listener->sock_fd = new_sock_fd;
-      /*Attach listener to loop*/
-      if (xps_loop_attach(curr_core->loop, dup_listener->sock_fd,
-                          EPOLLIN | EPOLLET, dup_listener,
-                          xps_listener_connection_handler, NULL, NULL) != OK) {
-        logger(LOG_ERROR, "cores_create()", "xps_loop_attach() failed");
-        free(dup_listener);
-        continue;
-      }
-      /*Add listener to 'listeners' list of core*/
-      vec_push(&(curr_core->listeners), dup_listener);
+      if (xps_listener_dup(listeners[j], cores[i]) == NULL)
+        logger(LOG_ERROR, "cores_create()", "xps_listener_dup() failed");
     }
   }
   for (int i = 0; i < n_listeners; i++) {
     xps_listener_destroy(listeners[i]);
   }
 
+  /*UDP sockets aren't shared: each core binds its own with SO_REUSEPORT*/
+  for (int i = 0; i < config->_all_listeners.length; i++) {
+    xps_config_listener_t *conf = config->_all_listeners.data[i];
+    if (conf->udp_route == NULL)
+      continue;
+    int n_bound = 0;
+    for (int j = 0; j < n_cores; j++) {
+      if (xps_udp_proxy_create(cores[j], conf->host, conf->port, conf->udp_route) != NULL)
+        n_bound++;
+      else
+        logger(LOG_ERROR, "cores_create()", "xps_udp_proxy_create() failed");
+    }
+    if (n_bound > 0)
+      logger(LOG_INFO, "cores_create()", "Server listening on udp://%s:%d", conf->host,
+             conf->port);
+  }
+
   logger(LOG_DEBUG, "cores_create()", "created cores");
 
   return OK;
@@ -162,8 +206,10 @@ int threads_create(xps_core_t **cores, int n_cores){
   }
 
   for(int i = 0; i < n_cores; i++){
+    if (__atomic_load_n(&stop_requested, __ATOMIC_ACQUIRE))
+      break; // SIGINT came before the loops ran
     xps_core_t *curr_core = cores[i];
-    int err = pthread_create(&(thread_ids[i]),NULL, thread_start, (void*) curr_core);
+    int err = pthread_create(&(thread_ids[n_threads]),NULL, thread_start, (void*) curr_core);
     if (err != 0) {
       logger(LOG_ERROR, "threads_create()", "pthread_create() failed");
       continue;
@@ -172,29 +218,23 @@ int threads_create(xps_core_t **cores, int n_cores){
     logger(LOG_DEBUG, "threads_create()", "created thread %d", i);
   }
 
-  for(int i=0;i < n_cores; i++ ){
+  for(int i=0;i < n_threads; i++ ){
     if(pthread_join(thread_ids[i],NULL) != 0){
       logger(LOG_ERROR, "threads_create()", "pthread_join() failed");
       exit(EXIT_FAILURE);
     }
   }
 
-  logger(LOG_DEBUG, "threads_create()", "created threads");
+  logger(LOG_DEBUG, "threads_create()", "threads returned");
 
   return OK;
 
 }
 
 void threads_destroy() {
-  for (int i = 0; i < n_threads; i++) {
-    int err = pthread_cancel(thread_ids[i]);
-    if (err != 0) {
-      logger(LOG_ERROR, "threads_destroy()", "pthread_cancel() failed");
-      perror("Error message");
-      exit(EXIT_FAILURE);
-    }
-  }
+  // The threads have been joined in threads_create()
   free(thread_ids);
+  n_threads = 0;
 
   logger(LOG_DEBUG, "threads_destroy()", "destroyed threads");
 }
@@ -8,6 +8,8 @@ void connection_close(xps_connection_t *connection, bool peer_closed);
 void connection_loop_read_handler(void *ptr);
 void connection_loop_write_handler(void *ptr);
 void connection_loop_close_handler(void *ptr);
+int connection_connect_complete(xps_connection_t *connection);
+void connection_set_remote(xps_connection_t *connection);
 
 void strrev(char *str);
 
@@ -49,7 +51,14 @@ xps_connection_t *xps_connection_create(xps_core_t *core, u_int sock_fd) {
   // Init values
   connection->core = core;
   connection->sock_fd = sock_fd;
-  connection->remote_ip = get_remote_ip(sock_fd);
+  connection->listener = NULL;
+  connection->buffer_size = core->config->buffer_size;
+  connection_set_remote(connection);
+  connection->connecting = false;
+  connection->connect_start_usec = 0;
+  connection->pooled = false;
+  connection->splice_from = NULL;
+  connection->splice_to = NULL;
   connection->source = source;
   connection->sink = sink;
 
@@ -81,6 +90,14 @@ void xps_connection_destroy(xps_connection_t *connection) {
   /* validate params */
   assert(connection != NULL);
 
+  if (connection->pooled)
+    xps_upstream_pool_remove(connection->core, connection);
+
+  if (connection->splice_from)
+    xps_splice_detach(connection->splice_from, connection);
+  if (connection->splice_to)
+    xps_splice_detach(connection->splice_to, connection);
+
   /* set connection to NULL in 'connections' list */
   for (int i = 0; i < (connection->core)->connections.length; i++) {
     xps_connection_t *curr = (connection->core)->connections.data[i];
@@ -100,9 +117,6 @@ void xps_connection_destroy(xps_connection_t *connection) {
   xps_pipe_source_destroy(connection->source);
   /*destroy sink*/
   xps_pipe_sink_destroy(connection->sink);
-  /* free connection->remote_ip */
-  free(connection->remote_ip);
-
   xps_metrics_set(connection->core, M_CONN_CLOSE, 1);
 
   /* free connection instance */
@@ -116,7 +130,11 @@ void connection_loop_read_handler(void *ptr) {
   assert(ptr != NULL);
   xps_connection_t *connection = ptr;
 
-  connection->source->ready = true;
+  // A splice reading from this connection takes the readiness instead of the pipe
+  if (connection->splice_from)
+    connection->splice_from->from_ready = true;
+  else
+    connection->source->ready = true;
 }
 
 void connection_loop_write_handler(void *ptr) {
@@ -124,19 +142,67 @@ void connection_loop_write_handler(void *ptr) {
   assert(ptr != NULL);
   xps_connection_t *connection = ptr;
 
+  // First writable event of an outgoing connection tells whether connect() succeeded
+  if (connection->connecting && connection_connect_complete(connection) != OK)
+    return;
+
   connection->sink->ready = true;
 }
 
+int connection_connect_complete(xps_connection_t *connection) {
+  assert(connection != NULL);
+
+  int sock_error = 0;
+  socklen_t sock_error_len = sizeof(sock_error);
+  if (getsockopt(connection->sock_fd, SOL_SOCKET, SO_ERROR, &sock_error, &sock_error_len) < 0)
+    sock_error = errno;
+
+  if (sock_error != 0) {
+    logger(LOG_ERROR, "connection_connect_complete()", "connect() failed: %s",
+           strerror(sock_error));
+    xps_metrics_set(connection->core, M_CONN_ERROR, 1);
+    connection_close(connection, false);
+    return E_FAIL;
+  }
+
+  connection->connecting = false;
+  xps_metrics_set(connection->core, M_UPSTREAM_CONNECT_TIME,
+                  monotonic_usec() - connection->connect_start_usec);
+  if (connection->remote_ip[0] == '\0')
+    connection_set_remote(connection);
+
+  return OK;
+}
+
 void connection_loop_close_handler(void *ptr) {
   /* validate params */
   assert(ptr != NULL);
   xps_connection_t *connection = ptr;
 
+  // A hang-up can come with bytes still unread; the splice reads on until EOF or an error
+  if (connection->splice_from) {
+    connection->splice_from->from_ready = true;
+    return;
+  }
+
   connection_close(connection, true);
 
   logger(LOG_INFO, "connection_loop_close_handler()", "connection closed by peer");
 }
 
+/* Fills remote_addr and remote_ip, or leaves them empty until the peer is known */
+void connection_set_remote(xps_connection_t *connection) {
+  assert(connection != NULL);
+
+  if (get_remote_addr(connection->sock_fd, &(connection->remote_addr)) != OK) {
+    memset(&(connection->remote_addr), 0, sizeof(connection->remote_addr));
+    connection->remote_ip[0] = '\0';
+    return;
+  }
+
+  addr_to_str(&(connection->remote_addr), connection->remote_ip, sizeof(connection->remote_ip));
+}
+
 void connection_source_handler(void *ptr) {
   /*assert ptr not null*/
   assert(ptr != NULL);
@@ -144,14 +210,14 @@ void connection_source_handler(void *ptr) {
   xps_pipe_source_t *source = ptr;
   xps_connection_t *connection = source->ptr;
 
-  xps_buffer_t *buff = xps_buffer_create(DEFAULT_BUFFER_SIZE, 0, NULL);
+  xps_buffer_t *buff = xps_buffer_create(connection->buffer_size, 0, NULL);
   if (buff == NULL) {
     logger(LOG_DEBUG, "connection_source_handler()", "xps_buffer_create() failed");
     return;
   }
 
   /*Read from socket using recv()*/
-  long read_n = recv(connection->sock_fd, buff->data, DEFAULT_BUFFER_SIZE, 0);
+  long read_n = recv(connection->sock_fd, buff->data, connection->buffer_size, 0);
   buff->len = read_n;
 
   // Set metrics
@@ -213,22 +279,21 @@ void connection_sink_handler(void *ptr) {
   xps_pipe_sink_t *sink = ptr;
   xps_connection_t *connection = sink->ptr;
 
-  xps_buffer_t *buff = xps_pipe_sink_read(sink, sink->pipe->buff_list->len);
-  if (buff == NULL) {
-    logger(LOG_ERROR, "connection_sink_handler()", "xps_pipe_sink_read() failed");
+  // Gather the queued buffers straight into one send, without coalescing them
+  struct iovec iov[MAX_SEND_IOVECS];
+  struct msghdr msg = {0};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = xps_buffer_list_iovec(sink->pipe->buff_list, iov, MAX_SEND_IOVECS);
+  if (msg.msg_iovlen == 0)
     return;
-  }
 
   // Write to socket
-  int write_n = send(connection->sock_fd, buff->data, buff->len, MSG_NOSIGNAL);
+  ssize_t write_n = sendmsg(connection->sock_fd, &msg, MSG_NOSIGNAL);
 
   // Set metrics
   if (write_n > 0)
     xps_metrics_set(connection->core, M_TRAFFIC_SEND_BYTES, write_n);
 
-  /*destroy buff*/
-  xps_buffer_destroy(buff);
-
   // Socket would block
   if (write_n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
     /*sink made not ready*/
@@ -249,7 +314,7 @@ void connection_sink_handler(void *ptr) {
     return;
 
   if (xps_buffer_list_clear(sink->pipe->buff_list, write_n) != OK) {
-    logger(LOG_ERROR, "connection_sink_handler()", "failed to clear %d bytes from sink", write_n);
+    logger(LOG_ERROR, "connection_sink_handler()", "failed to clear %zd bytes from sink", write_n);
   }
 }
 
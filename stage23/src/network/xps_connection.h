@@ -7,7 +7,14 @@ struct xps_connection_s {
     xps_core_t* core;
     int sock_fd;
     xps_listener_t* listener;
-    char* remote_ip;
+    u_int buffer_size; // bytes read per recv()
+    struct in6_addr remote_addr; // IPv4 clients as IPv4-mapped IPv6
+    char remote_ip[INET6_ADDRSTRLEN]; // remote_addr as text, "" until known
+    bool connecting; // non-blocking connect() still in progress
+    u_long connect_start_usec; // monotonic, when connect() was called
+    bool pooled;     // idle in the core's upstream pool
+    xps_splice_t* splice_from; // splice reading from this connection
+    xps_splice_t* splice_to;   // splice writing to this connection
     xps_pipe_source_t* source;
     xps_pipe_sink_t* sink;
 };
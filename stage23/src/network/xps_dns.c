@@ -0,0 +1,292 @@
+#include "xps_dns.h"
+
+// Authoritative copy of all upstream addresses, only touched by the resolver
+xps_dns_cache_t *resolver_cache = NULL;
+pthread_t resolver_thread;
+bool resolver_running = false;
+
+int dns_cache_add(xps_dns_cache_t *cache, const char *upstream);
+bool dns_resolve(xps_dns_entry_t *entry, u_long now_msec);
+void dns_publish(int index);
+void *dns_resolver_thread_start(void *arg);
+u_long dns_now_msec();
+
+xps_dns_cache_t *xps_dns_cache_create(xps_config_t *config) {
+  assert(config != NULL);
+
+  xps_dns_cache_t *cache = malloc(sizeof(xps_dns_cache_t));
+  if (cache == NULL) {
+    logger(LOG_ERROR, "xps_dns_cache_create()", "malloc() failed for 'cache'");
+    return NULL;
+  }
+
+  if (pthread_mutex_init(&(cache->mutex), NULL) != 0) {
+    logger(LOG_ERROR, "xps_dns_cache_create()", "pthread_mutex_init() failed");
+    free(cache);
+    return NULL;
+  }
+  vec_init(&(cache->entries));
+
+  // One entry per distinct upstream, in config order on every core
+  for (int i = 0; i < config->servers.length; i++) {
+    xps_config_server_t *server = config->servers.data[i];
+    for (int j = 0; j < server->routes.length; j++) {
+      xps_config_route_t *route = server->routes.data[j];
+      for (int k = 0; k < route->upstreams.length; k++) {
+        if (dns_cache_add(cache, route->upstreams.data[k]) != OK) {
+          xps_dns_cache_destroy(cache);
+          return NULL;
+        }
+      }
+    }
+  }
+
+  return cache;
+}
+
+void xps_dns_cache_destroy(xps_dns_cache_t *cache) {
+  assert(cache != NULL);
+
+  for (int i = 0; i < cache->entries.length; i++) {
+    xps_dns_entry_t *entry = cache->entries.data[i];
+    free(entry->host);
+    free(entry);
+  }
+  vec_deinit(&(cache->entries));
+  pthread_mutex_destroy(&(cache->mutex));
+  free(cache);
+}
+
+/*
+ * Copies the cached address of host:port into addr. Never blocks on the
+ * network. Returns E_AGAIN while the host has not been resolved yet and
+ * E_NOTFOUND for a host that is not an upstream in the config.
+ */
+int xps_dns_cache_lookup(xps_dns_cache_t *cache, const char *host, u_int port,
+                         struct sockaddr_in *addr) {
+  assert(cache != NULL);
+  assert(host != NULL);
+  assert(addr != NULL);
+
+  int error = E_NOTFOUND;
+
+  pthread_mutex_lock(&(cache->mutex));
+  for (int i = 0; i < cache->entries.length; i++) {
+    xps_dns_entry_t *entry = cache->entries.data[i];
+    if (entry->port == port && strcmp(entry->host, host) == 0) {
+      if (entry->resolved) {
+        *addr = entry->addr;
+        error = OK;
+      } else
+        error = E_AGAIN;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&(cache->mutex));
+
+  return error;
+}
+
+/* Resolves every upstream once, publishes to all cores, then keeps them fresh in the background */
+int xps_dns_resolver_start(xps_config_t *config) {
+  assert(config != NULL);
+
+  resolver_cache = xps_dns_cache_create(config);
+  if (resolver_cache == NULL) {
+    logger(LOG_ERROR, "xps_dns_resolver_start()", "xps_dns_cache_create() failed");
+    return E_FAIL;
+  }
+
+  u_long now_msec = dns_now_msec();
+  for (int i = 0; i < resolver_cache->entries.length; i++) {
+    if (dns_resolve(resolver_cache->entries.data[i], now_msec))
+      dns_publish(i);
+  }
+
+  if (pthread_create(&resolver_thread, NULL, dns_resolver_thread_start, NULL) != 0) {
+    logger(LOG_ERROR, "xps_dns_resolver_start()", "pthread_create() failed");
+    xps_dns_cache_destroy(resolver_cache);
+    resolver_cache = NULL;
+    return E_FAIL;
+  }
+  resolver_running = true;
+
+  return OK;
+}
+
+/*
+ * Adds the upstreams of a reloaded config to the resolver and every core, and
+ * resolves them before the config is published. Entries are never removed, so
+ * the index of an upstream stays the same in every cache.
+ */
+int xps_dns_resolver_update(xps_config_t *config) {
+  assert(config != NULL);
+  assert(resolver_cache != NULL);
+
+  int error = OK;
+
+  pthread_mutex_lock(&(resolver_cache->mutex));
+  int n_entries = resolver_cache->entries.length;
+
+  for (int i = 0; i < config->_all_routes.length && error == OK; i++) {
+    xps_config_route_t *route = config->_all_routes.data[i];
+    for (int j = 0; j < route->upstreams.length; j++) {
+      if (dns_cache_add(resolver_cache, route->upstreams.data[j]) != OK) {
+        error = E_FAIL;
+        break;
+      }
+    }
+  }
+
+  // Cores get the new entries in the same order
+  for (int i = 0; i < n_cores && error == OK; i++) {
+    xps_dns_cache_t *cache = cores[i]->dns_cache;
+    pthread_mutex_lock(&(cache->mutex));
+    for (int j = n_entries; j < resolver_cache->entries.length; j++) {
+      xps_dns_entry_t *entry = resolver_cache->entries.data[j];
+      char upstream[160];
+      snprintf(upstream, sizeof(upstream), "%s:%u", entry->host, entry->port);
+      if (dns_cache_add(cache, upstream) != OK) {
+        error = E_FAIL;
+        break;
+      }
+    }
+    pthread_mutex_unlock(&(cache->mutex));
+  }
+
+  if (error == OK) {
+    u_long now_msec = dns_now_msec();
+    for (int i = n_entries; i < resolver_cache->entries.length; i++) {
+      if (dns_resolve(resolver_cache->entries.data[i], now_msec))
+        dns_publish(i);
+    }
+  }
+  pthread_mutex_unlock(&(resolver_cache->mutex));
+
+  if (error != OK)
+    logger(LOG_ERROR, "xps_dns_resolver_update()", "dns_cache_add() failed");
+
+  return error;
+}
+
+void xps_dns_resolver_stop() {
+  if (resolver_running) {
+    pthread_cancel(resolver_thread);
+    pthread_join(resolver_thread, NULL);
+    resolver_running = false;
+  }
+
+  if (resolver_cache) {
+    xps_dns_cache_destroy(resolver_cache);
+    resolver_cache = NULL;
+  }
+}
+
+int dns_cache_add(xps_dns_cache_t *cache, const char *upstream) {
+  assert(cache != NULL);
+  assert(upstream != NULL);
+
+  char host[128];
+  u_int port = 0;
+  if (sscanf(upstream, "%127[^:]:%u", host, &port) != 2 || !is_valid_port(port)) {
+    logger(LOG_ERROR, "dns_cache_add()", "invalid upstream '%s'", upstream);
+    return E_FAIL;
+  }
+
+  for (int i = 0; i < cache->entries.length; i++) {
+    xps_dns_entry_t *entry = cache->entries.data[i];
+    if (entry->port == port && strcmp(entry->host, host) == 0)
+      return OK;
+  }
+
+  xps_dns_entry_t *entry = malloc(sizeof(xps_dns_entry_t));
+  if (entry == NULL) {
+    logger(LOG_ERROR, "dns_cache_add()", "malloc() failed for 'entry'");
+    return E_FAIL;
+  }
+  entry->host = strdup(host);
+  entry->port = port;
+  memset(&(entry->addr), 0, sizeof(entry->addr));
+  entry->resolved = false;
+  entry->expire_msec = 0;
+
+  vec_push(&(cache->entries), entry);
+
+  return OK;
+}
+
+/* Refreshes entry if its TTL ran out. Returns true if its address changed */
+bool dns_resolve(xps_dns_entry_t *entry, u_long now_msec) {
+  assert(entry != NULL);
+
+  if (entry->expire_msec > now_msec)
+    return false;
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(entry->port);
+
+  // IP literals never need a lookup
+  if (inet_pton(AF_INET, entry->host, &(addr.sin_addr)) == 1) {
+    entry->expire_msec = (u_long)-1;
+  } else {
+    struct addrinfo *addr_info = xps_getaddrinfo(entry->host, entry->port);
+    if (addr_info == NULL) {
+      // Keep serving the last known address and retry soon
+      logger(LOG_WARNING, "dns_resolve()", "failed to resolve %s", entry->host);
+      entry->expire_msec = now_msec + DEFAULT_DNS_RETRY_MSEC;
+      return false;
+    }
+    addr = *(struct sockaddr_in *)addr_info->ai_addr;
+    freeaddrinfo(addr_info);
+    entry->expire_msec = now_msec + DEFAULT_DNS_TTL_MSEC;
+  }
+
+  bool changed = !entry->resolved || entry->addr.sin_addr.s_addr != addr.sin_addr.s_addr;
+  entry->addr = addr;
+  entry->resolved = true;
+
+  return changed;
+}
+
+/* Copies entry index of the resolver's cache into every core's cache */
+void dns_publish(int index) {
+  xps_dns_entry_t *src = resolver_cache->entries.data[index];
+
+  for (int i = 0; i < n_cores; i++) {
+    xps_dns_cache_t *cache = cores[i]->dns_cache;
+    assert(cache->entries.length == resolver_cache->entries.length);
+
+    pthread_mutex_lock(&(cache->mutex));
+    xps_dns_entry_t *dst = cache->entries.data[index];
+    dst->addr = src->addr;
+    dst->resolved = src->resolved;
+    pthread_mutex_unlock(&(cache->mutex));
+  }
+}
+
+void *dns_resolver_thread_start(void *arg) {
+  while (1) {
+    sleep(1);
+
+    // A reload may be adding entries; cancelling with the lock held would leave it held
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_mutex_lock(&(resolver_cache->mutex));
+    u_long now_msec = dns_now_msec();
+    for (int i = 0; i < resolver_cache->entries.length; i++) {
+      if (dns_resolve(resolver_cache->entries.data[i], now_msec))
+        dns_publish(i);
+    }
+    pthread_mutex_unlock(&(resolver_cache->mutex));
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+  }
+
+  return NULL;
+}
+
+u_long dns_now_msec() {
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return timeval_to_msec(time);
+}
@@ -0,0 +1,29 @@
+#ifndef XPS_DNS_H
+#define XPS_DNS_H
+
+#include "../xps.h"
+
+struct xps_dns_entry_s {
+  char *host;
+  u_int port;
+  struct sockaddr_in addr;
+  bool resolved;
+  u_long expire_msec; // next refresh, only used by the resolver's own cache
+};
+
+/* Upstream addresses known to one core, filled in by the resolver thread */
+struct xps_dns_cache_s {
+  pthread_mutex_t mutex;
+  vec_void_t entries;
+};
+
+xps_dns_cache_t *xps_dns_cache_create(xps_config_t *config);
+void xps_dns_cache_destroy(xps_dns_cache_t *cache);
+int xps_dns_cache_lookup(xps_dns_cache_t *cache, const char *host, u_int port,
+                         struct sockaddr_in *addr);
+
+int xps_dns_resolver_start(xps_config_t *config);
+int xps_dns_resolver_update(xps_config_t *config);
+void xps_dns_resolver_stop();
+
+#endif
@@ -0,0 +1,518 @@
+#include "xps_health.h"
+
+// One entry per distinct upstream; a reload may add entries, never removes any
+vec_void_t health_entries;
+pthread_mutex_t health_mutex; // guards health_entries itself, not the entries
+vec_void_t health_probes;
+xps_core_t *health_core = NULL;
+xps_timer_t *health_timer = NULL;
+bool health_started = false;
+
+xps_health_entry_t *health_entry_get(const char *upstream);
+void health_configure(xps_config_t *config);
+void health_timer_handler(void *ptr);
+void health_probe_start(xps_core_t *core, xps_health_entry_t *entry);
+void health_probe_finish(xps_health_probe_t *probe, bool success);
+void health_probe_result(xps_health_entry_t *entry, bool success);
+void health_probe_read_handler(void *ptr);
+void health_probe_write_handler(void *ptr);
+void health_probe_close_handler(void *ptr);
+void health_probe_timeout_handler(void *ptr);
+u_long health_ewma_decayed(xps_health_entry_t *entry, u_long now_msec);
+
+/*
+ * Builds the health table from the config and points every reverse proxy
+ * route at its entries. Active checks run from a timer on core.
+ */
+int xps_health_start(xps_config_t *config, xps_core_t *core) {
+  assert(config != NULL);
+  assert(core != NULL);
+
+  vec_init(&health_entries);
+  vec_init(&health_probes);
+  pthread_mutex_init(&health_mutex, NULL);
+  health_core = core;
+  health_started = true;
+
+  if (xps_health_attach(config) != OK) {
+    logger(LOG_ERROR, "xps_health_start()", "xps_health_attach() failed");
+    xps_health_stop();
+    xps_health_destroy();
+    return E_FAIL;
+  }
+
+  health_configure(config);
+
+  return OK;
+}
+
+/* Points the routes of config at their entries, adding entries for new upstreams */
+int xps_health_attach(xps_config_t *config) {
+  assert(config != NULL);
+
+  int error = OK;
+
+  pthread_mutex_lock(&health_mutex);
+  for (int i = 0; i < config->servers.length && error == OK; i++) {
+    xps_config_server_t *server = config->servers.data[i];
+    for (int j = 0; j < server->routes.length && error == OK; j++) {
+      xps_config_route_t *route = server->routes.data[j];
+      for (int k = 0; k < route->upstreams.length; k++) {
+        xps_health_entry_t *entry = health_entry_get(route->upstreams.data[k]);
+        if (entry == NULL) {
+          logger(LOG_ERROR, "xps_health_attach()", "health_entry_get() failed");
+          error = E_FAIL;
+          break;
+        }
+        vec_push(&(route->_upstream_health), entry);
+      }
+    }
+  }
+  pthread_mutex_unlock(&health_mutex);
+
+  return error;
+}
+
+/* A core moved onto a reloaded config; the probing core takes its health checks */
+void xps_health_update(xps_core_t *core, xps_config_t *config) {
+  assert(core != NULL);
+  assert(config != NULL);
+
+  if (!health_started || core != health_core)
+    return;
+
+  health_configure(config);
+}
+
+/* Must run after the worker threads have stopped and before the cores are destroyed */
+void xps_health_stop() {
+  if (!health_started)
+    return;
+
+  for (int i = 0; i < health_probes.length; i++) {
+    xps_health_probe_t *probe = health_probes.data[i];
+    xps_timer_destroy(probe->timer);
+    close(probe->sock_fd);
+    free(probe);
+  }
+  vec_deinit(&health_probes);
+
+  if (health_timer) {
+    xps_timer_destroy(health_timer);
+    health_timer = NULL;
+  }
+}
+
+/* Frees the health table; must run after the cores, whose sessions and flows point into it */
+void xps_health_destroy() {
+  if (!health_started)
+    return;
+
+  for (int i = 0; i < health_entries.length; i++) {
+    xps_health_entry_t *entry = health_entries.data[i];
+    free(entry->upstream);
+    free(entry->host);
+    free(entry);
+  }
+  vec_deinit(&health_entries);
+  pthread_mutex_destroy(&health_mutex);
+
+  health_started = false;
+}
+
+bool xps_health_is_up(xps_health_entry_t *entry, u_long now_msec) {
+  assert(entry != NULL);
+
+  return !__atomic_load_n(&(entry->probe_down), __ATOMIC_RELAXED) &&
+         now_msec >= __atomic_load_n(&(entry->ejected_until_msec), __ATOMIC_RELAXED);
+}
+
+/* Passive outlier detection, fed by the sessions of every core */
+void xps_health_report(xps_health_entry_t *entry, bool success, u_long now_msec) {
+  assert(entry != NULL);
+
+  if (success) {
+    __atomic_store_n(&(entry->passive_fails), 0, __ATOMIC_RELAXED);
+    return;
+  }
+
+  u_int fails = __atomic_add_fetch(&(entry->passive_fails), 1, __ATOMIC_RELAXED);
+  if (fails < DEFAULT_HEALTH_MAX_FAILS)
+    return;
+
+  __atomic_store_n(&(entry->passive_fails), 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&(entry->ejected_until_msec), now_msec + DEFAULT_HEALTH_EJECT_MSEC,
+                   __ATOMIC_RELAXED);
+  __atomic_add_fetch(&(entry->ejections), 1, __ATOMIC_RELAXED);
+
+  logger(LOG_WARNING, "xps_health_report()", "ejected upstream %s after %u failures",
+         entry->upstream, fails);
+}
+
+void xps_health_conn_start(xps_health_entry_t *entry) {
+  assert(entry != NULL);
+
+  __atomic_add_fetch(&(entry->active), 1, __ATOMIC_RELAXED);
+}
+
+void xps_health_conn_end(xps_health_entry_t *entry) {
+  assert(entry != NULL);
+
+  __atomic_sub_fetch(&(entry->active), 1, __ATOMIC_RELAXED);
+}
+
+u_int xps_health_active(xps_health_entry_t *entry) {
+  assert(entry != NULL);
+
+  return __atomic_load_n(&(entry->active), __ATOMIC_RELAXED);
+}
+
+/*
+ * Peak-EWMA: a slower sample takes effect at once, faster ones are averaged
+ * in. Updates from different cores may race; losing one sample is harmless.
+ */
+void xps_health_observe(xps_health_entry_t *entry, u_long latency_msec, u_long now_msec) {
+  assert(entry != NULL);
+
+  u_long sample_usec = latency_msec * 1000;
+  u_long ewma_usec = health_ewma_decayed(entry, now_msec);
+
+  if (sample_usec > ewma_usec)
+    ewma_usec = sample_usec;
+  else
+    ewma_usec = ewma_usec - ewma_usec / 8 + sample_usec / 8;
+
+  __atomic_store_n(&(entry->ewma_usec), ewma_usec, __ATOMIC_RELAXED);
+  __atomic_store_n(&(entry->ewma_stamp_msec), now_msec, __ATOMIC_RELAXED);
+}
+
+/* Expected wait on this upstream: latency times the requests queued on it */
+u_long xps_health_cost(xps_health_entry_t *entry, u_long now_msec) {
+  assert(entry != NULL);
+
+  return (health_ewma_decayed(entry, now_msec) + 1) * (xps_health_active(entry) + 1);
+}
+
+xps_buffer_t *xps_health_get_json(u_long now_msec) {
+  pthread_mutex_lock(&health_mutex);
+
+  size_t size = 3;
+  for (int i = 0; i < health_entries.length; i++) {
+    xps_health_entry_t *entry = health_entries.data[i];
+    size += strlen(entry->upstream) + 128;
+  }
+
+  xps_buffer_t *buff = xps_buffer_create(size, 0, NULL);
+  if (buff == NULL) {
+    logger(LOG_ERROR, "xps_health_get_json()", "xps_buffer_create() failed");
+    pthread_mutex_unlock(&health_mutex);
+    return NULL;
+  }
+
+  char *data = (char *)buff->data;
+  size_t len = snprintf(data, size, "[");
+  for (int i = 0; i < health_entries.length; i++) {
+    xps_health_entry_t *entry = health_entries.data[i];
+    len += snprintf(data + len, size - len,
+                    "%s{\"upstream\": \"%s\",\"healthy\": %s,\"ejections\": %lu,"
+                    "\"active\": %u,\"ewma_usec\": %lu}",
+                    i == 0 ? "" : ",", entry->upstream,
+                    xps_health_is_up(entry, now_msec) ? "true" : "false",
+                    __atomic_load_n(&(entry->ejections), __ATOMIC_RELAXED),
+                    xps_health_active(entry), health_ewma_decayed(entry, now_msec));
+  }
+  len += snprintf(data + len, size - len, "]");
+  buff->len = len;
+
+  pthread_mutex_unlock(&health_mutex);
+
+  return buff;
+}
+
+xps_health_entry_t *health_entry_get(const char *upstream) {
+  assert(upstream != NULL);
+
+  for (int i = 0; i < health_entries.length; i++) {
+    xps_health_entry_t *entry = health_entries.data[i];
+    if (strcmp(entry->upstream, upstream) == 0)
+      return entry;
+  }
+
+  char host[128];
+  u_int port = 0;
+  if (sscanf(upstream, "%127[^:]:%u", host, &port) != 2 || !is_valid_port(port)) {
+    logger(LOG_ERROR, "health_entry_get()", "invalid upstream '%s'", upstream);
+    return NULL;
+  }
+
+  xps_health_entry_t *entry = malloc(sizeof(xps_health_entry_t));
+  if (entry == NULL) {
+    logger(LOG_ERROR, "health_entry_get()", "malloc() failed for 'entry'");
+    return NULL;
+  }
+
+  entry->upstream = strdup(upstream);
+  entry->host = strdup(host);
+  entry->port = port;
+  entry->probe_type = NULL;
+  entry->probe_path = NULL;
+  entry->probe_interval_msec = 0;
+  entry->next_probe_msec = 0;
+  entry->probe_fails = 0;
+  entry->probing = false;
+  entry->active = 0;
+  entry->ewma_usec = 0;
+  entry->ewma_stamp_msec = 0;
+  entry->probe_down = false;
+  entry->passive_fails = 0;
+  entry->ejected_until_msec = 0;
+  entry->ejections = 0;
+
+  vec_push(&health_entries, entry);
+
+  return entry;
+}
+
+/*
+ * Sets the active checks of every entry from config, on the probing core.
+ * Entries point into config, which that core keeps until it moves off it.
+ */
+void health_configure(xps_config_t *config) {
+  assert(config != NULL);
+
+  bool has_probes = false;
+
+  pthread_mutex_lock(&health_mutex);
+  for (int i = 0; i < health_entries.length; i++) {
+    xps_health_entry_t *entry = health_entries.data[i];
+    entry->probe_type = NULL;
+    entry->probe_path = NULL;
+  }
+
+  for (int i = 0; i < config->_all_routes.length; i++) {
+    xps_config_route_t *route = config->_all_routes.data[i];
+    for (int j = 0; j < route->_upstream_health.length; j++) {
+      xps_health_entry_t *entry = route->_upstream_health.data[j];
+
+      // The first route that asks for active checks decides how they are done
+      if (route->health_check_type != NULL && entry->probe_type == NULL) {
+        entry->probe_type = route->health_check_type;
+        entry->probe_path = route->health_check_path;
+        entry->probe_interval_msec = route->health_check_interval_msec;
+        has_probes = true;
+      }
+    }
+  }
+  pthread_mutex_unlock(&health_mutex);
+
+  if (has_probes && health_timer == NULL) {
+    health_timer =
+      xps_timer_create(health_core, DEFAULT_HEALTH_CHECK_TICK_MSEC, health_core, health_timer_handler);
+    if (health_timer == NULL)
+      logger(LOG_ERROR, "health_configure()", "xps_timer_create() failed");
+  }
+}
+
+void health_timer_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_core_t *core = ptr;
+
+  pthread_mutex_lock(&health_mutex);
+  for (int i = 0; i < health_entries.length; i++) {
+    xps_health_entry_t *entry = health_entries.data[i];
+    if (entry->probe_type == NULL || entry->probing || core->curr_time_msec < entry->next_probe_msec)
+      continue;
+
+    entry->next_probe_msec = core->curr_time_msec + entry->probe_interval_msec;
+    health_probe_start(core, entry);
+  }
+  pthread_mutex_unlock(&health_mutex);
+
+  xps_timer_update(health_timer, DEFAULT_HEALTH_CHECK_TICK_MSEC);
+}
+
+void health_probe_start(xps_core_t *core, xps_health_entry_t *entry) {
+  assert(core != NULL);
+  assert(entry != NULL);
+
+  struct sockaddr_in addr;
+  if (xps_dns_cache_lookup(core->dns_cache, entry->host, entry->port, &addr) != OK) {
+    // Unresolvable counts as unreachable, so the upstream can still be ejected
+    logger(LOG_DEBUG, "health_probe_start()", "no resolved address for %s", entry->upstream);
+    health_probe_result(entry, false);
+    return;
+  }
+
+  xps_health_probe_t *probe = malloc(sizeof(xps_health_probe_t));
+  if (probe == NULL) {
+    logger(LOG_ERROR, "health_probe_start()", "malloc() failed for 'probe'");
+    return;
+  }
+
+  probe->core = core;
+  probe->entry = entry;
+  probe->connected = false;
+  probe->sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (probe->sock_fd < 0) {
+    logger(LOG_ERROR, "health_probe_start()", "socket() failed");
+    free(probe);
+    return;
+  }
+
+  if (connect(probe->sock_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 &&
+      errno != EINPROGRESS) {
+    close(probe->sock_fd);
+    free(probe);
+    health_probe_result(entry, false);
+    return;
+  }
+
+  probe->timer =
+    xps_timer_create(core, DEFAULT_HEALTH_CHECK_TIMEOUT_MSEC, probe, health_probe_timeout_handler);
+  if (probe->timer == NULL) {
+    logger(LOG_ERROR, "health_probe_start()", "xps_timer_create() failed");
+    close(probe->sock_fd);
+    free(probe);
+    return;
+  }
+
+  if (xps_loop_attach(core->loop, probe->sock_fd, EPOLLIN | EPOLLOUT | EPOLLET, probe,
+                      health_probe_read_handler, health_probe_write_handler,
+                      health_probe_close_handler) != OK) {
+    logger(LOG_ERROR, "health_probe_start()", "xps_loop_attach() failed");
+    xps_timer_destroy(probe->timer);
+    close(probe->sock_fd);
+    free(probe);
+    return;
+  }
+
+  entry->probing = true;
+  vec_push(&health_probes, probe);
+}
+
+/* Tears down a probe and records its result */
+void health_probe_finish(xps_health_probe_t *probe, bool success) {
+  assert(probe != NULL);
+
+  xps_health_entry_t *entry = probe->entry;
+
+  xps_loop_detach(probe->core->loop, probe->sock_fd);
+  xps_timer_destroy(probe->timer);
+  close(probe->sock_fd);
+  vec_remove(&health_probes, probe);
+  free(probe);
+
+  entry->probing = false;
+  health_probe_result(entry, success);
+}
+
+void health_probe_result(xps_health_entry_t *entry, bool success) {
+  assert(entry != NULL);
+
+  if (success) {
+    entry->probe_fails = 0;
+    if (__atomic_load_n(&(entry->probe_down), __ATOMIC_RELAXED))
+      logger(LOG_INFO, "health_probe_result()", "upstream %s is healthy again", entry->upstream);
+    __atomic_store_n(&(entry->probe_down), false, __ATOMIC_RELAXED);
+    __atomic_store_n(&(entry->ejected_until_msec), 0, __ATOMIC_RELAXED);
+    return;
+  }
+
+  entry->probe_fails++;
+  if (entry->probe_fails >= DEFAULT_HEALTH_PROBE_FAILS &&
+      !__atomic_load_n(&(entry->probe_down), __ATOMIC_RELAXED)) {
+    __atomic_store_n(&(entry->probe_down), true, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(entry->ejections), 1, __ATOMIC_RELAXED);
+    logger(LOG_WARNING, "health_probe_result()", "upstream %s failed %u health checks",
+           entry->upstream, entry->probe_fails);
+  }
+}
+
+/* Connected; a TCP check is done, an HTTP check sends its request */
+void health_probe_write_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_health_probe_t *probe = ptr;
+  if (probe->connected)
+    return;
+
+  int sock_error = 0;
+  socklen_t sock_error_len = sizeof(sock_error);
+  if (getsockopt(probe->sock_fd, SOL_SOCKET, SO_ERROR, &sock_error, &sock_error_len) < 0 ||
+      sock_error != 0) {
+    health_probe_finish(probe, false);
+    return;
+  }
+  probe->connected = true;
+
+  // A reload may have turned the checks of this upstream off since the probe started
+  xps_health_entry_t *entry = probe->entry;
+  if (entry->probe_type == NULL || strcmp(entry->probe_type, "tcp") == 0) {
+    health_probe_finish(probe, true);
+    return;
+  }
+
+  char req[512];
+  int req_len = snprintf(req, sizeof(req),
+                         "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: " SERVER_NAME
+                         "\r\nConnection: close\r\n\r\n",
+                         entry->probe_path, entry->host);
+  if (req_len < 0 || (size_t)req_len >= sizeof(req) ||
+      send(probe->sock_fd, req, req_len, MSG_NOSIGNAL) != req_len)
+    health_probe_finish(probe, false);
+}
+
+/* An HTTP check passes on a 2xx or 3xx status line */
+void health_probe_read_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_health_probe_t *probe = ptr;
+  if (!probe->connected)
+    return;
+
+  char status_line[32];
+  ssize_t read_n = recv(probe->sock_fd, status_line, sizeof(status_line) - 1, 0);
+  if (read_n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return;
+  if (read_n <= 0) {
+    health_probe_finish(probe, false);
+    return;
+  }
+  status_line[read_n] = '\0';
+
+  u_int status_code = 0;
+  bool success = sscanf(status_line, "HTTP/1.%*1u %3u", &status_code) == 1 &&
+                 status_code >= 200 && status_code < 400;
+  health_probe_finish(probe, success);
+}
+
+void health_probe_close_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  health_probe_finish(ptr, false);
+}
+
+void health_probe_timeout_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_health_probe_t *probe = ptr;
+  logger(LOG_DEBUG, "health_probe_timeout_handler()", "health check of %s timed out",
+         probe->entry->upstream);
+  health_probe_finish(probe, false);
+}
+
+/* The EWMA halves for every DEFAULT_EWMA_HALF_LIFE_MSEC without samples, so a
+ * slow upstream that recovered gets picked again */
+u_long health_ewma_decayed(xps_health_entry_t *entry, u_long now_msec) {
+  assert(entry != NULL);
+
+  u_long ewma_usec = __atomic_load_n(&(entry->ewma_usec), __ATOMIC_RELAXED);
+  u_long stamp_msec = __atomic_load_n(&(entry->ewma_stamp_msec), __ATOMIC_RELAXED);
+  if (now_msec <= stamp_msec)
+    return ewma_usec;
+
+  u_long half_lives = (now_msec - stamp_msec) / DEFAULT_EWMA_HALF_LIFE_MSEC;
+
+  return half_lives >= 64 ? 0 : ewma_usec >> half_lives;
+}
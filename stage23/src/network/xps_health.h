@@ -0,0 +1,60 @@
+#ifndef XPS_HEALTH_H
+#define XPS_HEALTH_H
+
+#include "../xps.h"
+
+/*
+ * Health of one distinct upstream, shared by every route and core that uses
+ * it. Fields marked shared are read and written with __atomic builtins.
+ */
+struct xps_health_entry_s {
+  char *upstream; // "host:port" as written in the config
+  char *host;
+  u_int port;
+
+  /* active checks, only touched by the probing core */
+  const char *probe_type; // NULL, "tcp" or "http"
+  const char *probe_path;
+  u_long probe_interval_msec;
+  u_long next_probe_msec;
+  u_int probe_fails;
+  bool probing;
+
+  /* shared, load balancing */
+  u_int active;           // sessions proxying to this upstream on all cores
+  u_long ewma_usec;       // peak-EWMA of response latency
+  u_long ewma_stamp_msec; // time of the last latency sample
+
+  /* shared, health */
+  bool probe_down;           // failed DEFAULT_HEALTH_PROBE_FAILS probes in a row
+  u_int passive_fails;       // proxied requests that failed in a row
+  u_long ejected_until_msec; // set by passive detection
+  u_long ejections;
+};
+
+/* One in-flight active check */
+struct xps_health_probe_s {
+  xps_core_t *core;
+  xps_health_entry_t *entry;
+  int sock_fd;
+  bool connected;
+  xps_timer_t *timer;
+};
+
+int xps_health_start(xps_config_t *config, xps_core_t *core);
+int xps_health_attach(xps_config_t *config);
+void xps_health_update(xps_core_t *core, xps_config_t *config);
+void xps_health_stop();
+void xps_health_destroy();
+
+bool xps_health_is_up(xps_health_entry_t *entry, u_long now_msec);
+void xps_health_report(xps_health_entry_t *entry, bool success, u_long now_msec);
+xps_buffer_t *xps_health_get_json(u_long now_msec);
+
+void xps_health_conn_start(xps_health_entry_t *entry);
+void xps_health_conn_end(xps_health_entry_t *entry);
+u_int xps_health_active(xps_health_entry_t *entry);
+void xps_health_observe(xps_health_entry_t *entry, u_long latency_msec, u_long now_msec);
+u_long xps_health_cost(xps_health_entry_t *entry, u_long now_msec);
+
+#endif
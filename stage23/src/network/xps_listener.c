@@ -1,6 +1,8 @@
 #include "xps_listener.h"
 
-xps_listener_t *xps_listener_create(const char *host, u_int port) {
+bool listener_ip_allowed(xps_listener_t *listener, const struct sockaddr *addr);
+
+xps_listener_t *xps_listener_create(const char *host, u_int port, u_int backlog) {
   assert(host != NULL);
   assert(is_valid_port(port)); // Will be explained later
 
@@ -41,7 +43,7 @@ xps_listener_t *xps_listener_create(const char *host, u_int port) {
   freeaddrinfo(addr_info); // Will be explained later
 
   // Listening on port
-  if (listen(sock_fd, DEFAULT_BACKLOG) < 0) {
+  if (listen(sock_fd, backlog) < 0) {
     logger(LOG_ERROR, "xps_listener_create()", "listen() failed");
     perror("Error message");
     close(sock_fd);
@@ -61,6 +63,9 @@ xps_listener_t *xps_listener_create(const char *host, u_int port) {
   listener->host = host;
   listener->port = port;
   listener->sock_fd = sock_fd;
+  listener->tcp_route = NULL;
+  listener->acl_routes = NULL;
+  listener->conf = NULL;
 
   // // Attach listener to loop
   // xps_loop_attach(core->loop, sock_fd, EPOLLIN | EPOLLET, listener,
@@ -94,8 +99,9 @@ void xps_listener_destroy(xps_listener_t *listener) {
     }
   }
 
-  // Close socket
-  close(listener->sock_fd);
+  // Close socket, unless xps_listener_close() already has
+  if (listener->sock_fd != (u_int)-1)
+    close(listener->sock_fd);
 
   logger(LOG_DEBUG, "xps_listener_destroy()", "destroyed listener on port %d", listener->port);
 
@@ -103,16 +109,84 @@ void xps_listener_destroy(xps_listener_t *listener) {
   free(listener);
 }
 
+/* Attaches a copy of listener's socket to core, so every core accepts on it */
+xps_listener_t *xps_listener_dup(xps_listener_t *listener, xps_core_t *core) {
+  assert(listener != NULL);
+  assert(core != NULL);
+
+  xps_listener_t *dup_listener = malloc(sizeof(xps_listener_t));
+  if (dup_listener == NULL) {
+    logger(LOG_ERROR, "xps_listener_dup()", "malloc() failed for 'dup_listener'");
+    return NULL;
+  }
+
+  // Init values
+  dup_listener->core = core;
+  dup_listener->host = listener->host;
+  dup_listener->port = listener->port;
+  dup_listener->tcp_route = listener->tcp_route;
+  dup_listener->acl_routes = listener->acl_routes;
+  dup_listener->conf = listener->conf;
+
+  int new_sock_fd = dup(listener->sock_fd);
+  if (new_sock_fd == -1) {
+    logger(LOG_ERROR, "xps_listener_dup()", "dup() failed");
+    perror("Error message");
+    free(dup_listener);
+    return NULL;
+  }
+  dup_listener->sock_fd = new_sock_fd;
+
+  // Attach listener to loop
+  if (xps_loop_attach(core->loop, dup_listener->sock_fd, EPOLLIN | EPOLLET, dup_listener,
+                      xps_listener_connection_handler, NULL, NULL) != OK) {
+    logger(LOG_ERROR, "xps_listener_dup()", "xps_loop_attach() failed");
+    close(dup_listener->sock_fd);
+    free(dup_listener);
+    return NULL;
+  }
+
+  // Add listener to 'listeners' list of core
+  vec_push(&(core->listeners), dup_listener);
+
+  return dup_listener;
+}
+
+/*
+ * Stops accepting on listener and takes it off its core. The struct stays
+ * valid for connections it accepted earlier, until xps_listener_destroy().
+ */
+void xps_listener_close(xps_listener_t *listener) {
+  assert(listener != NULL);
+  assert(listener->core != NULL);
+
+  xps_loop_detach(listener->core->loop, listener->sock_fd);
+
+  for (int i = 0; i < listener->core->listeners.length; i++) {
+    if (listener->core->listeners.data[i] == listener) {
+      listener->core->listeners.data[i] = NULL;
+      listener->core->n_null_listeners++;
+      break;
+    }
+  }
+
+  close(listener->sock_fd);
+  listener->sock_fd = -1;
+  listener->core = NULL;
+
+  logger(LOG_DEBUG, "xps_listener_close()", "closed listener on port %d", listener->port);
+}
+
 void xps_listener_connection_handler(void *ptr) {
   assert(ptr != NULL);
   xps_listener_t *listener = ptr;
 
   while (1) {
-    struct sockaddr conn_addr;
+    struct sockaddr_storage conn_addr;
     socklen_t conn_addr_len = sizeof(conn_addr);
 
     // Accepting connection
-    int conn_sock_fd = accept(listener->sock_fd, &conn_addr, &conn_addr_len);
+    int conn_sock_fd = accept(listener->sock_fd, (struct sockaddr *)&conn_addr, &conn_addr_len);
 
     if (conn_sock_fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
       break;
@@ -125,6 +199,12 @@ void xps_listener_connection_handler(void *ptr) {
       return;
     }
 
+    // Clients no route would serve are closed before anything is allocated for them
+    if (!listener_ip_allowed(listener, (struct sockaddr *)&conn_addr)) {
+      close(conn_sock_fd);
+      continue;
+    }
+
     if (make_socket_non_blocking(conn_sock_fd) != OK) {
       logger(LOG_ERROR, "xps_listener_create()", "make_socket_non_blocking() failed");
       close(conn_sock_fd);
@@ -144,6 +224,16 @@ void xps_listener_connection_handler(void *ptr) {
       return;
     }
     client->listener = listener;
+    client->buffer_size = listener->conf->buffer_size;
+
+    // Streams of a tcp_proxy listener are spliced straight to an upstream
+    if (listener->tcp_route) {
+      if (xps_tcp_session_create(listener->core, client, listener->tcp_route) == NULL) {
+        logger(LOG_ERROR, "listener_connection_handler()", "xps_tcp_session_create() failed");
+        xps_connection_destroy(client);
+      }
+      continue;
+    }
 
     xps_session_t *session = xps_session_create(listener->core, client);
     if (session == NULL) {
@@ -155,4 +245,28 @@ void xps_listener_connection_handler(void *ptr) {
 
     logger(LOG_INFO, "xps_listener_connection_handler()", "new connection");
   }
-}
\ No newline at end of file
+}
+
+/* Whether some route of the listener would serve a client at addr */
+bool listener_ip_allowed(xps_listener_t *listener, const struct sockaddr *addr) {
+  assert(listener != NULL);
+  assert(addr != NULL);
+
+  if (listener->acl_routes == NULL || listener->acl_routes->length == 0)
+    return true;
+
+  struct in6_addr client_addr;
+  if (addr_from_sockaddr(addr, &client_addr) != OK)
+    return true;
+
+  for (int i = 0; i < listener->acl_routes->length; i++) {
+    if (xps_config_ip_allowed(listener->acl_routes->data[i], &client_addr))
+      return true;
+  }
+
+  char client_ip[INET6_ADDRSTRLEN];
+  addr_to_str(&client_addr, client_ip, sizeof(client_ip));
+  logger(LOG_DEBUG, "listener_ip_allowed()", "client ip %s is not allowed", client_ip);
+
+  return false;
+}
@@ -9,11 +9,16 @@ struct xps_listener_s {
   const char *host;
   u_int port;
   u_int sock_fd;
+  xps_config_route_t *tcp_route; // set for tcp_proxy listeners, NULL for http
+  vec_void_t *acl_routes; // a client must be allowed by one of these, when not empty
+  xps_config_listener_t *conf; // tuning for its clients, from the config being served
 };
 
 
-xps_listener_t *xps_listener_create( const char *host, u_int port);
+xps_listener_t *xps_listener_create(const char *host, u_int port, u_int backlog);
 void xps_listener_destroy(xps_listener_t *listener);
+xps_listener_t *xps_listener_dup(xps_listener_t *listener, xps_core_t *core);
+void xps_listener_close(xps_listener_t *listener);
 void xps_listener_connection_handler(void *ptr);
 
 
@@ -1,35 +1,38 @@
 #include "xps_upstream.h"
 
+bool upstream_is_alive(xps_connection_t *connection);
+
 xps_connection_t *xps_upstream_create(xps_core_t *core, const char *host, u_int port) {
   /* validate parameter */
   assert(core != NULL);
   assert(host != NULL);
   assert(is_valid_port(port));
 
-  int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sock_fd < 0) {
-    logger(LOG_ERROR, "xps_upstream_create()", "socket() failed");
-    perror("Error message");
+  /* address comes from the core's DNS cache, which the resolver thread keeps
+   * fresh, so the loop never waits on name resolution */
+  struct sockaddr_in upstream_addr;
+  int lookup_error = xps_dns_cache_lookup(core->dns_cache, host, port, &upstream_addr);
+  if (lookup_error != OK) {
+    logger(LOG_ERROR, "xps_upstream_create()", "no resolved address for %s:%u%s", host, port,
+           lookup_error == E_AGAIN ? " yet" : "");
     return NULL;
   }
 
-  /* create a socket and connect to host and port to upstream using
-   * xps_getaddrinfo and connect function */
-
-  struct addrinfo *upstream_addrinfo = xps_getaddrinfo(host, port);
-  if (upstream_addrinfo == NULL) {
-    logger(LOG_ERROR, "xps_upstream_create()", "getaddrinfo() failed");
+  int sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (sock_fd < 0) {
+    logger(LOG_ERROR, "xps_upstream_create()", "socket() failed");
     perror("Error message");
-    close(sock_fd);
     return NULL;
   }
 
-  int connect_error = connect(sock_fd, upstream_addrinfo->ai_addr, upstream_addrinfo->ai_addrlen);
+  /* start a non-blocking connect; completion is checked on the first EPOLLOUT */
+  u_long connect_start_usec = monotonic_usec();
+  int connect_error =
+    connect(sock_fd, (struct sockaddr *)&upstream_addr, sizeof(upstream_addr));
 
   if (!(connect_error == 0 || errno == EINPROGRESS)) {
     logger(LOG_ERROR, "xps_upstream_create()", "connect() failed");
     perror("Error message");
-    freeaddrinfo(upstream_addrinfo);
     close(sock_fd);
     return NULL;
   }
@@ -39,14 +42,122 @@ xps_connection_t *xps_upstream_create(xps_core_t *core, const char *host, u_int
   if (connection == NULL) {
     logger(LOG_ERROR, "xps_upstream_create()", "xps_connection_create() failed");
     perror("Error message");
-    freeaddrinfo(upstream_addrinfo);
     close(sock_fd);
     return NULL;
   }
+  connection->connecting = connect_error != 0;
+  connection->connect_start_usec = connect_start_usec;
+  if (!connection->connecting)
+    xps_metrics_set(core, M_UPSTREAM_CONNECT_TIME, monotonic_usec() - connect_start_usec);
 
   logger(LOG_DEBUG, "xps_upstream_create()", "upstream connection created");
 
-  freeaddrinfo(upstream_addrinfo);
-
   return connection;
-}
\ No newline at end of file
+}
+
+/* Takes the most recently parked live connection to upstream out of the pool */
+xps_connection_t *xps_upstream_pool_get(xps_core_t *core, const char *upstream) {
+  assert(core != NULL);
+  assert(upstream != NULL);
+
+  for (int i = core->upstream_pool.length - 1; i >= 0; i--) {
+    xps_upstream_idle_t *idle = core->upstream_pool.data[i];
+    if (strcmp(idle->upstream, upstream) != 0)
+      continue;
+
+    xps_connection_t *connection = idle->connection;
+    if (!upstream_is_alive(connection)) {
+      // Destroying it drops the pool entry and counts an eviction
+      xps_connection_destroy(connection);
+      continue;
+    }
+
+    vec_splice(&(core->upstream_pool), i, 1);
+    free(idle->upstream);
+    free(idle);
+
+    connection->pooled = false;
+    connection->sink->ready = true;
+    xps_metrics_set(core, M_UPSTREAM_POOL_HIT, 1);
+
+    return connection;
+  }
+
+  xps_metrics_set(core, M_UPSTREAM_POOL_MISS, 1);
+
+  return NULL;
+}
+
+/* Parks a connection that is detached from all pipes; the oldest one goes when the pool is full */
+void xps_upstream_pool_put(xps_core_t *core, xps_connection_t *connection, const char *upstream) {
+  assert(core != NULL);
+  assert(connection != NULL);
+  assert(upstream != NULL);
+
+  xps_upstream_idle_t *idle = malloc(sizeof(xps_upstream_idle_t));
+  if (idle == NULL) {
+    logger(LOG_ERROR, "xps_upstream_pool_put()", "malloc() failed for 'idle'");
+    xps_connection_destroy(connection);
+    return;
+  }
+
+  if (core->upstream_pool.length >= DEFAULT_UPSTREAM_POOL_SIZE) {
+    xps_upstream_idle_t *oldest = core->upstream_pool.data[0];
+    xps_connection_destroy(oldest->connection);
+  }
+
+  idle->connection = connection;
+  idle->upstream = strdup(upstream);
+  idle->idle_since_msec = core->curr_time_msec;
+
+  connection->pooled = true;
+  connection->source->active = false;
+  connection->sink->active = false;
+
+  vec_push(&(core->upstream_pool), idle);
+}
+
+/* Drops the pool entry of a pooled connection that is being destroyed */
+void xps_upstream_pool_remove(xps_core_t *core, xps_connection_t *connection) {
+  assert(core != NULL);
+  assert(connection != NULL);
+
+  for (int i = 0; i < core->upstream_pool.length; i++) {
+    xps_upstream_idle_t *idle = core->upstream_pool.data[i];
+    if (idle->connection == connection) {
+      vec_splice(&(core->upstream_pool), i, 1);
+      free(idle->upstream);
+      free(idle);
+      xps_metrics_set(core, M_UPSTREAM_POOL_EVICT, 1);
+      break;
+    }
+  }
+
+  connection->pooled = false;
+}
+
+void xps_upstream_pool_sweep_handler(void *ptr) {
+  assert(ptr != NULL);
+
+  xps_core_t *core = ptr;
+
+  // Entries are in the order they were parked, so stop at the first fresh one
+  while (core->upstream_pool.length > 0) {
+    xps_upstream_idle_t *idle = core->upstream_pool.data[0];
+    if (core->curr_time_msec - idle->idle_since_msec < DEFAULT_UPSTREAM_IDLE_TIMEOUT_MSEC)
+      break;
+    xps_connection_destroy(idle->connection);
+  }
+
+  xps_timer_update(core->upstream_pool_timer, DEFAULT_UPSTREAM_POOL_SWEEP_MSEC);
+}
+
+/* An idle upstream must have nothing to read; data or EOF means it can't be reused */
+bool upstream_is_alive(xps_connection_t *connection) {
+  assert(connection != NULL);
+
+  u_char ch;
+  ssize_t read_n = recv(connection->sock_fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+
+  return read_n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
@@ -3,6 +3,18 @@
 
 #include "../xps.h"
 
+/* Idle keep-alive connection parked in a core's upstream pool */
+struct xps_upstream_idle_s {
+  xps_connection_t *connection;
+  char *upstream; // "host:port" as written in the config
+  u_long idle_since_msec;
+};
+
 xps_connection_t *xps_upstream_create(xps_core_t *core, const char *host, u_int port);
 
-#endif
\ No newline at end of file
+xps_connection_t *xps_upstream_pool_get(xps_core_t *core, const char *upstream);
+void xps_upstream_pool_put(xps_core_t *core, xps_connection_t *connection, const char *upstream);
+void xps_upstream_pool_remove(xps_core_t *core, xps_connection_t *connection);
+void xps_upstream_pool_sweep_handler(void *ptr);
+
+#endif
@@ -0,0 +1,181 @@
+#include "xps_acl.h"
+
+int acl_node_create(xps_acl_t *acl);
+int acl_parse(const char *cidr, struct in6_addr *addr, u_int *prefix_len);
+void acl_find_v4_root(xps_acl_t *acl);
+
+xps_acl_t *xps_acl_create() {
+  xps_acl_t *acl = malloc(sizeof(xps_acl_t));
+  if (acl == NULL) {
+    logger(LOG_ERROR, "xps_acl_create()", "malloc() failed for 'acl'");
+    return NULL;
+  }
+
+  acl->nodes = NULL;
+  acl->n_nodes = 0;
+  acl->size = 0;
+  acl->n_prefixes = 0;
+  acl->v4_root = 0;
+  acl->v4_all = false;
+
+  // Root
+  if (acl_node_create(acl) < 0) {
+    logger(LOG_ERROR, "xps_acl_create()", "acl_node_create() failed");
+    free(acl);
+    return NULL;
+  }
+
+  return acl;
+}
+
+void xps_acl_destroy(xps_acl_t *acl) {
+  assert(acl != NULL);
+
+  free(acl->nodes);
+  free(acl);
+}
+
+/* Adds "a.b.c.d", "a.b.c.d/n", an IPv6 address or an IPv6 "addr/n" */
+int xps_acl_add(xps_acl_t *acl, const char *cidr) {
+  assert(acl != NULL);
+  assert(cidr != NULL);
+
+  struct in6_addr addr;
+  u_int prefix_len;
+  if (acl_parse(cidr, &addr, &prefix_len) != OK) {
+    logger(LOG_ERROR, "xps_acl_add()", "invalid address or prefix '%s'", cidr);
+    return E_FAIL;
+  }
+
+  u_int node = 0;
+  for (u_int i = 0; i < prefix_len; i++) {
+    int bit = (addr.s6_addr[i / 8] >> (7 - i % 8)) & 1;
+    if (acl->nodes[node].child[bit] == 0) {
+      int child = acl_node_create(acl);
+      if (child < 0) {
+        logger(LOG_ERROR, "xps_acl_add()", "acl_node_create() failed");
+        return E_FAIL;
+      }
+      acl->nodes[node].child[bit] = child;
+    }
+    node = acl->nodes[node].child[bit];
+  }
+
+  acl->nodes[node].match = true;
+  acl->n_prefixes++;
+  acl_find_v4_root(acl);
+
+  return OK;
+}
+
+/* Whether any prefix in acl contains addr */
+bool xps_acl_match(xps_acl_t *acl, const struct in6_addr *addr) {
+  assert(acl != NULL);
+  assert(addr != NULL);
+
+  // IPv4 skips the 96 bits every IPv4-mapped address shares
+  u_int node = 0;
+  u_int i = 0;
+  if (IN6_IS_ADDR_V4MAPPED(addr)) {
+    if (acl->v4_all)
+      return true;
+    if (acl->v4_root == 0)
+      return false;
+    node = acl->v4_root;
+    i = 96;
+  }
+
+  for (; i < 128; i++) {
+    if (acl->nodes[node].match)
+      return true;
+    int bit = (addr->s6_addr[i / 8] >> (7 - i % 8)) & 1;
+    node = acl->nodes[node].child[bit];
+    if (node == 0)
+      return false;
+  }
+
+  return acl->nodes[node].match;
+}
+
+void acl_find_v4_root(xps_acl_t *acl) {
+  assert(acl != NULL);
+
+  struct in_addr any = {0};
+  struct in6_addr prefix;
+  addr_from_ipv4(&any, &prefix);
+
+  u_int node = 0;
+  acl->v4_all = false;
+  for (u_int i = 0; i < 96; i++) {
+    if (acl->nodes[node].match)
+      acl->v4_all = true;
+    int bit = (prefix.s6_addr[i / 8] >> (7 - i % 8)) & 1;
+    node = acl->nodes[node].child[bit];
+    if (node == 0)
+      break;
+  }
+  acl->v4_root = node;
+}
+
+/* Index of a new empty node, or -1 */
+int acl_node_create(xps_acl_t *acl) {
+  assert(acl != NULL);
+
+  if (acl->n_nodes == acl->size) {
+    u_int size = acl->size ? acl->size * 2 : 64;
+    xps_acl_node_t *nodes = realloc(acl->nodes, sizeof(xps_acl_node_t) * size);
+    if (nodes == NULL) {
+      logger(LOG_ERROR, "acl_node_create()", "realloc() failed for 'nodes'");
+      return -1;
+    }
+    acl->nodes = nodes;
+    acl->size = size;
+  }
+
+  xps_acl_node_t *node = &(acl->nodes[acl->n_nodes]);
+  node->child[0] = 0;
+  node->child[1] = 0;
+  node->match = false;
+
+  return acl->n_nodes++;
+}
+
+int acl_parse(const char *cidr, struct in6_addr *addr, u_int *prefix_len) {
+  assert(cidr != NULL);
+  assert(addr != NULL);
+  assert(prefix_len != NULL);
+
+  char ip[INET6_ADDRSTRLEN];
+  const char *slash = strchr(cidr, '/');
+  size_t ip_len = slash ? (size_t)(slash - cidr) : strlen(cidr);
+  if (ip_len == 0 || ip_len >= sizeof(ip))
+    return E_FAIL;
+  memcpy(ip, cidr, ip_len);
+  ip[ip_len] = '\0';
+
+  u_int max_len;
+  struct in_addr addr4;
+  if (inet_pton(AF_INET, ip, &addr4) == 1) {
+    addr_from_ipv4(&addr4, addr);
+    max_len = 32;
+  } else if (inet_pton(AF_INET6, ip, addr) == 1) {
+    max_len = 128;
+  } else {
+    return E_FAIL;
+  }
+
+  *prefix_len = max_len;
+  if (slash) {
+    char *end;
+    long len = strtol(slash + 1, &end, 10);
+    if (slash[1] == '\0' || *end != '\0' || len < 0 || len > max_len)
+      return E_FAIL;
+    *prefix_len = len;
+  }
+
+  // IPv4 prefixes sit below ::ffff:0:0/96
+  if (max_len == 32)
+    *prefix_len += 96;
+
+  return OK;
+}
@@ -0,0 +1,31 @@
+#ifndef XPS_ACL_H
+#define XPS_ACL_H
+
+#include "../xps.h"
+
+/* Child 0 means none; the root is node 0, so it is never anyone's child */
+struct xps_acl_node_s {
+  u_int child[2];
+  bool match; // a prefix ends here
+};
+
+/*
+ * A set of IPv4 and IPv6 prefixes, as a binary trie over 128-bit addresses.
+ * IPv4 is kept as IPv4-mapped IPv6 (::ffff:a.b.c.d), so one walk of at most
+ * 128 steps answers either family. Nodes live in one array for locality.
+ */
+struct xps_acl_s {
+  xps_acl_node_t *nodes;
+  u_int n_nodes;
+  u_int size;
+  u_int n_prefixes;
+  u_int v4_root; // node of ::ffff:0:0/96 where IPv4 walks start, 0 if absent
+  bool v4_all;   // a prefix of /96 or shorter already covers all of IPv4
+};
+
+xps_acl_t *xps_acl_create();
+void xps_acl_destroy(xps_acl_t *acl);
+int xps_acl_add(xps_acl_t *acl, const char *cidr);
+bool xps_acl_match(xps_acl_t *acl, const struct in6_addr *addr);
+
+#endif
@@ -55,6 +55,32 @@ xps_buffer_t *xps_buffer_duplicate(xps_buffer_t *buff) {
   return dup_buff;
 }
 
+int xps_buffer_insert(xps_buffer_t *buff, size_t offset, const u_char *data, size_t len) {
+  assert(buff != NULL);
+  assert(data != NULL);
+  assert(offset <= buff->len);
+
+  // Grow buffer if inserted data does not fit
+  if (buff->size < buff->len + len) {
+    size_t pos_offset = buff->pos - buff->data;
+    u_char *new_data = realloc(buff->data, buff->len + len);
+    if (new_data == NULL) {
+      logger(LOG_ERROR, "xps_buffer_insert()", "realloc() failed");
+      return E_FAIL;
+    }
+    buff->data = new_data;
+    buff->pos = new_data + pos_offset;
+    buff->size = buff->len + len;
+  }
+
+  // Shift the tail and copy data into the gap
+  memmove(buff->data + offset + len, buff->data + offset, buff->len - offset);
+  memcpy(buff->data + offset, data, len);
+  buff->len += len;
+
+  return OK;
+}
+
 // xps_buffer_list
 
 xps_buffer_list_t *xps_buffer_list_create() {
@@ -94,6 +120,27 @@ void xps_buffer_list_append(xps_buffer_list_t *buff_list, xps_buffer_t *buff) {
   buff_list->len += buff->len;
 }
 
+/* Appends all of buffs or, when the list cannot grow, none of them */
+int xps_buffer_list_appendv(xps_buffer_list_t *buff_list, xps_buffer_t **buffs, int n_buffs) {
+  assert(buff_list != NULL);
+  assert(buffs != NULL);
+
+  vec_void_t *list = &(buff_list->list);
+  if (list->capacity < list->length + n_buffs) {
+    int capacity = list->capacity * 2 > list->length + n_buffs ? list->capacity * 2
+                                                                : list->length + n_buffs;
+    if (vec_reserve(list, capacity) != 0) {
+      logger(LOG_ERROR, "xps_buffer_list_appendv()", "vec_reserve() failed");
+      return E_FAIL;
+    }
+  }
+
+  for (int i = 0; i < n_buffs; i++)
+    xps_buffer_list_append(buff_list, buffs[i]);
+
+  return OK;
+}
+
 xps_buffer_t *xps_buffer_list_read(xps_buffer_list_t *buff_list, size_t len) {
   assert(buff_list != NULL);
   assert(len > 0);
@@ -165,4 +212,22 @@ int xps_buffer_list_clear(xps_buffer_list_t *buff_list, size_t len) {
   vec_filter_null(&(buff_list->list));
 
   return OK;
-}
\ No newline at end of file
+}
+
+/* Points iovecs at the buffers of the list, in order, without copying */
+int xps_buffer_list_iovec(xps_buffer_list_t *buff_list, struct iovec *iov, int iov_max) {
+  assert(buff_list != NULL);
+  assert(iov != NULL);
+
+  int n_iov = 0;
+  for (int i = 0; i < buff_list->list.length && n_iov < iov_max; i++) {
+    xps_buffer_t *curr_buff = buff_list->list.data[i];
+    if (curr_buff->len == 0)
+      continue;
+    iov[n_iov].iov_base = curr_buff->data;
+    iov[n_iov].iov_len = curr_buff->len;
+    n_iov++;
+  }
+
+  return n_iov;
+}
@@ -19,12 +19,15 @@ struct xps_buffer_list_s {
 xps_buffer_t *xps_buffer_create(size_t size, size_t len, u_char *data);
 void xps_buffer_destroy(xps_buffer_t *buff);
 xps_buffer_t *xps_buffer_duplicate(xps_buffer_t *buff);
+int xps_buffer_insert(xps_buffer_t *buff, size_t offset, const u_char *data, size_t len);
 
 // xps_buffer_list
 xps_buffer_list_t *xps_buffer_list_create();
 void xps_buffer_list_destroy(xps_buffer_list_t *buff_list);
 void xps_buffer_list_append(xps_buffer_list_t *buff_list, xps_buffer_t *buff);
+int xps_buffer_list_appendv(xps_buffer_list_t *buff_list, xps_buffer_t **buffs, int n_buffs);
 xps_buffer_t *xps_buffer_list_read(xps_buffer_list_t *buff_list, size_t len);
 int xps_buffer_list_clear(xps_buffer_list_t *buff_list, size_t len);
+int xps_buffer_list_iovec(xps_buffer_list_t *buff_list, struct iovec *iov, int iov_max);
 
 #endif
\ No newline at end of file
@@ -35,26 +35,61 @@ struct addrinfo *xps_getaddrinfo(const char *host, u_int port) {
   return result;
 }
 
-char *get_remote_ip(u_int sock_fd) {
-  struct sockaddr_in addr;
-  socklen_t addr_len = sizeof(addr);
-  char ipstr[INET_ADDRSTRLEN];
-
-  if (getpeername(sock_fd, (struct sockaddr *)&addr, &addr_len) != 0) {
-    logger(LOG_ERROR, "get_remote_ip()", "getpeername() failed");
+/* Peer address of sock_fd; E_AGAIN while an outgoing connect() is in progress */
+int get_remote_addr(u_int sock_fd, struct in6_addr *addr) {
+  assert(addr != NULL);
+
+  struct sockaddr_storage peer;
+  socklen_t peer_len = sizeof(peer);
+
+  if (getpeername(sock_fd, (struct sockaddr *)&peer, &peer_len) != 0) {
+    // Outgoing sockets have no peer until connect() completes
+    if (errno == ENOTCONN)
+      return E_AGAIN;
+    logger(LOG_ERROR, "get_remote_addr()", "getpeername() failed");
     perror("Error message");
-    return NULL;
+    return E_FAIL;
   }
 
-  char *ip_str = malloc(INET_ADDRSTRLEN);
-  if (ip_str == NULL) {
-    logger(LOG_ERROR, "get_remote_ip()", "malloc() failed for 'ip_str");
-    return NULL;
+  return addr_from_sockaddr((struct sockaddr *)&peer, addr);
+}
+
+/* IPv4 addresses become IPv4-mapped IPv6 (::ffff:a.b.c.d) */
+int addr_from_sockaddr(const struct sockaddr *sa, struct in6_addr *addr) {
+  assert(sa != NULL);
+  assert(addr != NULL);
+
+  if (sa->sa_family == AF_INET) {
+    addr_from_ipv4(&(((const struct sockaddr_in *)sa)->sin_addr), addr);
+    return OK;
+  }
+  if (sa->sa_family == AF_INET6) {
+    *addr = ((const struct sockaddr_in6 *)sa)->sin6_addr;
+    return OK;
   }
 
-  inet_ntop(AF_INET, &addr.sin_addr, ip_str, INET_ADDRSTRLEN);
+  return E_FAIL;
+}
+
+void addr_from_ipv4(const struct in_addr *addr4, struct in6_addr *addr) {
+  assert(addr4 != NULL);
+  assert(addr != NULL);
+
+  memset(addr, 0, sizeof(struct in6_addr));
+  addr->s6_addr[10] = 0xff;
+  addr->s6_addr[11] = 0xff;
+  memcpy(&(addr->s6_addr[12]), addr4, 4);
+}
+
+/* Dotted quad for IPv4-mapped addresses, IPv6 notation otherwise */
+void addr_to_str(const struct in6_addr *addr, char *str, size_t len) {
+  assert(addr != NULL);
+  assert(str != NULL);
 
-  return ip_str;
+  if (IN6_IS_ADDR_V4MAPPED(addr))
+    inet_ntop(AF_INET, &(addr->s6_addr[12]), str, len);
+  else
+    inet_ntop(AF_INET6, addr, str, len);
 }
 
 int make_socket_non_blocking(u_int sock_fd) {
@@ -93,6 +128,26 @@ void vec_filter_null(vec_void_t *v) {
   vec_deinit(&temp);
 }
 
+/* 64-bit FNV-1a followed by a murmur3 finalizer, so nearby keys spread over all bits */
+u_long hash_bytes(const void *data, size_t len, u_long seed) {
+  assert(data != NULL || len == 0);
+
+  const u_char *bytes = data;
+  u_long hash = 0xcbf29ce484222325UL ^ seed;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3UL;
+  }
+
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdUL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53UL;
+  hash ^= hash >> 33;
+
+  return hash;
+}
+
 const char *get_file_ext(const char *file_path) {
   // Find the last occurrence of dot
   const char *dot = strrchr(file_path, '.');
@@ -194,4 +249,74 @@ bool is_dir(char *path) {
 }
 
 /*Time*/
-u_long timeval_to_msec(struct timeval val) { return (val.tv_sec * 1000) + (val.tv_usec / 1000); }
\ No newline at end of file
+u_long timeval_to_msec(struct timeval val) { return (val.tv_sec * 1000) + (val.tv_usec / 1000); }
+
+/* Microseconds on CLOCK_MONOTONIC, for durations that must not jump with the wall clock */
+u_long monotonic_usec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u_long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*CPUs*/
+
+/* CPUs of the calling thread's affinity mask, in increasing order */
+int cpus_allowed(vec_int_t *cpus) {
+  assert(cpus != NULL);
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    logger(LOG_ERROR, "cpus_allowed()", "sched_getaffinity() failed");
+    perror("Error message");
+    return E_FAIL;
+  }
+
+  vec_clear(cpus);
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set))
+      vec_push(cpus, cpu);
+  }
+
+  return cpus->length > 0 ? OK : E_FAIL;
+}
+
+int cpu_pin_thread(pthread_t thread, int cpu) {
+  assert(cpu >= 0 && cpu < CPU_SETSIZE);
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+  if (err != 0) {
+    logger(LOG_ERROR, "cpu_pin_thread()", "pthread_setaffinity_np() failed for cpu %d: %s", cpu,
+           strerror(err));
+    return E_FAIL;
+  }
+
+  return OK;
+}
+
+/* NUMA node of cpu, read from sysfs; 0 when the kernel does not say */
+int cpu_node(int cpu) {
+  assert(cpu >= 0);
+
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+  DIR *dir = opendir(path);
+  if (dir == NULL)
+    return 0;
+
+  int node = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (sscanf(entry->d_name, "node%d", &node) == 1)
+      break;
+    node = 0;
+  }
+  closedir(dir);
+
+  return node;
+}
@@ -7,12 +7,16 @@
 bool is_valid_port(u_int port);
 int make_socket_non_blocking(u_int sock_fd);
 struct addrinfo *xps_getaddrinfo(const char *host, u_int port);
-char *get_remote_ip(u_int sock_fd);
+int get_remote_addr(u_int sock_fd, struct in6_addr *addr);
+int addr_from_sockaddr(const struct sockaddr *sa, struct in6_addr *addr);
+void addr_from_ipv4(const struct in_addr *addr4, struct in6_addr *addr);
+void addr_to_str(const struct in6_addr *addr, char *str, size_t len);
 
 
 // Other functions
 void vec_filter_null(vec_void_t *v);
 const char *get_file_ext(const char *file_path);
+u_long hash_bytes(const void *data, size_t len, u_long seed);
 
 // string
 char *str_from_ptrs(const char *start, const char *end);
@@ -27,6 +31,12 @@ bool is_dir(char* path);
 
 /* Time */
 u_long timeval_to_msec(struct timeval val);
+u_long monotonic_usec();
+
+/* CPUs */
+int cpus_allowed(vec_int_t *cpus);
+int cpu_pin_thread(pthread_t thread, int cpu);
+int cpu_node(int cpu);
 
 
 #endif
\ No newline at end of file
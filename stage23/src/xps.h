@@ -16,14 +16,18 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <zlib.h>
 #include <time.h>
 #include <sys/resource.h>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 
 // 3rd party libraries
 #include "lib/parson/parson.h"
@@ -31,14 +35,44 @@
 
 // Constants
 #define SERVER_NAME "expServer"
+#define MAX_WORKERS 1024
 #define LOCALHOST "127.0.0.1"
 #define DEFAULT_BACKLOG 64
 #define MAX_EPOLL_EVENTS 32
+#define MAX_SEND_IOVECS 64
 #define DEFAULT_NULLS_THRESH 32
 #define DEFAULT_BUFFER_SIZE 100000       // 100 KB
 #define DEFAULT_PIPE_BUFF_THRESH 1000000 // 1 MB
 #define DEFAULT_HTTP_REQ_TIMEOUT_MSEC 60000 // 60sec
 #define DEFAULT_METRICS_UPDATE_MSEC 500     // 500 msec
+#define METRICS_SNAPSHOT_TRIES 1000 // then a core's counts are taken as they are
+#define METRICS_HIST_SUB_BITS 5     // 32 buckets per power of two, so values are within 1/32
+#define METRICS_HIST_MAX_BITS 36    // latencies up to 2^36 usec, about 19 hours
+#define METRICS_HIST_BUCKETS ((METRICS_HIST_MAX_BITS - METRICS_HIST_SUB_BITS + 1) << METRICS_HIST_SUB_BITS)
+#define DEFAULT_UPSTREAM_POOL_SIZE 32           // idle connections per core
+#define DEFAULT_UPSTREAM_IDLE_TIMEOUT_MSEC 15000 // 15 sec
+#define DEFAULT_UPSTREAM_POOL_SWEEP_MSEC 1000    // 1 sec
+#define DEFAULT_HEALTH_CHECK_INTERVAL_MSEC 5000 // 5 sec
+#define DEFAULT_HEALTH_CHECK_TIMEOUT_MSEC 2000  // 2 sec
+#define DEFAULT_HEALTH_CHECK_TICK_MSEC 1000     // 1 sec
+#define DEFAULT_HEALTH_PROBE_FAILS 2            // failed active checks before ejection
+#define DEFAULT_HEALTH_MAX_FAILS 3              // failed proxied requests before ejection
+#define DEFAULT_HEALTH_EJECT_MSEC 10000         // 10 sec
+#define DEFAULT_EWMA_HALF_LIFE_MSEC 5000       // 5 sec
+#define MAX_UPSTREAM_WEIGHT 100
+#define DEFAULT_TCP_IDLE_TIMEOUT_MSEC 300000 // 5 min
+#define DEFAULT_UDP_IDLE_TIMEOUT_MSEC 30000 // 30 sec
+#define DEFAULT_UDP_BATCH_SIZE 32           // datagrams per recvmmsg()/sendmmsg()
+#define DEFAULT_UDP_DGRAM_SIZE 65535        // largest datagram, longer ones are dropped
+#define DEFAULT_UDP_MAX_FLOWS 4096          // client flows per listener per core
+#define DEFAULT_SPLICE_PIPE_SIZE 262144 // 256 KB kernel pipe per splice
+#define DEFAULT_SPLICE_MIN_BYTES 65536  // smaller bodies stay on the copy path
+#define MAGLEV_TABLE_SIZE 65537 // prime, must be well above the number of upstreams
+#define DEFAULT_DNS_TTL_MSEC 30000  // 30 sec
+#define DEFAULT_DNS_RETRY_MSEC 5000 // 5 sec
+#define DEFAULT_LOOKUP_CACHE_SIZE 1024     // cached lookups per core
+#define DEFAULT_LOOKUP_CACHE_TTL_MSEC 1000 // 1 sec, bounds how stale a file lookup can be
+#define DEFAULT_RELOAD_COLLECT_MSEC 1000 // 1 sec, how often drained configs are freed
 #define METRICS_HOST "0.0.0.0"
 #define METRICS_PORT 8004
 
@@ -67,23 +101,46 @@ struct xps_buffer_list_s;
 struct xps_pipe_s;
 struct xps_pipe_source_s;
 struct xps_pipe_sink_s;
+struct xps_splice_s;
 struct xps_file_s;
 struct xps_keyval_s {
   char *key;
   char *val;
 };
 struct xps_session_s;
+struct xps_tcp_session_s;
+struct xps_udp_proxy_s;
+struct xps_udp_flow_s;
 struct xps_http_req_s;
 struct xps_http_res_s;
+struct xps_http_res_template_s;
+struct xps_http_body_s;
 struct xps_config_s;
 struct xps_config_server_s;
 struct xps_config_listener_s;
 struct xps_config_route_s;
 struct xps_config_lookup_s;
+struct xps_config_route_node_s;
+struct xps_config_server_key_s;
+struct xps_config_cache_s;
+struct xps_config_cache_entry_s;
 struct xps_cliargs_s;
+struct xps_acl_s;
+struct xps_acl_node_s;
 struct xps_gzip_s;
 struct xps_timer_s;
 struct xps_metrics_s;
+struct xps_metrics_counts_s;
+struct xps_metrics_hist_s;
+struct xps_metrics_counters_s;
+struct xps_reload_retired_s;
+struct xps_reload_stats_s;
+struct xps_dns_entry_s;
+struct xps_dns_cache_s;
+struct xps_upstream_idle_s;
+struct xps_http_res_parser_s;
+struct xps_health_entry_s;
+struct xps_health_probe_s;
 
 // Struct typedefs
 typedef struct xps_core_s xps_core_t;
@@ -95,20 +152,43 @@ typedef struct xps_buffer_list_s xps_buffer_list_t;
 typedef struct xps_pipe_s xps_pipe_t;
 typedef struct xps_pipe_source_s xps_pipe_source_t;
 typedef struct xps_pipe_sink_s xps_pipe_sink_t;
+typedef struct xps_splice_s xps_splice_t;
 typedef struct xps_file_s xps_file_t;
 typedef struct xps_keyval_s xps_keyval_t;
 typedef struct xps_session_s xps_session_t;
+typedef struct xps_tcp_session_s xps_tcp_session_t;
+typedef struct xps_udp_proxy_s xps_udp_proxy_t;
+typedef struct xps_udp_flow_s xps_udp_flow_t;
 typedef struct xps_http_req_s xps_http_req_t;
 typedef struct xps_http_res_s xps_http_res_t;
+typedef struct xps_http_res_template_s xps_http_res_template_t;
+typedef struct xps_http_body_s xps_http_body_t;
 typedef struct xps_config_s xps_config_t;
 typedef struct xps_config_server_s xps_config_server_t;
 typedef struct xps_config_listener_s xps_config_listener_t;
 typedef struct xps_config_route_s xps_config_route_t;
 typedef struct xps_config_lookup_s xps_config_lookup_t;
+typedef struct xps_config_route_node_s xps_config_route_node_t;
+typedef struct xps_config_server_key_s xps_config_server_key_t;
+typedef struct xps_config_cache_s xps_config_cache_t;
+typedef struct xps_config_cache_entry_s xps_config_cache_entry_t;
 typedef struct xps_cliargs_s xps_cliargs_t;
+typedef struct xps_acl_s xps_acl_t;
+typedef struct xps_acl_node_s xps_acl_node_t;
 typedef struct xps_gzip_s xps_gzip_t;
 typedef struct xps_timer_s xps_timer_t;
 typedef struct xps_metrics_s xps_metrics_t;
+typedef struct xps_metrics_counts_s xps_metrics_counts_t;
+typedef struct xps_metrics_hist_s xps_metrics_hist_t;
+typedef struct xps_metrics_counters_s xps_metrics_counters_t;
+typedef struct xps_reload_retired_s xps_reload_retired_t;
+typedef struct xps_reload_stats_s xps_reload_stats_t;
+typedef struct xps_dns_entry_s xps_dns_entry_t;
+typedef struct xps_dns_cache_s xps_dns_cache_t;
+typedef struct xps_upstream_idle_s xps_upstream_idle_t;
+typedef struct xps_http_res_parser_s xps_http_res_parser_t;
+typedef struct xps_health_entry_s xps_health_entry_t;
+typedef struct xps_health_probe_s xps_health_probe_t;
 
 // Function typedefs
 typedef void (*xps_handler_t)(void *ptr);
@@ -123,18 +203,27 @@ extern int n_cores;
 #include "core/xps_loop.h"
 #include "core/xps_pipe.h"
 #include "core/xps_session.h"
+#include "core/xps_splice.h"
+#include "core/xps_tcp_session.h"
 #include "core/xps_timer.h"
+#include "core/xps_udp_proxy.h"
 #include "core/xps_metrics.h"
+#include "core/xps_reload.h"
 #include "disk/xps_directory.h"
 #include "disk/xps_file.h"
 #include "disk/xps_gzip.h"
 #include "disk/xps_mime.h"
 #include "http/xps_http.h"
+#include "http/xps_http_body.h"
 #include "http/xps_http_req.h"
 #include "http/xps_http_res.h"
+#include "http/xps_http_res_parser.h"
 #include "network/xps_connection.h"
+#include "network/xps_dns.h"
+#include "network/xps_health.h"
 #include "network/xps_listener.h"
 #include "network/xps_upstream.h"
+#include "utils/xps_acl.h"
 #include "utils/xps_buffer.h"
 #include "utils/xps_cliargs.h"
 #include "utils/xps_logger.h"